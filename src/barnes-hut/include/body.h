@@ -19,6 +19,8 @@ class Body {
         vec acc;
         /** mass, kg */
         scalar mass;
+        /** index of this body in the initial conditions (bodies get reordered in memory) */
+        int id;
 
         Body( );
         Body( scalar x, scalar y, scalar z, scalar vx, scalar vy, scalar vz, scalar m );
@@ -0,0 +1,67 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <stdint.h>
+
+#include <vector>
+
+#include "node.h"
+#include "pairs.h"
+#include "particles.h"
+
+#define CHECKPOINT_MAGIC "GLOBRCKP"
+#define CHECKPOINT_VERSION 6
+#define CHECKPOINT_KERNEL 16
+#define CHECKPOINT_RUN 64
+
+/**
+ * header of a checkpoint: everything a run needs to pick up exactly where it stopped.
+ *
+ * the header is followed by the particle arrays x, y, z, vx, vy, vz, ax, ay, az, m
+ * (scalar_size bytes per value), id and rung (int32), n values each, in tree order, and
+ * then the tree itself (nnodes raw Node structs) and the kepler pairs (npairs raw
+ * kepler_pair structs). the tree may have been refit a number
+ * of times since it was built, so there's no rebuilding it from the bodies; the restarted
+ * run picks up the very same tree and sums every force in the same order.
+ *
+ * the settings of the run ride along, so --restart doesn't need them repeated.
+*/
+struct checkpoint_header {
+    char magic[8]; /** "GLOBRCKP" */
+    int32_t version; /** CHECKPOINT_VERSION */
+    int32_t n; /** number of bodies */
+    int32_t ntree; /** bodies in the tree, the rest are escapers */
+    int32_t scalar_size; /** sizeof(scalar) of the run that wrote it */
+    int32_t node_size; /** sizeof(Node) of the run that wrote it */
+    int32_t nnodes; /** number of tree nodes */
+    int32_t npairs; /** number of kepler pairs */
+    int32_t step; /** next timestep to run */
+    double time; /** simulation time [s] */
+    double tsize; /** simulation domain, side length [m] */
+    double corner[3]; /** corner of the simulation domain [m] */
+
+    // settings of the run (see config in barnes-hut.cpp)
+    double dt; /** timestep [yr] */
+    double theta; /** opening criterion */
+    int32_t nstep, freq, checkpoint;
+    int32_t build, walk, group, leaf;
+    int32_t multipole, solver, fmm_order;
+    int32_t diag, format;
+    int32_t rungs; /** block timestep levels, 0 for one global step */
+    double eta; /** block timestep accuracy */
+    double refit; /** fraction of bodies out of their leaf before a rebuild */
+    double escape; /** escaper radius [pc], 0 for none */
+    int32_t soften; /** softening kernel (soften_mode) */
+    double eps; /** softening length [AU] */
+    double pairs; /** kepler pair semi-major axis limit [AU], 0 for none */
+    char kernel[CHECKPOINT_KERNEL]; /** force kernel name */
+    char run[CHECKPOINT_RUN]; /** name of the run (and its data directory) */
+};
+
+bool write_checkpoint( const char *fname, const checkpoint_header &h, const Particles &p, const std::vector<Node> &nodes,
+                       const std::vector<kepler_pair> &pairs );
+bool read_checkpoint_header( const char *fname, checkpoint_header &h );
+bool read_checkpoint( const char *fname, checkpoint_header &h, Particles &p, std::vector<Node> &nodes,
+                      std::vector<kepler_pair> &pairs );
+
+#endif
@@ -0,0 +1,65 @@
+#ifndef DIRECT_H
+#define DIRECT_H
+
+#include <vector>
+
+#include "kernels.h"
+#include "particles.h"
+#include "pool.h"
+#include "util.h"
+
+#define DIRECT_TILE 128
+
+/**
+ * direct sum accelerations of a sample of bodies, in double: what the force errors of
+ * the other solvers are measured against (see Octree::force_errors).
+*/
+struct force_reference {
+    std::vector<int> id; /** ids of the sampled bodies (rebuilds shuffle them around) */
+    std::vector<double> acc; /** their accelerations, 3 per body [m/s^2] */
+};
+
+/**
+ * direct summation solver: every pair of bodies, no tree and no approximation past the
+ * kernels' own roundoff. O(N^2), but every pair is only done once (newton's third law),
+ * and for a few thousand bodies that beats walking the tree.
+ *
+ * the bodies are cut into tiles of DIRECT_TILE, two of which fit in L1 together, and
+ * the tile kernels (see kernels.h) do every pair between two tiles. a round-robin
+ * schedule pairs every tile with every other one over ntile - 1 rounds, and no tile
+ * shows up twice in a round, so the pairs of a round run on any threads at once and
+ * still add both sides' pulls without locks. every body's sum comes out in the same
+ * order, bit for bit, whatever the number of threads.
+ *
+ * with a mask (block timesteps) most bodies don't need forces, and neither do the
+ * reactions; each tile of flagged bodies then sums over everybody with the regular
+ * force kernel instead, one side at a time. potentials (output steps only) go the same
+ * way.
+*/
+class Direct {
+
+    public:
+        Direct( );
+
+        void compute( Particles &p, int n, ThreadPool *pool, accel_kernel kernel, tile_kernel tkernel,
+                      const softening &soft, bool forces, bool potential, const char *mask = nullptr );
+        void reference( const Particles &p, int n, ThreadPool *pool, const softening &soft, int nsample,
+                        force_reference &ref ) const;
+
+    private:
+        /** per-thread scratch */
+        struct scratch {
+            tile a, b;
+            ilist src; /** every body, for the one-sided sums */
+        };
+
+        std::vector<scratch> work;
+        std::vector<double> acc; /** acceleration sums over the tile pairs so far, 3 per body [m/s^2] */
+
+        void load( tile &t, const Particles &p, int first, int count, vec o ) const;
+        void pairs( Particles &p, int n, ThreadPool *pool, tile_kernel tkernel, const softening &soft );
+        void one_sided( Particles &p, int n, ThreadPool *pool, accel_kernel kernel, const softening &soft,
+                        bool forces, bool potential, const char *mask );
+};
+
+#endif
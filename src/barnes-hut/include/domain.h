@@ -0,0 +1,98 @@
+#ifndef DOMAIN_H
+#define DOMAIN_H
+
+#include <mpi.h>
+#include <stdint.h>
+#include <vector>
+
+#include "particles.h"
+#include "tree.h"
+#include "util.h"
+
+/** one body on its way to another rank, see Domain::decompose */
+struct migrant {
+    scalar x, y, z;
+    scalar vx, vy, vz;
+    scalar m;
+    float cost;
+    int id;
+};
+
+/** a source sent to another rank for its force pass: a body, or a node as a point mass */
+struct ghost {
+    scalar x, y, z;
+    scalar m;
+};
+
+/** what the ranks did so far, see Domain::report */
+struct domain_stats {
+    long steps = 0; /** force passes */
+    long ghosts = 0; /** ghosts received, summed over the force passes */
+    long migrated = 0; /** bodies that moved to another rank */
+    double interactions = 0; /** summed in walk_tree, what the domains are balanced on */
+    double walk = 0; /** seconds in walk_tree */
+    double exchange = 0; /** seconds decomposing and swapping bodies and ghosts */
+};
+
+/**
+ * distributed memory version of a run: every mpi rank owns a share of the bodies in its
+ * own Octree, and they only ever see each other's through messages.
+ *
+ * the bodies are split along the morton (space filling) curve of the whole cluster:
+ * every rank gets one run of the curve, cut so that all runs cost about the same, going by
+ * how many interactions every body needed in its last walk (see Particles::cost). runs
+ * of the curve are compact in space, so the ranks' domains are too.
+ *
+ * for the forces every rank sends every other rank its locally essential tree: the
+ * nodes of its own tree that are far enough from the other rank's bodies to pass the
+ * opening test for all of them (the group walk's test, against the other rank's bounding
+ * box), as one point mass each, and the bodies of the leaves that aren't. those ghosts go
+ * into the tree next to the rank's own bodies for one walk, which only does the rank's
+ * own bodies, and come out again afterwards. nodes only go out as monopoles, whatever
+ * the multipole order.
+ *
+ * the integration is the tree's own global step, kick-drift-kick, with one force
+ * evaluation per step; block timesteps, kepler pairs and escapers aren't distributed.
+*/
+class Domain {
+
+    public:
+        MPI_Comm comm;
+        int rank; /** this rank */
+        int size; /** number of ranks */
+        long ntotal; /** bodies on all ranks together */
+        domain_stats stats;
+
+        double kenergy; /** total kinetic energy of all ranks [J], from the last compute_energy */
+        double penergy; /** total potential energy of all ranks [J], from the last compute_energy */
+        bool energies; /** false until compute_energy ran */
+
+        Domain( MPI_Comm comm );
+
+        void scatter( Octree &tree, int n, scalar *rows );
+        void decompose( Octree &tree );
+        void walk( Octree &tree, scalar theta, bool forces, bool potential );
+        void step( Octree &tree, scalar theta, scalar dt );
+        void compute_energy( Octree &tree, scalar theta );
+        bool write_snapshot( const char *fname, const Octree &tree, int step, scalar time, scalar theta ) const;
+        void report( ) const;
+
+    private:
+        bool have_acc; /** the bodies' accelerations are at their current positions */
+        scalar extent; /** side of the cube around all bodies, from the last decompose [m] */
+
+        std::vector<uint64_t> keys, kbuf;
+        std::vector<int> order, obuf;
+        std::vector<double> below; /** cost of everything left of each splitter */
+        std::vector<migrant> out, in;
+        std::vector<ghost> sent, got;
+        std::vector<int> scount, sdispl, rcount, rdispl;
+        std::vector<char> mine; /** per body in the combined tree, nonzero for this rank's own */
+        Particles pbuf;
+
+        void essential( const Octree &tree, int idx, vec bmin, vec bmax, scalar theta, std::vector<ghost> &list ) const;
+        long counts( );
+        void alltoallv( const void *send, void *recv, int unit );
+};
+
+#endif
@@ -0,0 +1,99 @@
+#ifndef FMM_H
+#define FMM_H
+
+#include <vector>
+
+#include "kernels.h"
+#include "node.h"
+#include "particles.h"
+#include "pool.h"
+#include "util.h"
+
+/**
+ * fast multipole solver on top of the octree: a cartesian taylor expansion of order p
+ * (multipoles and local expansions up to p-th derivatives of 1/r), evaluated with a
+ * dual tree walk in the style of dehnen's falcON.
+ *
+ * every node gets multipole moments about its center of mass (upward pass). pairs of
+ * nodes that are far enough apart, (rA + rB) < theta |cA - cB| with r the distance from
+ * the center of mass to the node's farthest body, interact once, cell to cell (M2L),
+ * instead of once for every body in them. the local expansions are then pushed down
+ * the tree (L2L) and evaluated at the bodies (L2P). pairs of close leaves are summed
+ * directly with the regular force kernels. the cost is O(N) for a fixed theta and p.
+ *
+ * the fmm has its own, coarser idea of a leaf: any node with at most `leaf` bodies.
+ * direct sums are cheap with the simd kernels and translations are not, so it pays to
+ * stop well above the tree's own buckets.
+ *
+ * the tree is cut into a fixed set of subtrees (tasks) that don't depend on the number
+ * of threads; each task collects everything acting on its bodies on its own, so results
+ * are bit-identical for any thread count.
+ *
+ * all expansions are kept in double, m * r^p is far past float range.
+ *
+ * softening carries over: with plummer the expansions are of the softened potential
+ * (see derivatives), and with the spline nothing within its softening length is
+ * expanded at all.
+*/
+class FMM {
+
+    public:
+        FMM( );
+
+        int order; /** expansion order p */
+        int leaf; /** nodes with at most this many bodies are leaves for the fmm */
+
+        void set_order( int p );
+        void compute( const std::vector<Node> &nodes, Particles &p, ThreadPool *pool, scalar theta,
+                      accel_kernel kernel, const softening &soft, bool forces, bool potential, const char *mask = nullptr );
+
+    private:
+        /** a close pair of leaves, summed directly */
+        struct leaf_pair {
+            int a, b; /** target leaf, source leaf */
+        };
+
+        /** per-thread scratch */
+        struct scratch {
+            std::vector<leaf_pair> pairs;
+            std::vector<double> d; /** derivatives of 1/r, (order + 1) * ncoef */
+            std::vector<double> pw; /** powers v^n / n! */
+            std::vector<int> stack;
+            ilist pp; /** bodies of all close leaves */
+        };
+
+        int ncoef; /** number of multi-indices (a, b, c) with a + b + c <= p */
+        int nlow; /** number of multi-indices of order < p */
+
+        // index tables, all built once in set_order. multi-indices are sorted by total order.
+        std::vector<int> total; /** a + b + c of every multi-index */
+        std::vector<int> rec_axis, rec_one, rec_two; /** recursions: axis, n - e_axis, n - 2 e_axis (or -1) */
+        std::vector<double> rec_n; /** n_axis of every multi-index */
+        std::vector<int> grad[3]; /** n + e_x, n + e_y, n + e_z for every n of order < p */
+        std::vector<int> sum_start, sum_m, sum_km; /** L2L: for every k, all m with |k + m| <= p, and k + m */
+        std::vector<int> m2l_start, m2l_m, m2l_km; /** M2L: same, minus the (zero) dipole terms */
+        std::vector<int> sub_start, sub_j, sub_kj; /** M2M: for every k, all j <= k, and k - j */
+
+        std::vector<double> M, L; /** multipoles and locals, ncoef per node */
+        std::vector<double> cx, cy, cz; /** expansion centers (centers of mass) [m] */
+        std::vector<double> rmax; /** distance from the center to the farthest body [m] */
+        std::vector<int> tasks; /** roots of the subtrees handed to the threads */
+        std::vector<scratch> work;
+
+        const Node *nd;
+        double theta2;
+        double eps2; /** plummer softening length squared, the expansions are of 1/sqrt(r^2 + eps^2) [m^2] */
+        double hsoft; /** spline softening length, pairs closer than this are summed directly [m] */
+
+        bool is_leaf( int i ) const { return !nd[i].is_internal() || nd[i].count <= leaf; }
+        void powers( double x, double y, double z, double *pw ) const;
+        void derivatives( double x, double y, double z, double *d ) const;
+
+        void upward( const Particles &p );
+        void interact( int a, int b, scratch &s );
+        void m2l( int a, int b, scratch &s );
+        void downward( int a, scratch &s );
+        void evaluate( int task, Particles &p, accel_kernel kernel, const softening &soft, bool forces, bool potential, const char *mask, scratch &s );
+};
+
+#endif
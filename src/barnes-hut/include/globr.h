@@ -0,0 +1,37 @@
+#ifndef GLOBR_H
+#define GLOBR_H
+
+/**
+ * the tree code as a library (libglobr.so / libglobr.a, make lib), for programs that
+ * keep their own bodies and want forces from the tree without going through files.
+ * C++ callers can use Octree directly (set_bodies, walk_tree, compute_forces,
+ * get_bodies, get_accelerations); this is the plain C version of the same, which is what
+ * the python bindings (python/globr.py) load.
+ *
+ * all arrays are in the caller's order and are read or written in place: positions,
+ * velocities and accelerations as x y z for every body (n x 3, row major), masses and
+ * potentials one per body. units are si, masses in solar masses (like the initial
+ * conditions files).
+*/
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct globr_tree globr_tree;
+
+globr_tree *globr_create( int nthreads );
+void globr_destroy( globr_tree *t );
+int globr_set_option( globr_tree *t, const char *name, const char *value );
+void globr_set_bodies( globr_tree *t, int n, const double *pos, const double *vel, const double *mass );
+int globr_count( const globr_tree *t );
+void globr_get_bodies( const globr_tree *t, double *pos, double *vel );
+void globr_accelerations( globr_tree *t, double theta, double *acc, double *pot );
+void globr_step( globr_tree *t, double theta, double dt, int nstep );
+void globr_energy( globr_tree *t, double theta, double *kenergy, double *penergy );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
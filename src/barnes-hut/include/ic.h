@@ -0,0 +1,52 @@
+#ifndef IC_H
+#define IC_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+#include "pool.h"
+#include "util.h"
+
+#define IC_MAGIC "GLOBRIC"
+#define IC_VERSION 1
+
+/** the rows of an initial conditions file, in file order */
+enum ic_row {
+    IC_X, IC_Y, IC_Z,       /** position [m] */
+    IC_VX, IC_VY, IC_VZ,    /** velocity [m/s] */
+    IC_M,                   /** mass [msun] */
+    IC_ROWS
+};
+
+/**
+ * header of a binary initial conditions file (written by initialConditions.save in
+ * initialConditionsBuilder.py). the header (16 bytes) is followed by IC_ROWS float32
+ * arrays of n values each, in ic_row order, little-endian.
+*/
+struct ic_header {
+    char magic[8]; /** "GLOBRIC" */
+    int32_t version; /** IC_VERSION */
+    int32_t n; /** number of bodies */
+};
+
+static_assert( sizeof(ic_header) == 16, "ic header has to stay 16 bytes" );
+
+/**
+ * initial conditions for every body, as loaded from --init.
+ *
+ * text files are what they've always been, seven whitespace separated rows of n values
+ * (x, y, z, vx, vy, vz, m); one line of seven values per body works too. n is whatever
+ * the file holds, nobody has to pass it in. binary files (see ic_header) are detected
+ * by their magic and mapped straight in.
+*/
+struct initial_conditions {
+    int n = 0; /** number of bodies */
+    std::vector<scalar> data; /** IC_ROWS arrays of n values */
+
+    scalar *row( int r ) { return data.data() + (size_t) r * n; }
+};
+
+bool load_initial_conditions( const char *fname, initial_conditions &ic, ThreadPool *pool );
+
+#endif
@@ -0,0 +1,116 @@
+#ifndef KERNELS_H
+#define KERNELS_H
+
+#include <vector>
+
+#include "util.h"
+
+/**
+ * number type the force kernels compute in: float, except in double builds. mixed builds
+ * keep the bodies in double but still run the kernels in float, 8 or 16 lanes wide, on
+ * positions measured from a point next to the target (see ilist) and sum their results
+ * in double.
+*/
+#ifdef GLOBR_DOUBLE
+typedef double kscalar;
+#else
+typedef float kscalar;
+#endif
+
+/**
+ * an interaction list: the point masses (single bodies or whole nodes) that act on one 
+ * target, gathered by the tree walk and then handed to a force kernel in one go. 
+ * stored as separate arrays so the kernels can load 8 or 16 sources at a time.
+ * 
+ * positions are stored relative to the list's origin, the target (or the middle of the
+ * group) it's gathered for. every source that matters up close is then a small number,
+ * which a float resolves fine even when the bodies themselves sit 1e17 m out in double.
+ * 
+ * the arrays only ever grow, so a list reused across walks stops allocating quickly.
+*/
+struct ilist {
+    std::vector<kscalar> x, y, z; /** source positions, relative to the origin [m] */
+    std::vector<kscalar> gm; /** source G * mass [m^3/s^2] */
+    scalar ox = 0, oy = 0, oz = 0; /** origin of the positions [m] */
+    int count = 0; /** number of sources in the list */
+
+    void clear( vec o ) { count = 0; ox = o.x; oy = o.y; oz = o.z; }
+
+    void push( scalar px, scalar py, scalar pz, scalar pgm ) {
+        if (count == (int) x.size()) {
+            size_t grow = x.empty() ? 256 : 2 * x.size();
+            x.resize( grow ); y.resize( grow ); z.resize( grow ); gm.resize( grow );
+        }
+        x[count] = (kscalar) (px - ox); y[count] = (kscalar) (py - oy); z[count] = (kscalar) (pz - oz);
+        gm[count] = (kscalar) pgm;
+        count++;
+    }
+};
+
+/** how gravity is softened at short distances */
+enum soften_mode {
+    SOFTEN_NONE,    /** plain newtonian 1/r^2 */
+    SOFTEN_PLUMMER, /** 1/(r^2 + eps^2): every pair feels a bit less, however far apart */
+    SOFTEN_SPLINE   /** cubic spline over h = 2.8 eps (monaghan & lattanzio): exactly newtonian beyond h */
+};
+
+/**
+ * softening of the force kernels, the same in forces and potentials. for the spline,
+ * eps is the plummer-equivalent softening (same potential depth at r = 0).
+*/
+struct softening {
+    soften_mode mode = SOFTEN_NONE;
+    scalar eps = 0; /** softening length [m] */
+
+    scalar eps2( ) const { return mode == SOFTEN_PLUMMER ? eps * eps : 0; }
+    scalar h( ) const { return mode == SOFTEN_SPLINE ? (scalar) 2.8 * eps : 0; }
+};
+
+/**
+ * a force kernel: sums the acceleration that every source in a list exerts on a target 
+ * at (tx, ty, tz). all variants do the same math; they only differ in how many sources
+ * they handle per instruction.
+*/
+typedef vec (*accel_kernel)( scalar tx, scalar ty, scalar tz, const ilist &src, const softening &soft );
+
+vec accel_scalar( scalar tx, scalar ty, scalar tz, const ilist &src, const softening &soft );
+vec accel_avx2( scalar tx, scalar ty, scalar tz, const ilist &src, const softening &soft );
+vec accel_avx512( scalar tx, scalar ty, scalar tz, const ilist &src, const softening &soft );
+
+double potential_sum( scalar tx, scalar ty, scalar tz, const ilist &src, const softening &soft );
+
+accel_kernel pick_kernel( const char *name, const char **picked );
+
+/**
+ * a tile of the direct solver (see direct.h): a block of bodies, positions relative to
+ * an origin shared with the tile it's paired with, and the accelerations summed over
+ * that pair. stored as separate arrays, like ilist.
+*/
+struct tile {
+    std::vector<kscalar> x, y, z; /** positions, relative to the origin [m] */
+    std::vector<kscalar> gm; /** G * mass [m^3/s^2] */
+    std::vector<kscalar> ax, ay, az; /** accelerations from the other tile [m/s^2] */
+    int count = 0; /** number of bodies in the tile */
+
+    void resize( int n ) {
+        x.resize( n ); y.resize( n ); z.resize( n ); gm.resize( n );
+        ax.assign( n, 0 ); ay.assign( n, 0 ); az.assign( n, 0 );
+        count = n;
+    }
+};
+
+/**
+ * a tile kernel: adds the pull of every body of b to every body of a and, by newton's
+ * third law, the opposite pull to b, so each pair costs one distance and one square
+ * root. a and b can be the same tile, then every pair in it is done once. same variants
+ * as the force kernels.
+*/
+typedef void (*tile_kernel)( tile &a, tile &b, const softening &soft );
+
+void tile_scalar( tile &a, tile &b, const softening &soft );
+void tile_avx2( tile &a, tile &b, const softening &soft );
+void tile_avx512( tile &a, tile &b, const softening &soft );
+
+tile_kernel pick_tile_kernel( const char *picked );
+
+#endif
@@ -0,0 +1,78 @@
+#ifndef MORTON_H
+#define MORTON_H
+
+#include <stdint.h>
+#include <vector>
+
+#include "pool.h"
+#include "util.h"
+
+#define MORTON_BITS 21 // bits per axis, 3 * 21 = 63-bit keys
+
+/**
+ * spreads the lowest 21 bits of v out so there are two zero bits between each of them
+ * (bit i moves to bit 3i), ready to be interleaved with the other two axes.
+ * 
+ * @param v integer grid coordinate, 0 <= v < 2^21
+ * 
+ * @returns v with its bits spread over 63 bits.
+*/
+inline uint64_t spread_bits( uint64_t v ) {
+    v &= 0x1fffff;
+    v = (v | (v << 32)) & 0x001f00000000ffffULL;
+    v = (v | (v << 16)) & 0x001f0000ff0000ffULL;
+    v = (v | (v << 8))  & 0x100f00f00f00f00fULL;
+    v = (v | (v << 4))  & 0x10c30c30c30c30c3ULL;
+    v = (v | (v << 2))  & 0x1249249249249249ULL;
+    return v;
+}
+
+/**
+ * calculates the 63-bit morton (z-order) key of a position inside a cubic domain.
+ * the top three bits pick the octant at the first level of the tree, the next three
+ * the octant inside that, and so on. positions outside the domain are clamped onto
+ * its edge.
+ * 
+ * @param pos position of the body [m]
+ * @param corner corner coordinates of the domain [m]
+ * @param dx side length of the domain [m]
+ * 
+ * @returns the morton key, x bits above y bits above z bits at every level.
+*/
+inline uint64_t morton_key( vec pos, vec corner, scalar dx ) {
+    const double cells = (double) (1 << MORTON_BITS);
+    double scale = cells / dx;
+    double f[3] = { (pos.x - (double) corner.x) * scale,
+                    (pos.y - (double) corner.y) * scale,
+                    (pos.z - (double) corner.z) * scale };
+    uint64_t ix[3];
+
+    for (int k = 0; k < 3; k++) {
+        if (!(f[k] > 0)) f[k] = 0; // also catches nan
+        if (f[k] > cells - 1) f[k] = cells - 1;
+        ix[k] = (uint64_t) f[k];
+    }
+
+    return (spread_bits(ix[0]) << 2) | (spread_bits(ix[1]) << 1) | spread_bits(ix[2]);
+}
+
+/**
+ * converts a 3-bit morton digit (x, y, z bit) into the octant numbering used by 
+ * get_quadrant and get_new_corner.
+ * 
+ * @param d morton digit, 0-7
+ * 
+ * @returns the matching octant, 0-7.
+*/
+inline int morton_octant( int d ) {
+    int xb = (d >> 2) & 1;
+    int yb = (d >> 1) & 1;
+    int q = xb ? (yb ? 2 : 3) : (yb ? 1 : 0);
+    if (d & 1) q += 4;
+    return q;
+}
+
+void sort_keys( std::vector<uint64_t> &keys, std::vector<int> &idx, 
+                std::vector<uint64_t> &kbuf, std::vector<int> &ibuf, ThreadPool *pool );
+
+#endif
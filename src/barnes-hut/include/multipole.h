@@ -0,0 +1,86 @@
+#ifndef MULTIPOLE_H
+#define MULTIPOLE_H
+
+#include <vector>
+
+#include "kernels.h"
+#include "util.h"
+
+/** how many terms of a node's multipole expansion the far field uses */
+enum multipole_order {
+    ORDER_MONOPOLE = 0,     /** point mass at the center of mass (classic barnes-hut) */
+    ORDER_QUADRUPOLE = 2,   /** + quadrupole (the dipole vanishes about the center of mass) */
+    ORDER_OCTUPOLE = 3      /** + octupole */
+};
+
+/**
+ * higher moments of the mass in one node, about the node's center of mass. kept next
+ * to (not inside) the nodes, so a monopole-only walk doesn't drag them through the cache.
+ *
+ * the upward pass works on the raw moments (sum of m d_i d_j and m d_i d_j d_k, with
+ * d = x - com) in double, since those shift cleanly from child to parent and m * r^3 in
+ * si units is way past what a float holds. finish() then turns them into the trace-free
+ * quadrupole and octupole the kernels use, times G and divided by powers of the node
+ * size h, which brings them back into float range.
+ *
+ * with plummer softening the expansion is of the softened potential, 1/sqrt(r^2 + eps^2)
+ * instead of 1/r. that one isn't harmonic, so the traces the trace-free moments leave
+ * out come back in as terms of order eps^2; tr and v keep them.
+ *
+ * component order, s and q: xx yy zz xy xz yz
+ *                  t and o: xxx yyy zzz xxy xxz xyy yyz xzz yzz xyz
+*/
+struct multipole {
+    double cx, cy, cz; /** center of mass, same as the node's [m] */
+    double s[6]; /** raw second moments [kg m^2] */
+    double t[10]; /** raw third moments [kg m^3] */
+    scalar q[6]; /** G * trace-free quadrupole / h^2 [m^3/s^2] */
+    scalar o[10]; /** G * trace-free octupole / h^3 [m^3/s^2] */
+    scalar tr; /** G * trace of s / h^2 [m^3/s^2] */
+    scalar v[3]; /** G * t_ijj / h^3 [m^3/s^2] */
+
+    void clear( );
+    void add_body( double m, double dx, double dy, double dz, int order );
+    void add_child( const multipole &c, double mc, int order );
+    void finish( scalar h, int order );
+};
+
+/**
+ * the interaction list for accepted nodes above monopole order: point mass and moments
+ * of every node, stored as separate arrays like ilist so the kernels can load 8 or 16
+ * nodes at a time, with the centers relative to an origin like there. only ever grows,
+ * and is reused between walks.
+*/
+struct mlist {
+    const multipole *base = nullptr; /** the tree's moments, indexed like its nodes */
+    int order = ORDER_QUADRUPOLE; /** highest term to evaluate */
+    std::vector<kscalar> x, y, z; /** centers of mass, relative to the origin [m] */
+    std::vector<kscalar> gm; /** G * mass [m^3/s^2] */
+    std::vector<kscalar> h; /** node sizes [m] */
+    std::vector<kscalar> q[6], o[10]; /** scaled moments, see multipole */
+    std::vector<kscalar> tr, v[3]; /** scaled traces, for plummer softening, see multipole */
+    scalar near = 0; /** nodes closer than this go in the particle-cell list instead: the spline softening length, see Node::get_force */
+    scalar ox = 0, oy = 0, oz = 0; /** origin of the centers [m] */
+    int count = 0; /** number of nodes in the list */
+
+    void clear( vec o ) { count = 0; ox = o.x; oy = o.y; oz = o.z; }
+    void push( int node, scalar pgm, scalar ph );
+};
+
+/**
+ * a multipole kernel: acceleration of a target at (tx, ty, tz) from every node in the
+ * list, monopole included, plummer softened like the plain force kernels (see kernels.h)
+ * and with the same variants. the spline is newtonian past its softening length, which
+ * is what the list's near keeps the nodes at.
+*/
+typedef vec (*multipole_kernel)( scalar tx, scalar ty, scalar tz, const mlist &src, const softening &soft );
+
+vec multipole_scalar( scalar tx, scalar ty, scalar tz, const mlist &src, const softening &soft );
+vec multipole_avx2( scalar tx, scalar ty, scalar tz, const mlist &src, const softening &soft );
+vec multipole_avx512( scalar tx, scalar ty, scalar tz, const mlist &src, const softening &soft );
+
+double potential_multipole( scalar tx, scalar ty, scalar tz, const mlist &src, const softening &soft );
+
+multipole_kernel pick_multipole_kernel( const char *picked );
+
+#endif
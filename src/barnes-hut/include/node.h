@@ -1,32 +1,63 @@
 #ifndef NODE_H
 #define NODE_H
 
+#include <vector>
+
 #include "util.h"
-#include "body.h"
+#include "kernels.h"
+#include "multipole.h"
+#include "particles.h"
+
+/**
+ * the tree cut into subtrees for the upward pass (see Octree::refit): the topmost nodes
+ * with few enough bodies, which together hold every body once, in body order. their
+ * subtrees are fit on their own, in parallel, and the pass over the nodes above them
+ * takes their results from here instead of going down into them again.
+*/
+struct upward_cut {
+    std::vector<int> slot; /** per node, the index of its subtree if it's the root of one, -1 if not */
+    std::vector<int> root; /** root node of every subtree */
+    std::vector<int> migrants; /** per subtree, bodies outside their leaf's cell, from its last fit */
+    std::vector<vec> lo, hi; /** per subtree, box around its bodies, from its last fit */
+};
 
+/**
+ * a single cell of the octree. nodes live next to each other in one flat array
+ * owned by the Octree (see Octree::nodes) and refer to each other by index, so the
+ * tree can be thrown away and rebuilt every step without touching the heap.
+ * 
+ * bodies are kept in tree order, so every node owns the contiguous range 
+ * [first, first + count) of the particle arrays. leaves are buckets of up to 
+ * Octree::leaf_size bodies.
+*/
 class Node {
 
     public:
         scalar mass; /** total mass in node [kg] */
         scalar dx; /** node size (physical) [m] */
+        scalar size; /** side of the cube around the cell's center that holds all its bodies, what the opening test uses. dx, unless a refit left bodies outside the cell */
         int nchildren; /** total number of child nodes */
         vec corner; /** coordinates of upper left corner */
         vec com; /** position of center of mass */
 
-        Node* parent; /** parent node in the tree */
-        Node* children[8]; /** list of pointers to child nodes */
-        Body* particle; /** particle/body contained in node */
+        int parent; /** index of the parent node in the tree, -1 for the root */
+        int children[8]; /** indices of child nodes, -1 if there is no child in that octant */
+        int first; /** first body of this node in the particle arrays (list head while inserting) */
+        int count; /** number of bodies inside this node */
 
-        Node( vec c, scalar s);
-        ~Node();
+        Node( vec c, scalar s, int p = -1 );
 
-        bool is_internal( );
-        bool contains( vec v );
-        void insert( Body* b);
+        bool is_internal( ) const;
+        bool contains( vec v ) const;
+        bool owns( int i ) const { return i >= first && i < first + count; }
 
-        void update_mass( ) ;
-        vec get_force( Body* b, scalar theta );
+        int update_mass( Node* nodes, const Particles &p, multipole *mp = nullptr, int order = ORDER_MONOPOLE, 
+                         vec *lo = nullptr, vec *hi = nullptr, const upward_cut *done = nullptr ) ;
+        void get_force( const Node* nodes, const Particles &p, int i, scalar theta, ilist &pp, ilist &pc, 
+                        mlist *pm = nullptr ) const;
+        void get_force_group( const Node* nodes, const Particles &p, const Node &group, vec bmin, vec bmax, 
+                              scalar theta, ilist &pp, ilist &pc, mlist *pm = nullptr ) const;
 
 };
 
-#endif
\ No newline at end of file
+#endif
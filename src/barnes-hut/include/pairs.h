@@ -0,0 +1,23 @@
+#ifndef PAIRS_H
+#define PAIRS_H
+
+/**
+ * a tight binary taken out of the leapfrog and moved on its exact kepler orbit instead
+ * (see Octree::set_pairs).
+ *
+ * in the particle arrays the pair is packed into its first member: a carries the center
+ * of mass position and velocity and the total mass, b sits on top of a with mass zero.
+ * the tree (and every other body) only ever sees the pair as one point mass. the orbit
+ * itself is kept here, relative and in double: a star a few solar radii from its partner
+ * is far below float resolution at cluster coordinates.
+*/
+struct kepler_pair {
+    int a, b; /** ids of the members */
+    double ma, mb; /** masses of the members [kg] */
+    double r[3]; /** position of b relative to a [m] */
+    double v[3]; /** velocity of b relative to a [m/s] */
+};
+
+void kepler_drift( double gm, double *r, double *v, double dt );
+
+#endif
@@ -0,0 +1,41 @@
+#ifndef PARTICLES_H
+#define PARTICLES_H
+
+#include <vector>
+
+#include "pool.h"
+#include "util.h"
+
+/**
+ * structure-of-arrays storage for every body in the simulation. each quantity lives in
+ * its own contiguous array, so the kick/drift loops and the force kernels stream through
+ * memory and can be vectorised.
+ * 
+ * the tree keeps these arrays in tree (z-) order, so every node owns one contiguous
+ * range [first, first + count) of them; id maps back to the initial conditions.
+*/
+class Particles {
+
+    public:
+        int n; /** number of bodies */
+
+        std::vector<scalar> x, y, z; /** positions [m] */
+        std::vector<scalar> vx, vy, vz; /** velocities [m/s] */
+        std::vector<scalar> ax, ay, az; /** accelerations [m/s^2] */
+        std::vector<scalar> m; /** masses [kg] */
+        std::vector<scalar> pot; /** gravitational potential at each body, filled by Octree::compute_energy [J/kg] */
+        std::vector<int> id; /** index of each body in the initial conditions */
+        std::vector<int> rung; /** block timestep level, each body steps with dt / 2^rung */
+        std::vector<float> cost; /** interactions summed for this body in the last tree walk that did it, what the mpi domains are balanced on */
+
+        Particles( );
+
+        void resize( int n );
+        void permute( const std::vector<int> &order, Particles &scratch, ThreadPool *pool );
+
+        vec pos( int i ) const { return vec( x[i], y[i], z[i] ); }
+        vec vel( int i ) const { return vec( vx[i], vy[i], vz[i] ); }
+        vec acc( int i ) const { return vec( ax[i], ay[i], az[i] ); }
+};
+
+#endif
@@ -0,0 +1,106 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * a small persistent thread pool for the per-body loops in the tree code.
+ *
+ * work is handed out with range-based work stealing: the loop [0, n) is cut into one
+ * contiguous block per thread, each thread eats its own block chunk by chunk, and
+ * once it runs dry it steals chunks from the other blocks. tree walks in a cluster core
+ * cost far more than walks in the halo, so a static split would leave most threads idle.
+ *
+ * the calling thread always takes part as thread 0, so a pool of size 1 spawns nothing
+ * and runs the loop serially.
+*/
+class TaskGraph;
+
+class ThreadPool {
+
+    public:
+        ThreadPool( int nthreads );
+        ~ThreadPool( );
+
+        int size( ) const { return nthreads; }
+
+        void parallel_for( int n, int chunk, const std::function<void(int, int, int)> &fn );
+        void run_graph( TaskGraph &g );
+
+    private:
+        /** one stealable range of work, padded so neighbouring blocks don't share a cache line */
+        struct block {
+            std::atomic<int> next;
+            int end;
+            char pad[64 - sizeof(std::atomic<int>) - sizeof(int)];
+        };
+
+        int nthreads; /** total threads, including the caller */
+        std::vector<std::thread> workers; /** nthreads - 1 helper threads */
+        block *blocks; /** one block of the current loop per thread */
+
+        std::mutex lock;
+        std::condition_variable wake; /** signals helpers that a new loop is ready */
+        std::condition_variable done; /** signals the caller that all helpers finished */
+
+        const std::function<void(int, int, int)> *job; /** loop body of the current parallel_for */
+        int chunk; /** iterations grabbed per steal */
+        unsigned long generation; /** bumped once per parallel_for */
+        int busy; /** helpers still working on the current loop */
+        bool stop;
+
+        void worker( int tid );
+        void run( int tid );
+};
+
+/**
+ * coarse tasks and the order they have to run in, for ThreadPool::run_graph: a task
+ * starts once every task it was put after has finished, on whichever thread is free,
+ * so independent chains of work (one per subtree, say) overlap instead of every stage
+ * waiting for the whole of the last one.
+ *
+ * every task carries a stage (a small integer of the caller's, the tree code uses its
+ * profile phases). in profiling builds the run adds up the time the threads spent in
+ * every stage, which next to the run's wall time says how busy the pool was and with
+ * what.
+*/
+class TaskGraph {
+
+    public:
+        std::vector<double> busy; /** thread-seconds spent in every stage's tasks in the last run, GLOBR_PROFILE builds only */
+        double span; /** wall time of the last run [s], GLOBR_PROFILE builds only */
+
+        TaskGraph( ) : span( 0 ), left( 0 ) {}
+
+        int add( int stage, const std::function<void(int)> &fn );
+        void after( int task, int before );
+        void clear( );
+        int size( ) const { return (int) tasks.size(); }
+
+    private:
+        friend class ThreadPool;
+
+        struct task {
+            int stage;
+            std::function<void(int)> fn; /** the work, called with the index of the thread it runs on */
+            std::vector<int> next; /** tasks waiting for this one */
+            int waits; /** tasks this one waits for */
+        };
+
+        std::vector<task> tasks;
+        std::vector<int> pending; /** while running: unfinished tasks every task still waits for */
+        std::vector<int> ready; /** while running: tasks free to start, taken from the back */
+        int left; /** while running: unfinished tasks */
+
+        std::mutex lock;
+        std::condition_variable wake; /** signals idle threads that tasks got ready, or that all are done */
+
+        void drain( int tid );
+};
+
+#endif
@@ -0,0 +1,81 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+/**
+ * step profiling: wall times of the phases of a step, and how much work the tree walks
+ * did. all of it is compiled in only with -DGLOBR_PROFILE (make PROFILE=1); otherwise
+ * the macros below are empty and the hot loops don't pay for a single counter.
+*/
+
+/** the phases of a step that get timed */
+enum profile_phase {
+    PHASE_BUILD,    /** tree builds, rebuild_tree (without their upward pass) */
+    PHASE_UPWARD,   /** upward passes, Node::update_mass (refits and after builds) */
+    PHASE_WALK,     /** tree walks and force sums, forces and potentials */
+    PHASE_KICK,     /** velocity updates */
+    PHASE_DRIFT,    /** position updates, kepler pairs included */
+    PHASE_OUTPUT,   /** snapshots, up to where the writer takes over */
+    NPHASES
+};
+
+extern const char *const phase_names[NPHASES];
+
+/**
+ * timings and counters, of one step or summed over many.
+ *
+ * phases that run as tasks of a graph (see Octree::step_graph) overlap, so for those
+ * time is the phase's share of the graph's wall time: its thread-seconds over the
+ * number of threads. busy and span say how well the overlap filled the threads.
+*/
+struct step_profile {
+    double time[NPHASES] = {}; /** wall time per phase [s] */
+    double busy[NPHASES] = {}; /** thread-seconds per phase in task graphs [s] */
+    double span = 0; /** wall time of the task graphs [s] */
+    int threads = 0; /** threads that ran the task graphs */
+    long walks = 0; /** tree walks */
+    long opened = 0; /** nodes opened by the walks */
+    long pp = 0; /** particle-particle interactions */
+    long pc = 0; /** particle-cell interactions, multipole terms included */
+
+    void add( const step_profile &s ) {
+        for (int k = 0; k < NPHASES; k++) { time[k] += s.time[k]; busy[k] += s.busy[k]; }
+        span += s.span;
+        if (s.threads > 0) threads = s.threads;
+        walks += s.walks; opened += s.opened; pp += s.pp; pc += s.pc;
+    }
+
+    /** fraction of the threads' time in the task graphs that went to phase k */
+    double utilisation( int k ) const { return span > 0 ? busy[k] / (span * threads) : 0.0; }
+};
+
+#ifdef GLOBR_PROFILE
+
+#include <chrono>
+
+/** adds the wall time of its own lifetime to a slot */
+class profile_timer {
+    public:
+        profile_timer( double &slot ) : slot( slot ), start( std::chrono::steady_clock::now() ) {}
+        ~profile_timer( ) { slot += std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count(); }
+    private:
+        double &slot;
+        std::chrono::steady_clock::time_point start;
+};
+
+extern thread_local long profile_openings; /** nodes opened by this thread's walks */
+
+#define PROFILE_CONCAT2( a, b ) a##b
+#define PROFILE_CONCAT( a, b ) PROFILE_CONCAT2( a, b )
+#define PROFILE_SCOPE( prof, phase ) profile_timer PROFILE_CONCAT( profile_timer_, __LINE__ )( (prof).time[phase] )
+#define PROFILE_COUNT( counter ) (++(counter))
+#define PROFILE_ONLY( code ) code
+
+#else
+
+#define PROFILE_SCOPE( prof, phase )
+#define PROFILE_COUNT( counter )
+#define PROFILE_ONLY( code )
+
+#endif
+
+#endif
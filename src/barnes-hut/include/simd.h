@@ -0,0 +1,93 @@
+#ifndef SIMD_H
+#define SIMD_H
+
+/**
+ * bits shared by the vector kernels in kernels.cpp and multipole.cpp. those are written
+ * for float lanes, so they're only built on x86 and when kscalar is float; double builds
+ * run the scalar kernels instead.
+*/
+#if (defined(__x86_64__) || defined(__i386__)) && !defined(GLOBR_DOUBLE)
+#define SIMD_X86
+#include <immintrin.h>
+
+/**
+ * running sum of 8 float lanes, the accumulator of the avx2 kernels. mixed builds
+ * (GLOBR_MIXED) widen every term to double before it's added, so a list of thousands of
+ * sources sums up no worse than in a double build.
+*/
+struct sum8 {
+#ifdef GLOBR_MIXED
+    __m256d lo, hi;
+
+    __attribute__((target("avx2,fma"))) sum8( ) : lo( _mm256_setzero_pd() ), hi( _mm256_setzero_pd() ) {}
+
+    /** adds a * b, lane by lane */
+    __attribute__((target("avx2,fma"))) void fma( __m256 a, __m256 b ) {
+        __m256 t = _mm256_mul_ps( a, b );
+        lo = _mm256_add_pd( lo, _mm256_cvtps_pd( _mm256_castps256_ps128( t ) ) );
+        hi = _mm256_add_pd( hi, _mm256_cvtps_pd( _mm256_extractf128_ps( t, 1 ) ) );
+    }
+
+    /** adds a, lane by lane */
+    __attribute__((target("avx2,fma"))) void add( __m256 a ) {
+        lo = _mm256_add_pd( lo, _mm256_cvtps_pd( _mm256_castps256_ps128( a ) ) );
+        hi = _mm256_add_pd( hi, _mm256_cvtps_pd( _mm256_extractf128_ps( a, 1 ) ) );
+    }
+
+    /** adds up the lanes */
+    __attribute__((target("avx2,fma"))) double total( ) const {
+        __m256d s = _mm256_add_pd( lo, hi );
+        __m128d t = _mm_add_pd( _mm256_castpd256_pd128( s ), _mm256_extractf128_pd( s, 1 ) );
+        return _mm_cvtsd_f64( _mm_add_sd( t, _mm_unpackhi_pd( t, t ) ) );
+    }
+#else
+    __m256 s;
+
+    __attribute__((target("avx2,fma"))) sum8( ) : s( _mm256_setzero_ps() ) {}
+    __attribute__((target("avx2,fma"))) void fma( __m256 a, __m256 b ) { s = _mm256_fmadd_ps( a, b, s ); }
+    __attribute__((target("avx2,fma"))) void add( __m256 a ) { s = _mm256_add_ps( s, a ); }
+
+    __attribute__((target("avx2,fma"))) float total( ) const {
+        __m128 t = _mm_add_ps( _mm256_castps256_ps128( s ), _mm256_extractf128_ps( s, 1 ) );
+        t = _mm_add_ps( t, _mm_movehl_ps( t, t ) );
+        t = _mm_add_ss( t, _mm_shuffle_ps( t, t, 1 ) );
+        return _mm_cvtss_f32( t );
+    }
+#endif
+};
+
+// gcc 12's avx-512 headers trip -Wuninitialized on their own _mm512_undefined_ps() placeholders
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+
+/** running sum of 16 float lanes, for the avx-512 kernels. same as sum8. */
+struct sum16 {
+#ifdef GLOBR_MIXED
+    __m512d lo, hi;
+
+    __attribute__((target("avx512f"))) sum16( ) : lo( _mm512_setzero_pd() ), hi( _mm512_setzero_pd() ) {}
+
+    __attribute__((target("avx512f"))) void fma( __m512 a, __m512 b ) { add( _mm512_mul_ps( a, b ) ); }
+
+    __attribute__((target("avx512f"))) void add( __m512 a ) {
+        lo = _mm512_add_pd( lo, _mm512_cvtps_pd( _mm512_castps512_ps256( a ) ) );
+        hi = _mm512_add_pd( hi, _mm512_cvtps_pd( _mm256_castpd_ps( _mm512_extractf64x4_pd( _mm512_castps_pd( a ), 1 ) ) ) );
+    }
+
+    __attribute__((target("avx512f"))) double total( ) const { return _mm512_reduce_add_pd( _mm512_add_pd( lo, hi ) ); }
+#else
+    __m512 s;
+
+    __attribute__((target("avx512f"))) sum16( ) : s( _mm512_setzero_ps() ) {}
+    __attribute__((target("avx512f"))) void fma( __m512 a, __m512 b ) { s = _mm512_fmadd_ps( a, b, s ); }
+    __attribute__((target("avx512f"))) void add( __m512 a ) { s = _mm512_add_ps( s, a ); }
+    __attribute__((target("avx512f"))) float total( ) const { return _mm512_reduce_add_ps( s ); }
+#endif
+};
+
+#pragma GCC diagnostic pop
+
+#endif
+
+#endif
@@ -0,0 +1,110 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define SNAPSHOT_MAGIC "GLOBRSNP"
+#define SNAPSHOT_VERSION 1
+
+/** how output steps are written */
+enum snapshot_format {
+    FORMAT_BINARY,  /** .snap, fixed header + raw float arrays, see snapshot_header */
+    FORMAT_TEXT     /** .dat, the old human readable table (positions and masses only) */
+};
+
+/** the per-body arrays of a snapshot, in the order they sit in the file */
+enum snapshot_field {
+    FIELD_M,        /** mass [kg] */
+    FIELD_X,        /** position [m] */
+    FIELD_Y,
+    FIELD_Z,
+    FIELD_VX,       /** velocity [m/s] */
+    FIELD_VY,
+    FIELD_VZ,
+    NFIELDS
+};
+
+/**
+ * header of a binary snapshot. the file is this header (64 bytes), followed by NFIELDS
+ * float32 arrays of n values each, in snapshot_field order. bodies are in initial
+ * conditions order, everything is in si units and native (little-endian) byte order.
+ *
+ * every array starts at a fixed offset (64 + 4 n f), so the whole file can be
+ * memory mapped and used as is, without parsing anything (see viz/viz.py).
+*/
+struct snapshot_header {
+    char magic[8]; /** "GLOBRSNP" */
+    int32_t version; /** SNAPSHOT_VERSION */
+    int32_t n; /** number of bodies */
+    int32_t step; /** timestep */
+    int32_t energies; /** 1 if kenergy and penergy were computed for this step */
+    double time; /** simulation time [s] */
+    double theta; /** opening criterion */
+    double size; /** simulation domain, side length [m] */
+    double kenergy; /** total kinetic energy [J] */
+    double penergy; /** total potential energy [J] */
+};
+
+static_assert( sizeof(snapshot_header) == 64, "snapshot header has to stay 64 bytes" );
+
+/** one output step, header and body data, ready to be written out */
+struct snapshot {
+    snapshot_header head;
+    std::vector<float> data; /** NFIELDS arrays of head.n values */
+
+    void resize( int n );
+    float *field( int f ) { return data.data() + (size_t) f * head.n; }
+    const float *field( int f ) const { return data.data() + (size_t) f * head.n; }
+};
+
+bool write_binary( const char *fname, const snapshot &s );
+bool write_text( const char *fname, const snapshot &s );
+bool read_binary( const char *fname, snapshot &s );
+
+/**
+ * writes snapshots on a background thread, so the next steps of the simulation run
+ * while the last one goes to disk.
+ *
+ * double buffered: the simulation fills one snapshot while the writer works on the
+ * other. buffer() hands out the free one and blocks if both are still waiting to be
+ * written (back-pressure, the simulation never gets more than one output ahead), and
+ * submit() queues it. the destructor writes out whatever is left.
+ *
+ * files go to DATPATH/{run}/globr_{run}_0000000.snap (or .dat), the directories are
+ * made once, up front.
+*/
+class SnapshotWriter {
+
+    public:
+        SnapshotWriter( const char *run, snapshot_format format );
+        ~SnapshotWriter( );
+
+        snapshot &buffer( );
+        void submit( );
+        void flush( );
+
+    private:
+        std::string run; /** name of the run, for the file names */
+        snapshot_format format;
+
+        snapshot bufs[2];
+        bool queued[2]; /** true from submit() until the buffer is on disk */
+        int filling; /** buffer the simulation fills next */
+        int writing; /** buffer the writer takes next */
+        bool stop;
+
+        std::mutex lock;
+        std::condition_variable ready; /** signals the writer that a buffer was queued */
+        std::condition_variable freed; /** signals the simulation that a buffer was written */
+        std::thread worker;
+
+        void loop( );
+};
+
+#endif
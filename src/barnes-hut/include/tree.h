@@ -2,38 +2,206 @@
 #define TREE_H
 
 #include <math.h>
+#include <stdint.h>
 #include <vector>
 
 #include "body.h"
+#include "checkpoint.h"
+#include "direct.h"
+#include "fmm.h"
+#include "kernels.h"
+#include "multipole.h"
 #include "node.h"
+#include "pairs.h"
+#include "particles.h"
+#include "pool.h"
+#include "profile.h"
+#include "snapshot.h"
 #include "util.h"
 
+/** how the tree is built every step */
+enum build_mode {
+    BUILD_INSERT,   /** one body at a time from the root */
+    BUILD_MORTON    /** bulk build from radix-sorted morton keys */
+};
+
+/** what computes the forces */
+enum solver_mode {
+    SOLVER_TREE,    /** barnes-hut tree walk */
+    SOLVER_FMM,     /** fast multipole method on the same tree */
+    SOLVER_DIRECT   /** every pair of bodies, no approximation */
+};
+
+/** how the force pass walks the tree */
+enum walk_mode {
+    WALK_BODY,      /** one walk per body */
+    WALK_GROUP      /** one walk per group of nearby bodies, shared by all of them */
+};
+
+/** how often the tree was refit or rebuilt after a drift, and why (see Octree::update_tree) */
+struct tree_stats {
+    long refits = 0; /** trees refit in place, block timestep substeps included */
+    long rebuilds = 0; /** full rebuilds */
+    long grown = 0; /** ... of those because bodies left the domain */
+    long migrated = 0; /** ... of those because too many bodies had left their leaf */
+    long escaped = 0; /** ... of those because stars escaped the cluster */
+    int migrants = 0; /** bodies outside their leaf's cell after the last refit */
+    int ejected = 0; /** stars taken out of the tree as escapers (see Octree::set_escape) */
+};
+
+/** what the last walk_tree did (tree solver only, the fmm and direct sums don't count) */
+struct walk_stats {
+    long bodies = 0; /** bodies that got new results */
+    long pp = 0; /** particle-particle interactions */
+    long pc = 0; /** particle-cell interactions, multipole terms included */
+    long opened = 0; /** nodes opened, only counted in GLOBR_PROFILE builds */
+
+    void add( const walk_stats &w ) { bodies += w.bodies; pp += w.pp; pc += w.pc; opened += w.opened; }
+};
+
+/** a node whose subtree build_morton left to carve in parallel */
+struct build_piece {
+    int root; /** index of the node */
+    int level; /** its depth */
+};
+
 class Octree {
 
     public:
 
-        Node* root; /** pointer, root node*/
+        std::vector<Node> nodes; /** flat node arena, root at index 0. cleared but never shrunk between rebuilds */
         scalar tsize; /** total simulation domain [m] */
         vec corner; /** coordinates of upper left corner, simulation domain [m] */
         int n; /** total number of particles in the simulation */
+        int ntree; /** bodies in the tree, [0, ntree) of p. escapers (see set_escape) are kept behind them */
 
-        scalar kenergy; /** total kinetic energy [J] */
-        scalar penergy; /** total potential energy [J] */
+        double kenergy; /** total kinetic energy [J], from the last compute_energy (or compute_forces with energy) */
+        double penergy; /** total potential energy [J], from the last compute_energy (or compute_forces with energy) */
+        bool energies; /** false if compute_energy hasn't been run (diagnostics off) */
 
-        Body** nbody; /** list of pointers to all bodies in the simuation */
+        Particles p; /** all bodies, structure-of-arrays, kept in tree (z-) order */
+        ThreadPool* pool; /** worker threads for the force pass and the tree build */
+        build_mode mode; /** how rebuild_tree builds the tree */
+        walk_mode walk; /** how compute_forces walks it */
+        int leaf_size; /** max bodies per leaf bucket */
+        int group_size; /** max bodies per group in the group walk */
+        int moment_order; /** multipole order of the far field, see multipole_order */
+        accel_kernel kernel; /** force kernel for the interaction lists */
+        const char* kernel_name; /** which kernel that is, for the logs */
+        multipole_kernel mkernel; /** matching kernel for accepted nodes above monopole order */
+        tile_kernel tkernel; /** matching kernel for the direct solver's tile pairs */
+        solver_mode solver; /** barnes-hut walk, fmm or direct sums */
+        int max_rung; /** block timesteps: bodies step with dt / 2^rung, rung 0 .. max_rung. 0 is one global step */
+        scalar eta; /** block timesteps: how much a body's acceleration may change over one of its steps */
+        scalar max_migrants; /** refit instead of rebuilding until more than this fraction of the bodies left their leaf. 0 rebuilds every step */
+        scalar escape_radius; /** unbound stars leaving the cluster beyond this distance from its center of mass [m] leave the tree. 0 keeps everybody */
+        softening soft; /** softening of the forces and potentials */
+        scalar pair_radius; /** bound pairs closer than this move on kepler orbits (see set_pairs) [m]. 0 for none */
+        scalar pair_gamma; /** ... while the tidal pull of everybody else stays below this fraction of their own */
+        std::vector<kepler_pair> pairs; /** the pairs moving on kepler orbits right now */
+        long pairs_formed, pairs_dissolved; /** how many pairs were made and broken up so far */
+        tree_stats stats; /** refit and rebuild counts */
+        walk_stats walked; /** interaction counts of the last walk_tree */
+        step_profile prof; /** phase timings and walk counts since it was last cleared, GLOBR_PROFILE builds only (see profile.h) */
+        FMM fmm; /** the fmm solver and its expansions */
+        Direct direct; /** the direct summation solver */
 
         Octree(); // default constructor
         Octree( scalar cx, scalar cy, scalar cz, scalar dx); // used to construct the root node (full simulation area)
 
         ~Octree( ); // destructor
     
+        void set_threads( int nthreads );
+        void set_build( build_mode m );
+        void set_walk( walk_mode w, int ngroup = 64 );
+        void set_leaf_size( int nleaf );
+        void set_order( int o );
+        void set_solver( solver_mode s, int p = 4 );
+        void set_timesteps( int rungs, scalar eta = 0.05 );
+        void set_refit( scalar migrants );
+        void set_escape( scalar radius );
+        void set_softening( soften_mode mode, scalar eps );
+        void set_pairs( scalar radius, scalar gamma = 1e-4 );
+        bool set_kernel( const char* name );
+        Body get_body( int i ) const;
+        int depth( ) const;
         void build_tree(int n, scalar *xi, scalar *yi, scalar *zi, scalar *vxi, scalar *vyi, scalar *vzi, scalar *mass);
-        void compute_forces( scalar theta, scalar dt);
+        void set_bodies( int n, const double *pos, const double *vel, const double *mass );
+        void get_bodies( double *pos, double *vel ) const;
+        void get_accelerations( double *acc, double *pot = nullptr ) const;
+        void rebuild_tree( );
+        void update_tree( bool refitted = false );
+        void walk_tree( scalar theta, bool forces, bool potential, const char *mask = nullptr );
+        void compute_forces( scalar theta, scalar dt, bool energy = false, snapshot *out = nullptr );
+        void kick( scalar dt, bool energy = false );
+        void kick_drift( scalar kdt, scalar ddt );
+        void drift( scalar dt );
+        void compute_energy( scalar theta );
+        void direct_reference( int nsample, force_reference &ref );
+        std::vector<double> force_errors( const force_reference &ref ) const;
         void print_bodies( int step );
-        void save_step( int step, scalar time, scalar theta, const char *run );
+        bool save_checkpoint( const char *fname, const checkpoint_header &h ) const;
+        bool load_checkpoint( const char *fname, checkpoint_header &h );
+        void make_snapshot( int step, scalar time, scalar theta, snapshot &s ) const;
+        void save_step( int step, scalar time, scalar theta, SnapshotWriter &out, bool filled = false );
 
     private: // to help us rebuild the tree during force calculations
-        void rebuild_tree( );
+        void build_nodes( );
+        void find_groups( );
+        void find_cut( );
+        void refit( );
+        void fit_subtree( int s );
+        int fit_top( );
+        void fit_domain( );
+        bool eject( );
+        void escaper_forces( bool forces, bool potential, const char *mask );
+        void start_walk( );
+        void walk_range( int begin, int end, int tid, scalar theta, bool forces, bool potential, const char *mask );
+        void finish_walk( );
+        void kick_range( int begin, int end, scalar dt, double *energy );
+        void kick_drift_range( int begin, int end, scalar kdt, scalar ddt );
+        void sum_energies( );
+        void step_graph( scalar theta, scalar dt, bool energy, snapshot *out );
+        void run_graph( );
+        void copy_snapshot( snapshot &s, int begin, int end ) const;
+        void finish_snapshot( int step, scalar time, scalar theta, snapshot &s ) const;
+        void update_pairs( );
+        void drift_pairs( double dt );
+        void drift_pair_range( int begin, int end, double dt );
+        void pack( int i, int j );
+        void unpack( const kepler_pair &k, int ia, int ib );
+        double perturbation( vec c, int ia, int ib, double r, double m ) const;
+        void step_block( scalar theta, scalar dt );
+        void build_morton( );
+        void build_insert( );
+        void carve( std::vector<Node> &arena, int idx, int level, int begin, int end, int split );
+        void stitch( );
+        void insert( int b );
+        int make_child( std::vector<Node> &arena, int parent, int q );
+        int place( int idx, int pos );
+
+        std::vector<uint64_t> keys, kbuf; /** morton keys of the bodies, plus sort scratch */
+        std::vector<int> order, obuf; /** body index for every sorted key, plus sort scratch */
+        std::vector<int> next; /** bucket linked lists while inserting one body at a time */
+        std::vector<build_piece> pieces; /** subtrees a parallel carve leaves for later, in depth first order */
+        std::vector<std::vector<Node>> arenas; /** the nodes of every piece, each with its own root at 0 */
+        std::vector<Node> nbuf; /** scratch node arena for putting the pieces back together */
+        std::vector<int> remap; /** new index of every node above the pieces */
+        std::vector<int> groups; /** nodes walked as one group: the largest subtrees with at most group_size bodies, in body order */
+        upward_cut cut; /** the tree in a few hundred subtrees, for the upward pass and the step's tasks (see find_cut) */
+        std::vector<int> cut_groups; /** groups of every subtree of the cut, from cut_groups[s] to cut_groups[s + 1]; empty if groups don't fit in them */
+        TaskGraph graph; /** tasks of the step, see step_graph */
+        std::vector<double> sums; /** partial energy sums, see kick_range */
+        Particles pbuf; /** scratch particle storage for the z-order shuffle */
+        std::vector<ilist> lists; /** two interaction lists (particle-particle, particle-cell) per thread */
+        std::vector<multipole> moments; /** higher moments of every node, only filled in above monopole order */
+        std::vector<mlist> mlists; /** multipole corrections, one list per thread */
+        std::vector<walk_stats> tallies; /** walk counts, one per thread */
+        bool have_acc; /** p.ax .. are the accelerations at the current positions (steps carry them over) */
+        std::vector<char> active; /** block steps: bodies that get new forces this substep */
+        std::vector<scalar> oax, oay, oaz; /** block steps: accelerations before the substep, for the jerk estimate */
+        std::vector<int> where; /** index of every body id in the particle arrays, while the pairs are updated and drifted */
+        std::vector<char> paired; /** per body id, nonzero if it's in a pair */
 };
 
 #endif
\ No newline at end of file
@@ -8,7 +8,14 @@
 #define PC 3.085E16     // parsec [m]
 #define YR 3.15e7       // year [s]
 
-typedef float scalar; // general data type, should be float or higher precision.
+// general data type of the bodies and the tree, picked at build time (make PRECISION=..., 
+// see the Makefile). float by default; double and mixed builds store everything in double,
+// mixed then still runs the force kernels in float (see kscalar in kernels.h).
+#if defined(GLOBR_DOUBLE) || defined(GLOBR_MIXED)
+typedef double scalar;
+#else
+typedef float scalar;
+#endif
 
 #include <cmath>
 
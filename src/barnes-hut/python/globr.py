@@ -0,0 +1,165 @@
+import ctypes
+import os
+
+import numpy as np
+
+
+# libglobr.so from `make lib` in src/barnes-hut/src, see include/globr.h. GLOBR_LIB
+# points somewhere else.
+LIBPATH = os.environ.get('GLOBR_LIB', os.path.join(os.path.dirname(os.path.abspath(__file__)), '..', 'src', 'libglobr.so'))
+
+_doubles = ctypes.POINTER(ctypes.c_double)
+_lib = None
+
+
+def _load( path: str = LIBPATH ) :
+    """
+    loads the library once and declares what its functions take and return.
+    """
+    global _lib
+    if _lib is None:
+        lib = ctypes.CDLL(path)
+        lib.globr_create.restype = ctypes.c_void_p
+        lib.globr_create.argtypes = [ctypes.c_int]
+        lib.globr_destroy.argtypes = [ctypes.c_void_p]
+        lib.globr_set_option.restype = ctypes.c_int
+        lib.globr_set_option.argtypes = [ctypes.c_void_p, ctypes.c_char_p, ctypes.c_char_p]
+        lib.globr_set_bodies.argtypes = [ctypes.c_void_p, ctypes.c_int, _doubles, _doubles, _doubles]
+        lib.globr_count.restype = ctypes.c_int
+        lib.globr_count.argtypes = [ctypes.c_void_p]
+        lib.globr_get_bodies.argtypes = [ctypes.c_void_p, _doubles, _doubles]
+        lib.globr_accelerations.argtypes = [ctypes.c_void_p, ctypes.c_double, _doubles, _doubles]
+        lib.globr_step.argtypes = [ctypes.c_void_p, ctypes.c_double, ctypes.c_double, ctypes.c_int]
+        lib.globr_energy.argtypes = [ctypes.c_void_p, ctypes.c_double, _doubles, _doubles]
+        _lib = lib
+    return _lib
+
+
+def _pointer( a, shape = None ) :
+    """
+    a pointer to the data of a float64 array. c-ordered float64 arrays (what numpy makes
+    by default) go as they are, without a copy; anything else is converted first.
+    """
+    if a is None:
+        return None, None
+    a = np.require(a, dtype=np.float64, requirements=['C', 'A'])
+    if shape is not None and a.shape != shape:
+        raise ValueError(f'expected an array of shape {shape}, got {a.shape}')
+    return a, a.ctypes.data_as(_doubles)
+
+
+def _output( a, shape ) :
+    """
+    a float64 array to fill in place: a new one, or the caller's if it can be written
+    as it is.
+    """
+    if a is None:
+        a = np.empty(shape)
+    elif a.dtype != np.float64 or not a.flags['C_CONTIGUOUS'] or not a.flags['WRITEABLE'] or a.shape != shape:
+        raise ValueError(f'output arrays have to be writeable, c-ordered float64 arrays of shape {shape}')
+    return a, a.ctypes.data_as(_doubles)
+
+
+class Tree:
+    """
+    globr's octree, in process: hand it the bodies as numpy arrays, get the forces (or
+    whole steps of globr's own integrator) back in numpy arrays. positions, velocities
+    and accelerations are (n, 3) arrays, masses and potentials (n,); units are si, masses
+    in solar masses. arrays come back in the order the bodies went in.
+
+        tree = Tree(threads=4, soften='spline', eps=200 * AU)
+        acc = tree.accelerations(pos, mass, theta=0.5)
+
+    settings are globr's command line flags (underscores for dashes), see set(). G and
+    the solar mass are globr's too, Tree.G and Tree.MSUN: code with constants of its own
+    scales its masses by its G * msun / (Tree.G * Tree.MSUN) to get the same forces.
+    """
+
+    G = 6.67e-11 # gravitational constant [m^3/kg/s^2], include/util.h
+    MSUN = 2e30 # solar mass [kg], include/util.h
+
+    def __init__( self, threads: int = 1, **options ) :
+        self.lib = _load()
+        self.handle = self.lib.globr_create(threads)
+        self.mass = None
+        self.set(**options)
+
+    def __del__( self ) :
+        if getattr(self, 'handle', None):
+            self.lib.globr_destroy(self.handle)
+            self.handle = None
+
+    def set( self, **options ) :
+        """
+        changes settings, e.g. set(solver='fmm', multipole='quad', leaf=16). lengths
+        (eps, pairs, escape) are in meters. see globr_set_option in src/globr.cpp.
+        """
+        for name, value in options.items():
+            key = name.replace('_', '-').encode()
+            if not self.lib.globr_set_option(self.handle, key, str(value).encode()):
+                raise ValueError(f'unknown setting {name}={value}')
+
+    def __len__( self ) :
+        return self.lib.globr_count(self.handle)
+
+    def set_bodies( self, pos, mass, vel = None ) :
+        """
+        replaces the bodies (and builds the tree over them). vel defaults to all at rest.
+        """
+        if pos is None or mass is None:
+            raise ValueError('set_bodies needs both pos and mass')
+        mass, pm = _pointer(mass)
+        n = len(mass)
+        pos, pp = _pointer(pos, (n, 3))
+        vel, pv = _pointer(vel, (n, 3))
+        self.lib.globr_set_bodies(self.handle, n, pp, pv, pm)
+        self.mass = mass.copy() # for accelerations(pos) without masses
+
+    def bodies( self, pos = None, vel = None ) :
+        """
+        positions and velocities of the bodies, as (n, 3) arrays. pass arrays of your own
+        to have them filled in place.
+        """
+        n = len(self)
+        pos, pp = _output(pos, (n, 3))
+        vel, pv = _output(vel, (n, 3))
+        self.lib.globr_get_bodies(self.handle, pp, pv)
+        return pos, vel
+
+    def accelerations( self, pos = None, mass = None, theta: float = 0.5, potential: bool = False, out = None ) :
+        """
+        one force pass. with pos and mass the bodies are replaced first (what an
+        integrator of your own does at every stage), with pos alone only their positions
+        (masses and velocities stay), otherwise it's the current ones.
+
+        returns the accelerations [m/s^2], (n, 3), in out if given, and with potential
+        also the potentials [J/kg], (n,).
+        """
+        if pos is None and mass is not None:
+            raise ValueError('accelerations got masses but no positions')
+        if pos is not None and mass is None:
+            if self.mass is None:
+                raise ValueError('accelerations(pos) keeps the masses of the current bodies, but there are none yet; pass mass too')
+            _, vel = self.bodies()
+            self.set_bodies(pos, self.mass, vel)
+        elif pos is not None:
+            self.set_bodies(pos, mass)
+        n = len(self)
+        acc, pa = _output(out, (n, 3))
+        pot, pp = _output(None, (n,)) if potential else (None, None)
+        self.lib.globr_accelerations(self.handle, theta, pa, pp)
+        return (acc, pot) if potential else acc
+
+    def step( self, dt: float, nstep: int = 1, theta: float = 0.5 ) :
+        """
+        advances the bodies by nstep steps of dt [s] with globr's own integrator.
+        """
+        self.lib.globr_step(self.handle, theta, dt, nstep)
+
+    def energy( self, theta: float = 0.5 ) :
+        """
+        total kinetic and potential energy [J].
+        """
+        ke, pe = ctypes.c_double(), ctypes.c_double()
+        self.lib.globr_energy(self.handle, theta, ctypes.byref(ke), ctypes.byref(pe))
+        return ke.value, pe.value
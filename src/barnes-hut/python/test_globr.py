@@ -0,0 +1,116 @@
+import os
+import sys
+
+import numpy as np
+
+# run after `make lib` in src/barnes-hut/src: python test_globr.py (or pytest)
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), '..', '..'))
+
+import globr
+import nbody_python as nb
+
+
+def _relative( a, b ) :
+    """
+    |a - b| / |b| for every body.
+    """
+    return np.linalg.norm(a - b, axis=1) / np.linalg.norm(b, axis=1)
+
+
+def test_tree_matches_numpy() :
+    """
+    at theta 0 the tree opens every node, so nbody_python's acceleration() has to come
+    out the same with a tree attached as without, globr's G and msun notwithstanding.
+    """
+    rng = np.random.default_rng(7)
+    n = 300
+    pos = rng.normal(size=(n, 3)) * nb.pc
+    mass = rng.uniform(0.1, 10, size=n)
+    system = nb.nbdsys(n, mass_list=mass, init_vel=np.zeros((n, 3)), init_pos=pos)
+
+    plain = nb.acceleration(system)
+    system.tree = globr.Tree()
+    system.theta = 0
+    tree = nb.acceleration(system)
+
+    err = _relative(tree, plain)
+    assert np.median(err) < 1e-6, np.median(err)
+    assert err.max() < 1e-4, err.max()
+
+
+def test_accelerations_keeps_masses() :
+    """
+    accelerations(pos) without masses moves the bodies and keeps their masses and
+    velocities.
+    """
+    rng = np.random.default_rng(8)
+    n = 200
+    pos = rng.normal(size=(n, 3)) * nb.pc
+    vel = rng.normal(size=(n, 3)) * 1e3
+    mass = rng.uniform(0.1, 10, size=n)
+
+    tree = globr.Tree()
+    tree.set_bodies(pos, mass, vel)
+    moved = pos + rng.normal(size=(n, 3)) * 0.01 * nb.pc
+    acc = tree.accelerations(moved, theta=0)
+    got_pos, got_vel = tree.bodies()
+
+    reference = globr.Tree()
+    ref = reference.accelerations(moved, mass, theta=0)
+    assert np.array_equal(acc, ref)
+    assert np.allclose(got_pos, moved, rtol=1e-6, atol=0)
+    assert np.allclose(got_vel, vel, rtol=1e-6, atol=0)
+
+
+def test_accelerations_needs_masses() :
+    """
+    positions without masses on a tree that has no bodies yet is a clear error.
+    """
+    tree = globr.Tree()
+    try:
+        tree.accelerations(np.zeros((4, 3)))
+    except ValueError:
+        return
+    raise AssertionError('no ValueError')
+
+
+
+def test_builder_writes_si() :
+    """
+    initialConditionsBuilder writes m and m/s whatever units R0 and Vmax come in (needs
+    astropy, skipped without it).
+    """
+    try:
+        import astropy.units as u
+        import initialConditionsBuilder as icb
+    except ImportError:
+        return
+    import tempfile
+
+    for model in ['uniform', 'plummer']:
+        runs = []
+        for R0, Vmax in [(1*u.pc, 1*u.km/u.s), (u.pc.to(u.m)*u.m, 1e3*u.m/u.s)]:
+            np.random.seed(9)
+            ic = icb.initialConditions(500)
+            ic.sample_piecewise_powerlaw([-2.3], [0.5, 10])
+            ic.build_phasespace(3, R0, Vmax=Vmax, model=model)
+            runs.append(ic)
+        assert np.allclose(runs[0].posVels, runs[1].posVels, rtol=1e-12, atol=0)
+
+        with tempfile.TemporaryDirectory() as tmp:
+            fname = os.path.join(tmp, 'ic.txt')
+            runs[0].save(fname, binary=False)
+            saved = np.loadtxt(fname)
+        assert np.allclose(saved[:6], runs[0].posVels, rtol=1e-12, atol=0)
+        r = np.linalg.norm(saved[:3], axis=0)
+        assert 1e15 < np.median(r) < 1e17, np.median(r)
+        if model == 'uniform':
+            assert np.linalg.norm(saved[3:6], axis=0).max() <= 1e3 * (1 + 1e-12)
+
+
+if __name__ == '__main__':
+    for name, test in list(globals().items()):
+        if name.startswith('test_'):
+            test()
+            print(f'{name}: ok')
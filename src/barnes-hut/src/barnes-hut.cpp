@@ -1,5 +1,6 @@
 #include "tree.h"
 #include "body.h"
+#include "ic.h"
 #include "node.h"
 #include "util.h"
 
@@ -8,6 +9,13 @@
 #include <iostream>
 #include <cstring>
 
+#ifdef GLOBR_MPI
+#include "domain.h"
+
+#include <errno.h>
+#include <sys/stat.h>
+#endif
+
 #define DATAPATH "../data/"
 #define INITPATH "../init/"
 
@@ -18,13 +26,33 @@ struct config {
     scalar theta = 0.5;
     int nstep = 5000;
     int fout = nstep / 1000;
-    char* run = nullptr;
+    int nthreads = 1;
+    int diag = 1;
+    build_mode build = BUILD_MORTON;
+    walk_mode walk = WALK_GROUP;
+    int ngroup = 64;
+    int nleaf = 8;
+    int multipole = ORDER_MONOPOLE;
+    solver_mode solver = SOLVER_TREE;
+    int fmm_order = 4;
+    snapshot_format format = FORMAT_BINARY;
+    int checkpoint = 1000;
+    int rungs = 0;
+    scalar eta = 0.05;
+    scalar refit = 0.05;
+    scalar escape = 0;
+    soften_mode soften = SOFTEN_NONE;
+    scalar eps = 0;
+    scalar pairs = 0;
+    const char* kernel = "auto";
+    char* restart = nullptr;
+    char* profile = nullptr;
+    const char* run = nullptr;
     char* prefix = nullptr;
     char* filename = nullptr;
 };
 
-config parse_args(int argc, char** argv) {
-    config cfg;
+config parse_args(int argc, char** argv, config cfg = config()) {
 
     for (int i = 1; i < argc; ++i) {
         if ((std::strcmp(argv[i], "-N") == 0 || std::strcmp(argv[i], "--N") == 0) && i + 1 < argc) {
@@ -39,6 +67,69 @@ config parse_args(int argc, char** argv) {
             cfg.fout = std::atoi(argv[++i]);
         } else if (std::strcmp(argv[i], "--theta") == 0 && i + 1 < argc) {
             cfg.theta = std::atof(argv[++i]);
+        } else if (std::strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            cfg.nthreads = std::atoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "--build") == 0 && i + 1 < argc) {
+            ++i;
+            if (std::strcmp(argv[i], "morton") == 0) cfg.build = BUILD_MORTON;
+            else if (std::strcmp(argv[i], "insert") == 0) cfg.build = BUILD_INSERT;
+            else throw std::runtime_error(std::string("Unknown tree build: ") + argv[i]);
+        } else if (std::strcmp(argv[i], "--walk") == 0 && i + 1 < argc) {
+            ++i;
+            if (std::strcmp(argv[i], "group") == 0) cfg.walk = WALK_GROUP;
+            else if (std::strcmp(argv[i], "body") == 0) cfg.walk = WALK_BODY;
+            else throw std::runtime_error(std::string("Unknown tree walk: ") + argv[i]);
+        } else if (std::strcmp(argv[i], "--group") == 0 && i + 1 < argc) {
+            cfg.ngroup = std::atoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "--leaf") == 0 && i + 1 < argc) {
+            cfg.nleaf = std::atoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "--multipole") == 0 && i + 1 < argc) {
+            ++i;
+            if (std::strcmp(argv[i], "mono") == 0) cfg.multipole = ORDER_MONOPOLE;
+            else if (std::strcmp(argv[i], "quad") == 0) cfg.multipole = ORDER_QUADRUPOLE;
+            else if (std::strcmp(argv[i], "oct") == 0) cfg.multipole = ORDER_OCTUPOLE;
+            else throw std::runtime_error(std::string("Unknown multipole order: ") + argv[i]);
+        } else if (std::strcmp(argv[i], "--solver") == 0 && i + 1 < argc) {
+            ++i;
+            if (std::strcmp(argv[i], "tree") == 0) cfg.solver = SOLVER_TREE;
+            else if (std::strcmp(argv[i], "fmm") == 0) cfg.solver = SOLVER_FMM;
+            else if (std::strcmp(argv[i], "direct") == 0) cfg.solver = SOLVER_DIRECT;
+            else throw std::runtime_error(std::string("Unknown solver: ") + argv[i]);
+        } else if (std::strcmp(argv[i], "--fmm-order") == 0 && i + 1 < argc) {
+            cfg.fmm_order = std::atoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "--format") == 0 && i + 1 < argc) {
+            ++i;
+            if (std::strcmp(argv[i], "bin") == 0) cfg.format = FORMAT_BINARY;
+            else if (std::strcmp(argv[i], "text") == 0) cfg.format = FORMAT_TEXT;
+            else throw std::runtime_error(std::string("Unknown output format: ") + argv[i]);
+        } else if (std::strcmp(argv[i], "--kernel") == 0 && i + 1 < argc) {
+            cfg.kernel = argv[++i];
+        } else if (std::strcmp(argv[i], "--diag") == 0 && i + 1 < argc) {
+            cfg.diag = std::atoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "--rungs") == 0 && i + 1 < argc) {
+            cfg.rungs = std::atoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "--eta") == 0 && i + 1 < argc) {
+            cfg.eta = std::atof(argv[++i]);
+        } else if (std::strcmp(argv[i], "--refit") == 0 && i + 1 < argc) {
+            cfg.refit = std::atof(argv[++i]);
+        } else if (std::strcmp(argv[i], "--escape") == 0 && i + 1 < argc) {
+            cfg.escape = std::atof(argv[++i]);
+        } else if (std::strcmp(argv[i], "--soften") == 0 && i + 1 < argc) {
+            ++i;
+            if (std::strcmp(argv[i], "none") == 0) cfg.soften = SOFTEN_NONE;
+            else if (std::strcmp(argv[i], "plummer") == 0) cfg.soften = SOFTEN_PLUMMER;
+            else if (std::strcmp(argv[i], "spline") == 0) cfg.soften = SOFTEN_SPLINE;
+            else throw std::runtime_error(std::string("Unknown softening: ") + argv[i]);
+        } else if (std::strcmp(argv[i], "--eps") == 0 && i + 1 < argc) {
+            cfg.eps = std::atof(argv[++i]);
+        } else if (std::strcmp(argv[i], "--pairs") == 0 && i + 1 < argc) {
+            cfg.pairs = std::atof(argv[++i]);
+        } else if (std::strcmp(argv[i], "--checkpoint") == 0 && i + 1 < argc) {
+            cfg.checkpoint = std::atoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "--profile") == 0 && i + 1 < argc) {
+            cfg.profile = argv[++i];
+        } else if (std::strcmp(argv[i], "--restart") == 0 && i + 1 < argc) {
+            cfg.restart = argv[++i];
         } else if (std::strcmp(argv[i], "--run") == 0 && i + 1 < argc) {
             cfg.run = argv[++i];
         } else if (std::strcmp(argv[i], "--init") == 0 && i + 1 < argc) {
@@ -51,84 +142,384 @@ config parse_args(int argc, char** argv) {
     return cfg;
 }
 
-int main( int argc, char *argv[] ) {
+/**
+ * copies the settings of a run into a checkpoint header.
+ *
+ * @param cfg settings of the run
+ * @param kernel name of the force kernel actually in use
+ * @param h header to fill in
+*/
+void store_settings( const config &cfg, const char *kernel, checkpoint_header &h ) {
+    std::memset( &h, 0, sizeof(h) );
+    h.dt = cfg.dt;
+    h.theta = cfg.theta;
+    h.nstep = cfg.nstep;
+    h.freq = cfg.fout;
+    h.checkpoint = cfg.checkpoint;
+    h.build = cfg.build;
+    h.walk = cfg.walk;
+    h.group = cfg.ngroup;
+    h.leaf = cfg.nleaf;
+    h.multipole = cfg.multipole;
+    h.solver = cfg.solver;
+    h.fmm_order = cfg.fmm_order;
+    h.diag = cfg.diag;
+    h.format = cfg.format;
+    h.rungs = cfg.rungs;
+    h.eta = cfg.eta;
+    h.refit = cfg.refit;
+    h.escape = cfg.escape;
+    h.soften = cfg.soften;
+    h.eps = cfg.eps;
+    h.pairs = cfg.pairs;
+    std::strncpy( h.kernel, kernel, CHECKPOINT_KERNEL - 1 );
+    std::strncpy( h.run, cfg.run, CHECKPOINT_RUN - 1 );
+}
 
-    config cfg = parse_args( argc, argv );
+/**
+ * the settings of a checkpointed run, as the starting point for a restart.
+ *
+ * @param h checkpoint header, has to outlive the config (the kernel and run names point into it)
+ *
+ * @returns the run's settings.
+*/
+config load_settings( const checkpoint_header &h ) {
+    config cfg;
+    cfg.dt = h.dt;
+    cfg.theta = h.theta;
+    cfg.nstep = h.nstep;
+    cfg.fout = h.freq;
+    cfg.checkpoint = h.checkpoint;
+    cfg.build = (build_mode) h.build;
+    cfg.walk = (walk_mode) h.walk;
+    cfg.ngroup = h.group;
+    cfg.nleaf = h.leaf;
+    cfg.multipole = h.multipole;
+    cfg.solver = (solver_mode) h.solver;
+    cfg.fmm_order = h.fmm_order;
+    cfg.diag = h.diag;
+    cfg.format = (snapshot_format) h.format;
+    cfg.rungs = h.rungs;
+    cfg.eta = h.eta;
+    cfg.refit = h.refit;
+    cfg.escape = h.escape;
+    cfg.soften = (soften_mode) h.soften;
+    cfg.eps = h.eps;
+    cfg.pairs = h.pairs;
+    cfg.kernel = h.kernel;
+    cfg.run = h.run;
+    return cfg;
+}
+
+/**
+ * writes one step's timings and walk counts as a row of the --profile csv, and how busy
+ * the threads were with every phase while the step's task graphs ran (idle: waiting on
+ * other tasks).
+ *
+ * @param f csv file, NULL for none
+ * @param step integer timestep
+ * @param tree the tree, with the step's profile
+ * @param rebuilt true if the tree was rebuilt this step (instead of refit)
+*/
+void write_profile( FILE *f, int step, const Octree &tree, bool rebuilt ) {
+    if (f == NULL) return;
+
+    const step_profile &sp = tree.prof;
+    fprintf( f, "%d", step );
+    for (int k = 0; k < NPHASES; k++)
+        fprintf( f, ",%.6e", sp.time[k] );
+    fprintf( f, ",%ld,%ld,%ld,%ld,%d,%d,%d", sp.walks, sp.opened, sp.pp, sp.pc, (int) tree.nodes.size(), tree.depth(), rebuilt ? 1 : 0 );
+
+    double idle = 1;
+    fprintf( f, ",%.6e", sp.span );
+    for (int k = 0; k < NPHASES; k++) {
+        fprintf( f, ",%.4f", sp.utilisation( k ) );
+        idle -= sp.utilisation( k );
+    }
+    fprintf( f, ",%.4f\n", sp.span > 0 ? idle : 0.0 );
+}
+
+#ifdef GLOBR_MPI
+/**
+ * the whole run, spread over the mpi ranks (globr-mpi, see domain.h). rank 0 reads the
+ * initial conditions and hands them out; from then on every rank steps its own bodies,
+ * and the snapshots are written by all of them together.
+ *
+ * block timesteps, kepler pairs, escapers, checkpoints and text output are the single
+ * process globr's alone.
+ *
+ * @param cfg settings of the run
+ *
+ * @returns the exit status, the same on every rank.
+*/
+int run_distributed( const config &cfg ) {
+    Domain dom( MPI_COMM_WORLD );
+    bool root = dom.rank == 0;
+
+    const char *alone = nullptr;
+    if (cfg.restart) alone = "--restart";
+    else if (cfg.rungs > 0) alone = "--rungs";
+    else if (cfg.pairs > 0) alone = "--pairs";
+    else if (cfg.escape > 0) alone = "--escape";
+    else if (cfg.profile) alone = "--profile";
+    else if (cfg.format == FORMAT_TEXT) alone = "--format text";
+    if (alone) {
+        if (root) printf("%s doesn't work with globr-mpi\n", alone);
+        return 1;
+    }
+    if (cfg.soften != SOFTEN_NONE && cfg.eps <= 0) {
+        if (root) printf("--soften needs a softening length, --eps\n");
+        return 1;
+    }
+    if (!cfg.run) {
+        if (root) printf("--run needs the name of the run (and its data directory)\n");
+        return 1;
+    }
+
+    scalar size = cfg.size * PC;
+    Octree *bhtree = new Octree( -size/2, -size/2, -size/2, size );
+    bhtree->set_threads( cfg.nthreads );
+    bhtree->set_build( cfg.build );
+    bhtree->set_walk( cfg.walk, cfg.ngroup );
+    bhtree->set_leaf_size( cfg.nleaf );
+    bhtree->set_order( cfg.multipole );
+    bhtree->set_solver( cfg.solver, cfg.fmm_order );
+    bhtree->set_softening( cfg.soften, cfg.eps * AU );
+    if (!bhtree->set_kernel( cfg.kernel )) {
+        if (root) printf("Unknown force kernel: %s\n", cfg.kernel);
+        return 1;
+    }
 
+    // >>> initial conditions, rank 0 reads them for everybody
     char PATH[512];
     std::snprintf(PATH, sizeof(PATH), "%s/%s", INITPATH, cfg.filename);
 
+    initial_conditions ic;
+    int ok = 1;
+    if (root) {
+        ok = load_initial_conditions( PATH, ic, bhtree->pool );
+        if (ok && cfg.n > 0 && cfg.n != ic.n) {
+            printf("%s holds %d bodies, but -N says %d\n", PATH, ic.n, cfg.n);
+            ok = 0;
+        }
 
-    scalar size = cfg.size * PC; // total simulation size
-    vec c = { -size/2, -size/2, size/2};
-    Octree *bhtree = new Octree( c.x, c.y, c.z, size ); // initializing our tree
+        std::string dname = std::string( DATPATH ) + "/" + cfg.run;
+        if (mkdir( DATPATH, 0777 ) != 0 && errno != EEXIST)
+            printf( "Couldn't make %s\n", DATPATH );
+        if (mkdir( dname.c_str(), 0777 ) != 0 && errno != EEXIST)
+            printf( "Couldn't make %s\n", dname.c_str() );
+    }
+    MPI_Bcast( &ok, 1, MPI_INT, 0, MPI_COMM_WORLD );
+    if (!ok)
+        return 1;
 
-    // >>> new test suite, 1000 particles for a realistic cluster
+    dom.scatter( *bhtree, ic.n, ic.data.data() );
+    ic = initial_conditions();
 
-    scalar *x; scalar *y; scalar *z;
-    scalar *vx; scalar *vy; scalar *vz;
-    scalar *m;
+    scalar dt = cfg.dt * YR;
+    scalar theta = cfg.theta;
+    scalar simtime = 0.0;
+    char SNAP[512];
 
-    int n = cfg.n;
+    double start = MPI_Wtime();
+    for ( int t = 0; t < cfg.nstep; t++) {
 
-    x   = (scalar *) malloc( sizeof(scalar) * n);
-    y   = (scalar *) malloc( sizeof(scalar) * n);
-    z   = (scalar *) malloc( sizeof(scalar) * n);
-    vx  = (scalar *) malloc( sizeof(scalar) * n);
-    vy  = (scalar *) malloc( sizeof(scalar) * n);
-    vz  = (scalar *) malloc( sizeof(scalar) * n);
-    m   = (scalar *) malloc( sizeof(scalar) * n);
+        dom.step( *bhtree, theta, dt );
+        if (t % cfg.fout == 0) {
+            if (cfg.diag)
+                dom.compute_energy( *bhtree, theta );
+            std::snprintf(SNAP, sizeof(SNAP), "%s/%s/globr_%s_%07d.snap", DATPATH, cfg.run, cfg.run, t);
+            if (!dom.write_snapshot( SNAP, *bhtree, t, simtime, theta ) && root)
+                printf("Couldn't write %s\n", SNAP);
+        }
+        simtime += dt;
+    }
 
+    double elapsed = MPI_Wtime() - start;
+    if (root)
+        printf("globr-mpi: %ld bodies, %d steps in %.3f s (%.3f s per step)\n",
+               dom.ntotal, cfg.nstep, elapsed, cfg.nstep > 0 ? elapsed / cfg.nstep : 0.0);
+    dom.report( );
 
-    // actually reading in our data
-    scalar *lines[7] = { x, y, z, vx, vy, vz, m };
+    delete bhtree;
+    return 0;
+}
+#endif
 
-    FILE *fp = fopen(PATH, "r");
-    // std::cout << "reading file...\n"; 
+int main( int argc, char *argv[] ) {
 
-    if (!fp) {
-        perror("Error opening file");
+#ifdef GLOBR_MPI
+    MPI_Init( &argc, &argv );
+    int status = run_distributed( parse_args( argc, argv ) );
+    MPI_Finalize( );
+    return status;
+#endif
+
+    config cfg = parse_args( argc, argv );
+
+    // restarts take the checkpoint's settings, and anything given on the command line on top
+    checkpoint_header ckpt;
+    if (cfg.restart) {
+        if (!read_checkpoint_header( cfg.restart, ckpt ))
+            return 1;
+        cfg = parse_args( argc, argv, load_settings( ckpt ) );
+    }
+
+    if (cfg.pairs > 0 && cfg.rungs > 0) {
+        printf("--pairs needs one global step, it doesn't work with --rungs\n");
+        if (cfg.restart && ckpt.npairs > 0)
+            printf("the checkpoint holds %d kepler pairs, --pairs 0 breaks them up\n", ckpt.npairs);
+        return 1;
+    }
+    if (cfg.soften != SOFTEN_NONE && cfg.eps <= 0) {
+        printf("--soften needs a softening length, --eps\n");
+        return 1;
+    }
+    if (!cfg.run) {
+        printf("--run needs the name of the run (and its data directory)\n");
+        return 1;
+    }
+    if (std::strlen( cfg.run ) >= CHECKPOINT_RUN) {
+        printf("--run takes names of up to %d characters\n", CHECKPOINT_RUN - 1);
         return 1;
     }
 
-    // int newline = 0;
+    char PATH[512];
+    std::snprintf(PATH, sizeof(PATH), "%s/%s", INITPATH, cfg.filename);
 
-    for (int row = 0; row < 7; row++) {
-        for (int col = 0; col < n; col++) {
-            int ret = fscanf(fp, " %f ", &lines[row][col]);
-            if (ret == EOF) {
-                printf("Reached EOF at row %d col %d\n", row, col);
-                return 1;
-            }
-        }
+
+    scalar size = cfg.size * PC; // total simulation size
+    vec c = { -size/2, -size/2, -size/2};
+    Octree *bhtree = new Octree( c.x, c.y, c.z, size ); // initializing our tree
+    bhtree->set_threads( cfg.nthreads );
+    bhtree->set_build( cfg.build );
+    bhtree->set_walk( cfg.walk, cfg.ngroup );
+    bhtree->set_leaf_size( cfg.nleaf );
+    bhtree->set_order( cfg.multipole );
+    bhtree->set_solver( cfg.solver, cfg.fmm_order );
+    bhtree->set_timesteps( cfg.rungs, cfg.eta );
+    bhtree->set_refit( cfg.refit );
+    bhtree->set_escape( cfg.escape * PC );
+    bhtree->set_softening( cfg.soften, cfg.eps * AU );
+    bhtree->set_pairs( cfg.pairs * AU );
+    if (!bhtree->set_kernel( cfg.kernel )) {
+        printf("Unknown force kernel: %s\n", cfg.kernel);
+        return 1;
     }
 
-    fclose(fp);
-    // std::cout << "done reading file...\n"; 
+    int start = 0;
+    scalar simtime = 0.0;
+
+    if (cfg.restart) {
+        // >>> picking a run back up, exactly where its checkpoint left it
+        if (!bhtree->load_checkpoint( cfg.restart, ckpt ))
+            return 1;
+        start = ckpt.step;
+        simtime = ckpt.time;
+    } else {
+        // >>> initial conditions, text or binary. N comes from the file
+        initial_conditions ic;
+        if (!load_initial_conditions( PATH, ic, bhtree->pool ))
+            return 1;
+
+        if (cfg.n > 0 && cfg.n != ic.n) {
+            printf("%s holds %d bodies, but -N says %d\n", PATH, ic.n, cfg.n);
+            return 1;
+        }
+        int n = ic.n;
+
+        bhtree->build_tree(n, ic.row(IC_X), ic.row(IC_Y), ic.row(IC_Z), ic.row(IC_VX), ic.row(IC_VY), ic.row(IC_VZ), ic.row(IC_M));
+    }
 
-    bhtree->build_tree(n, x, y, z, vx, vy, vz, m);
-    // std::cout << "tree built...\n"; 
     scalar dt = cfg.dt * YR;
-    scalar simtime = 0.0;
     scalar theta = cfg.theta;
+    SnapshotWriter *writer = new SnapshotWriter( cfg.run, cfg.format ); // output goes to disk in the background
 
-    for ( int t = 0; t < cfg.nstep; t++) {
+    // per step timings and walk counts, profiling builds only
+    FILE *fprof = NULL;
+    if (cfg.profile) {
+#ifdef GLOBR_PROFILE
+        fprof = fopen( cfg.profile, "w" );
+        if (fprof == NULL) {
+            perror( "Error opening profile" );
+            return 1;
+        }
+        fprintf( fprof, "step" );
+        for (int k = 0; k < NPHASES; k++)
+            fprintf( fprof, ",%s_s", phase_names[k] );
+        fprintf( fprof, ",walks,opened,pp,pc,nodes,depth,rebuilt,tasks_s" );
+        for (int k = 0; k < NPHASES; k++)
+            fprintf( fprof, ",%s_util", phase_names[k] );
+        fprintf( fprof, ",idle_util\n" );
+#else
+        printf("--profile needs a profiling build (make PROFILE=1)\n");
+        return 1;
+#endif
+    }
+    step_profile total;
+    bhtree->prof = step_profile(); // the setup isn't part of any step
+
+    char CKPT[512];
+    std::snprintf(CKPT, sizeof(CKPT), "%s/%s/globr_%s.ckpt", DATPATH, cfg.run, cfg.run);
 
-        bhtree->compute_forces( theta, dt);
-        if (t % cfg.fout == 0)
-            bhtree->save_step( t, simtime, theta, cfg.run );
+    for ( int t = start; t < cfg.nstep; t++) {
+
+        long rebuilds = bhtree->stats.rebuilds;
+        bool out = t % cfg.fout == 0;
+        snapshot *snap = out ? &writer->buffer() : nullptr; // filled in by the step, as its bodies are done
+        bhtree->compute_forces( theta, dt, out && cfg.diag, snap ); // energies only for the steps we write out
+        if (out)
+            bhtree->save_step( t, simtime, theta, *writer, true );
         simtime += dt;
-        
+
+        // checkpoints every so often, and at the very end so the run can be extended
+        if (cfg.checkpoint > 0 && ((t + 1) % cfg.checkpoint == 0 || t + 1 == cfg.nstep)) {
+            checkpoint_header h;
+            store_settings( cfg, bhtree->kernel_name, h );
+            h.step = t + 1;
+            h.time = simtime;
+            if (!bhtree->save_checkpoint( CKPT, h ))
+                printf("Couldn't write checkpoint %s\n", CKPT);
+        }
+
+        write_profile( fprof, t, *bhtree, bhtree->stats.rebuilds > rebuilds );
+        total.add( bhtree->prof );
+        bhtree->prof = step_profile();
     }
+    if (fprof)
+        fclose( fprof );
 
-    // >>> memory cleanup on aisle zero.
-    free(x);
-    free(y);
-    free(z);
-    free(vx);
-    free(vy);
-    free(vz);
-    free(m);
+    delete writer; // waits for the last snapshots to hit the disk
+
+    const tree_stats &ts = bhtree->stats;
+    printf("tree: %ld refits, %ld rebuilds (%ld after leaving the domain, %ld after migrations, %ld after escapes), %d escapers\n",
+           ts.refits, ts.rebuilds, ts.grown, ts.migrated, ts.escaped, ts.ejected);
+    if (cfg.pairs > 0)
+        printf("pairs: %ld formed, %ld broken up, %d left\n",
+               bhtree->pairs_formed, bhtree->pairs_dissolved, (int) bhtree->pairs.size());
+
+#ifdef GLOBR_PROFILE
+    double busy = 0;
+    for (int k = 0; k < NPHASES; k++)
+        busy += total.time[k];
+    printf("profile:");
+    for (int k = 0; k < NPHASES; k++)
+        printf(" %s %.3f s (%.0f%%)%s", phase_names[k], total.time[k], busy > 0 ? 100 * total.time[k] / busy : 0.0, k + 1 < NPHASES ? "," : "\n");
+    if (total.span > 0) {
+        double idle = 1;
+        printf("tasks: %.3f s on %d thread(s), busy with", total.span, total.threads);
+        for (int k = 0; k < NPHASES; k++) {
+            if (total.busy[k] == 0)
+                continue; // never a task
+            printf(" %s %.0f%%,", phase_names[k], 100 * total.utilisation( k ));
+            idle -= total.utilisation( k );
+        }
+        printf(" idle %.0f%%\n", 100 * idle);
+    }
+    printf("walks: %ld, %.3e nodes opened, %.3e particle-particle and %.3e particle-cell interactions (%.3e per second of walk), %d nodes, depth %d\n",
+           total.walks, (double) total.opened, (double) total.pp, (double) total.pc,
+           total.time[PHASE_WALK] > 0 ? (total.pp + total.pc) / total.time[PHASE_WALK] : 0.0, (int) bhtree->nodes.size(), bhtree->depth());
+#endif
 
     return 0;
         
@@ -0,0 +1,811 @@
+#include "tree.h"
+#include "body.h"
+#include "ic.h"
+#include "util.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+/**
+ * tree benchmarks on plummer spheres.
+ *
+ *   --mode build:    times rebuild_tree with the one-at-a-time insert build and the
+ *                    morton bulk build for 10^3 .. nmax bodies, and checks that the
+ *                    morton build on T threads makes the same tree as on one. exits
+ *                    with 1 if it doesn't.
+ *   --mode accuracy: force error against a direct sum vs. the cost of one force pass,
+ *                    for every multipole order of the tree walk, and the fmm solver at
+ *                    a few expansion orders, over a range of theta, at N = nmax, and
+ *                    for the direct solver.
+ *   --mode refit:    times a full rebuild_tree against the refit that update_tree does
+ *                    instead while bodies stay in their leaves, for 10^3 .. nmax bodies.
+ *   --mode suite:    everything a release should be checked against, for 10^3 .. nmax
+ *                    bodies, 1 .. T threads (powers of two) and a few theta: tree build,
+ *                    upward pass, force walk, integration and output timed separately,
+ *                    interactions per second and the force error against a direct sum.
+ *                    --json and --csv write the results out for tracking regressions.
+ *   --mode convergence: energy error of the leapfrog over a fixed stretch of time with
+ *                    ever shorter steps, which has to shrink as dt^2. exits with 1 if
+ *                    it doesn't, so it doubles as a regression test for the integrator.
+ *   --mode softening: force errors of every solver with plummer and spline softening
+ *                    against a softened direct sum, at N = min(nmax, 20000). exits with
+ *                    1 if softening makes any of them much worse than it is without, or
+ *                    the multipoles worse than the monopole.
+ *   --mode ic:       writes a plummer sphere as text initial conditions in every layout
+ *                    the loader takes (seven rows, one line per body, leading blank lines,
+ *                    crlf) and reads them back. exits with 1 if any come back different.
+ *   --mode restart:  restarts a checkpointed plummer sphere with the same and with other
+ *                    force settings. exits with 1 if the same settings don't continue
+ *                    bit for bit, or other ones open with the checkpoint's accelerations.
+ *   --mode escape:   lets a star escape from a plummer sphere that moved since its tree
+ *                    was built, with and without refits. exits with 1 if either misses it.
+ *
+ * usage: ./globr-bench [--mode build|accuracy|refit|suite|convergence|softening|ic|restart|escape] [--threads T] [--nmax N] [--reps R]
+ *                      [--json file] [--csv file]
+*/
+
+struct bench_config {
+    const char* mode = "build";
+    int nthreads = 1;
+    int nmax = 1000000;
+    int reps = 5;
+    const char* json = nullptr;
+    const char* csv = nullptr;
+};
+
+bench_config parse_args(int argc, char** argv) {
+    bench_config cfg;
+
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--mode") == 0 && i + 1 < argc) {
+            cfg.mode = argv[++i];
+        } else if (std::strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            cfg.nthreads = std::atoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "--nmax") == 0 && i + 1 < argc) {
+            cfg.nmax = std::atoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "--reps") == 0 && i + 1 < argc) {
+            cfg.reps = std::atoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "--json") == 0 && i + 1 < argc) {
+            cfg.json = argv[++i];
+        } else if (std::strcmp(argv[i], "--csv") == 0 && i + 1 < argc) {
+            cfg.csv = argv[++i];
+        } else {
+            throw std::runtime_error(std::string("Unknown or incomplete argument: ") + argv[i]);
+        }
+    }
+
+    return cfg;
+}
+
+/**
+ * samples positions of an (equal mass, cold) plummer sphere, truncated at 20 scale radii.
+ *
+ * @param n number of bodies
+ * @param a plummer scale radius [m]
+ * @param ic seven arrays of length n: x, y, z, vx, vy, vz, mass [msun]
+*/
+void plummer( int n, double a, std::vector<scalar> *ic ) {
+    std::mt19937_64 rng( 513 );
+    std::uniform_real_distribution<double> uni( 0.0, 1.0 );
+
+    for (int k = 0; k < 7; k++)
+        ic[k].assign( n, 0 );
+
+    for (int i = 0; i < n; i++) {
+        double r;
+        do {
+            r = a / sqrt( pow( uni(rng), -2.0 / 3.0 ) - 1.0 );
+        } while (r > 20 * a);
+
+        double ct = 2 * uni(rng) - 1;
+        double st = sqrt( 1 - ct * ct );
+        double phi = 2 * M_PI * uni(rng);
+
+        ic[0][i] = r * st * cos(phi);
+        ic[1][i] = r * st * sin(phi);
+        ic[2][i] = r * ct;
+        ic[6][i] = 0.5;
+    }
+}
+
+/**
+ * builds a fresh tree of the plummer sphere and times rebuild_tree.
+ *
+ * @returns the mean wall time of one rebuild [s].
+*/
+double time_build( std::vector<scalar> *ic, int n, build_mode mode, const bench_config &cfg, int *nnodes ) {
+    scalar size = 50 * PC;
+    Octree tree( -size/2, -size/2, -size/2, size );
+    tree.set_threads( cfg.nthreads );
+    tree.set_build( mode );
+    tree.build_tree( n, ic[0].data(), ic[1].data(), ic[2].data(), ic[3].data(), ic[4].data(), ic[5].data(), ic[6].data() );
+
+    auto t0 = std::chrono::steady_clock::now();
+    for (int r = 0; r < cfg.reps; r++)
+        tree.rebuild_tree( );
+    auto t1 = std::chrono::steady_clock::now();
+
+    *nnodes = (int) tree.nodes.size();
+    return std::chrono::duration<double>( t1 - t0 ).count() / cfg.reps;
+}
+
+/**
+ * builds the plummer sphere with the morton build on cfg.nthreads threads and on one,
+ * and compares the two trees node for node, masses and centres included.
+ *
+ * @returns true if they're the same.
+*/
+bool same_build( std::vector<scalar> *ic, int n, const bench_config &cfg ) {
+    scalar size = 50 * PC;
+    Octree a( -size/2, -size/2, -size/2, size ), b( -size/2, -size/2, -size/2, size );
+    a.set_threads( cfg.nthreads );
+    b.set_threads( 1 );
+    a.build_tree( n, ic[0].data(), ic[1].data(), ic[2].data(), ic[3].data(), ic[4].data(), ic[5].data(), ic[6].data() );
+    b.build_tree( n, ic[0].data(), ic[1].data(), ic[2].data(), ic[3].data(), ic[4].data(), ic[5].data(), ic[6].data() );
+
+    if (a.nodes.size() != b.nodes.size() || a.p.id != b.p.id)
+        return false;
+
+    for (size_t i = 0; i < a.nodes.size(); i++) {
+        const Node &x = a.nodes[i], &y = b.nodes[i];
+        if (x.mass != y.mass || x.dx != y.dx || x.size != y.size || x.nchildren != y.nchildren
+            || x.parent != y.parent || x.first != y.first || x.count != y.count
+            || x.corner.x != y.corner.x || x.corner.y != y.corner.y || x.corner.z != y.corner.z
+            || x.com.x != y.com.x || x.com.y != y.com.y || x.com.z != y.com.z)
+            return false;
+        for (int q = 0; q < 8; q++)
+            if (x.children[q] != y.children[q])
+                return false;
+    }
+    return true;
+}
+
+/**
+ * times rebuild_tree against update_tree on a tree nobody has moved in, i.e. a refit.
+ * the morton build, the default.
+*/
+void refit( const bench_config &cfg ) {
+    printf( "# tree refit benchmark, %d thread(s), %d update(s) per point\n", cfg.nthreads, cfg.reps );
+    printf( "# %-10s  %14s  %14s  %10s\n", "N", "rebuild [s]", "refit [s]", "speedup" );
+
+    for (int n = 1000; n <= cfg.nmax; n *= 10) {
+        std::vector<scalar> ic[7];
+        plummer( n, 1 * PC, ic );
+
+        int nnodes;
+        double t_rebuild = time_build( ic, n, BUILD_MORTON, cfg, &nnodes );
+
+        scalar size = 50 * PC;
+        Octree tree( -size/2, -size/2, -size/2, size );
+        tree.set_threads( cfg.nthreads );
+        tree.build_tree( n, ic[0].data(), ic[1].data(), ic[2].data(), ic[3].data(), ic[4].data(), ic[5].data(), ic[6].data() );
+
+        tree.update_tree( ); // the first one may still grow the domain
+        auto t0 = std::chrono::steady_clock::now();
+        for (int r = 0; r < cfg.reps; r++)
+            tree.update_tree( );
+        auto t1 = std::chrono::steady_clock::now();
+        double t_refit = std::chrono::duration<double>( t1 - t0 ).count() / cfg.reps;
+
+        printf( "  %-10d  %14.4e  %14.4e  %10.2f\n", n, t_rebuild, t_refit, t_rebuild / t_refit );
+    }
+}
+
+/**
+ * relative force errors of the last force pass against a direct sum (see
+ * Octree::force_errors), sorted.
+ *
+ * @returns the errors of all sampled bodies, smallest first.
+*/
+std::vector<double> sorted_errors( const Octree &tree, const force_reference &ref ) {
+    std::vector<double> err = tree.force_errors( ref );
+    std::sort( err.begin(), err.end() );
+    return err;
+}
+
+/**
+ * relative force errors of the tree against a direct sum (in double) on a sample of
+ * bodies, and the wall time of one force pass, for every multipole order and theta.
+ * the direct solver gets one row of its own, theta doesn't matter to it.
+*/
+void accuracy( const bench_config &cfg ) {
+    int n = cfg.nmax;
+    int nsample = std::min( n, 1000 );
+    std::vector<scalar> ic[7];
+    plummer( n, 1 * PC, ic );
+
+    scalar size = 50 * PC;
+    Octree tree( -size/2, -size/2, -size/2, size );
+    tree.set_threads( cfg.nthreads );
+    tree.build_tree( n, ic[0].data(), ic[1].data(), ic[2].data(), ic[3].data(), ic[4].data(), ic[5].data(), ic[6].data() );
+
+    force_reference ref;
+    tree.direct_reference( nsample, ref );
+
+    printf( "# force accuracy vs. cost, N = %d, %d sampled bodies, %d thread(s), %s kernel\n", n, nsample, cfg.nthreads, tree.kernel_name );
+    printf( "# %-10s  %6s  %12s  %12s  %12s\n", "solver", "theta", "median err", "99% err", "force [s]" );
+
+    // tree walk at every multipole order, then fmm at order 3, 4, 6, then direct sums
+    const char* names[] = { "mono", "quad", "oct", "fmm p=3", "fmm p=4", "fmm p=6", "direct" };
+    int orders[] = { ORDER_MONOPOLE, ORDER_QUADRUPOLE, ORDER_OCTUPOLE, 3, 4, 6, 0 };
+    scalar thetas[] = { 0.3, 0.5, 0.7, 0.8, 1.0 };
+
+    for (int o = 0; o < 7; o++) {
+        if (o < 3) {
+            tree.set_solver( SOLVER_TREE );
+            tree.set_order( orders[o] );
+        } else if (o < 6) {
+            tree.set_solver( SOLVER_FMM, orders[o] );
+        } else {
+            tree.set_solver( SOLVER_DIRECT );
+        }
+        tree.rebuild_tree( );
+
+        for (scalar theta : thetas) {
+            if (o == 6 && theta != thetas[0])
+                break;
+            auto t0 = std::chrono::steady_clock::now();
+            for (int r = 0; r < cfg.reps; r++)
+                tree.walk_tree( theta, true, false );
+            auto t1 = std::chrono::steady_clock::now();
+
+            std::vector<double> err = sorted_errors( tree, ref );
+            char th[16];
+            std::snprintf( th, sizeof(th), (o == 6) ? "-" : "%.2f", theta );
+            printf( "  %-10s  %6s  %12.3e  %12.3e  %12.4e\n", names[o], th, err[nsample / 2], 
+                    err[(int) (0.99 * (nsample - 1))], std::chrono::duration<double>( t1 - t0 ).count() / cfg.reps );
+        }
+    }
+}
+
+/** one point of the benchmark suite */
+struct suite_row {
+    int n, threads;
+    double theta;
+    double build, upward, walk, integrate, step, output; /** wall times [s] */
+    long interactions; /** interactions summed in one force walk */
+    double err_median, err_99; /** relative force errors against a direct sum */
+};
+
+/**
+ * mean wall time of fn over reps calls.
+*/
+template <typename F>
+double mean_time( int reps, F fn ) {
+    auto t0 = std::chrono::steady_clock::now();
+    for (int r = 0; r < reps; r++)
+        fn();
+    auto t1 = std::chrono::steady_clock::now();
+    return std::chrono::duration<double>( t1 - t0 ).count() / reps;
+}
+
+/**
+ * writes the suite's results as json.
+ *
+ * @returns false if the file couldn't be written.
+*/
+bool write_json( const char *fname, const char *kernel, const bench_config &cfg, const std::vector<suite_row> &rows ) {
+    FILE *f = fopen( fname, "w" );
+    if (f == NULL) return false;
+
+    fprintf( f, "{\n  \"bench\": \"suite\",\n  \"kernel\": \"%s\",\n  \"scalar_bytes\": %d,\n  \"kernel_bytes\": %d,\n  \"reps\": %d,\n"
+                "  \"results\": [\n", kernel, (int) sizeof(scalar), (int) sizeof(kscalar), cfg.reps );
+    for (size_t k = 0; k < rows.size(); k++) {
+        const suite_row &r = rows[k];
+        fprintf( f, "    {\"n\": %d, \"threads\": %d, \"theta\": %.2f, \"build_s\": %.6e, \"upward_s\": %.6e, "
+                    "\"walk_s\": %.6e, \"integrate_s\": %.6e, \"step_s\": %.6e, \"output_s\": %.6e, "
+                    "\"interactions\": %ld, \"interactions_per_s\": %.6e, \"err_median\": %.6e, \"err_99\": %.6e}%s\n",
+                 r.n, r.threads, r.theta, r.build, r.upward, r.walk, r.integrate, r.step, r.output,
+                 r.interactions, r.interactions / r.walk, r.err_median, r.err_99, k + 1 < rows.size() ? "," : "" );
+    }
+    fprintf( f, "  ]\n}\n" );
+    return fclose( f ) == 0;
+}
+
+/**
+ * writes the suite's results as csv, one row per point.
+ *
+ * @returns false if the file couldn't be written.
+*/
+bool write_csv( const char *fname, const std::vector<suite_row> &rows ) {
+    FILE *f = fopen( fname, "w" );
+    if (f == NULL) return false;
+
+    fprintf( f, "n,threads,theta,build_s,upward_s,walk_s,integrate_s,step_s,output_s,interactions,interactions_per_s,err_median,err_99\n" );
+    for (const suite_row &r : rows)
+        fprintf( f, "%d,%d,%.2f,%.6e,%.6e,%.6e,%.6e,%.6e,%.6e,%ld,%.6e,%.6e,%.6e\n",
+                 r.n, r.threads, r.theta, r.build, r.upward, r.walk, r.integrate, r.step, r.output,
+                 r.interactions, r.interactions / r.walk, r.err_median, r.err_99 );
+    return fclose( f ) == 0;
+}
+
+/**
+ * the whole benchmark suite, see the top of this file. the parts of a step are timed
+ * on their own:
+ *
+ *   build:     rebuild_tree, from scratch
+ *   upward:    update_tree on a tree nobody moved in, i.e. the refit (masses, centers of
+ *              mass, moments)
+ *   walk:      one force pass, walk_tree
+ *   integrate: the two half kicks and the drift of a leapfrog step (kick_drift and kick)
+ *   step:      a whole compute_forces, force pass, kicks, drift and tree update
+ *   output:    make_snapshot plus writing it out, as the snapshot writer would
+ *
+ * force errors are against a direct sum (in double) over 1000 sampled bodies.
+*/
+void suite( const bench_config &cfg ) {
+    std::vector<int> threads;
+    for (int t = 1; t < cfg.nthreads; t *= 2)
+        threads.push_back( t );
+    threads.push_back( std::max( cfg.nthreads, 1 ) );
+    scalar thetas[] = { 0.3, 0.5, 0.7 };
+
+    std::vector<suite_row> rows;
+    const char *kernel = "";
+    std::string snap = "globr-bench.snap";
+
+    printf( "# benchmark suite, %d rep(s) per timing\n", cfg.reps );
+    printf( "# %-8s %3s %5s %11s %11s %11s %11s %11s %11s %11s %10s %10s\n", "N", "thr", "theta", "build [s]", "upward [s]",
+            "walk [s]", "integr. [s]", "step [s]", "output [s]", "inter./s", "median err", "99% err" );
+
+    for (int n = 1000; n <= cfg.nmax; n *= 10) {
+        std::vector<scalar> ic[7];
+        plummer( n, 1 * PC, ic );
+        force_reference ref;
+
+        for (int nt : threads) {
+            scalar size = 50 * PC;
+            Octree tree( -size/2, -size/2, -size/2, size );
+            tree.set_threads( nt );
+            tree.build_tree( n, ic[0].data(), ic[1].data(), ic[2].data(), ic[3].data(), ic[4].data(), ic[5].data(), ic[6].data() );
+            kernel = tree.kernel_name;
+            if (ref.id.empty())
+                tree.direct_reference( std::min( n, 1000 ), ref );
+
+            double t_build = mean_time( cfg.reps, [&]() { tree.rebuild_tree( ); } );
+            tree.update_tree( ); // the first one may still grow the domain
+            double t_upward = mean_time( cfg.reps, [&]() { tree.update_tree( ); } );
+
+            snapshot out;
+            double t_output = mean_time( cfg.reps, [&]() {
+                tree.make_snapshot( 0, 0, 0.5, out );
+                write_binary( snap.c_str(), out );
+            });
+            remove( snap.c_str() );
+
+            // force passes first, steps move the bodies away from the reference
+            size_t first = rows.size();
+            for (scalar theta : thetas) {
+                suite_row r;
+                r.n = n; r.threads = nt; r.theta = theta;
+                r.build = t_build; r.upward = t_upward; r.output = t_output;
+                r.walk = mean_time( cfg.reps, [&]() { tree.walk_tree( theta, true, false ); } );
+                r.interactions = tree.walked.pp + tree.walked.pc;
+
+                std::vector<double> err = sorted_errors( tree, ref );
+                r.err_median = err[err.size() / 2];
+                r.err_99 = err[(size_t) (0.99 * (err.size() - 1))];
+                rows.push_back( r );
+            }
+
+            for (size_t k = first; k < rows.size(); k++) {
+                suite_row &r = rows[k];
+                r.step = mean_time( cfg.reps, [&]() { tree.compute_forces( r.theta, YR ); } );
+                r.integrate = mean_time( cfg.reps, [&]() { tree.kick_drift( 0.5 * YR, YR ); tree.kick( 0.5 * YR ); } );
+
+                printf( "  %-8d %3d %5.2f %11.4e %11.4e %11.4e %11.4e %11.4e %11.4e %11.3e %10.3e %10.3e\n", r.n, r.threads, r.theta,
+                        r.build, r.upward, r.walk, r.integrate, r.step, r.output, r.interactions / r.walk, r.err_median, r.err_99 );
+            }
+        }
+    }
+
+    if (cfg.json && !write_json( cfg.json, kernel, cfg, rows ))
+        printf( "Couldn't write %s\n", cfg.json );
+    if (cfg.csv && !write_csv( cfg.csv, rows ))
+        printf( "Couldn't write %s\n", cfg.csv );
+}
+
+/**
+ * checks that the leapfrog is second order: integrates the same softened, cold plummer
+ * sphere over the same stretch of time (one dynamical time, most of its collapse) with dt, dt/2,
+ * dt/4 .. and tracks the largest relative energy error along the way. the forces are
+ * direct sums, so the only error is the integrator's (and rounding).
+ *
+ * @returns true if the error shrank by 2^2 per halving of dt, within some slack.
+*/
+bool convergence( const bench_config &cfg ) {
+    int n = std::min( cfg.nmax, 1000 );
+    double a = 1 * PC;
+    std::vector<scalar> ic[7];
+    plummer( n, a, ic );
+
+    double mass = 0.5 * MSUN * n;
+    double tdyn = std::sqrt( a * a * a / (G * mass) );
+    double span = tdyn;
+
+    printf( "# leapfrog energy convergence, N = %d, direct forces, plummer softening a/10, %.3e s\n", n, span );
+    printf( "# %-8s  %12s  %14s  %8s\n", "steps", "dt [s]", "max |dE/E0|", "order" );
+
+    bool ok = true;
+    double last = 0;
+    for (int nstep = 8; nstep <= 128; nstep *= 2) {
+        scalar size = 50 * PC;
+        Octree tree( -size/2, -size/2, -size/2, size );
+        tree.set_threads( cfg.nthreads );
+        tree.set_solver( SOLVER_DIRECT );
+        tree.set_softening( SOFTEN_PLUMMER, (scalar) (0.1 * a) );
+        tree.build_tree( n, ic[0].data(), ic[1].data(), ic[2].data(), ic[3].data(), ic[4].data(), ic[5].data(), ic[6].data() );
+
+        tree.compute_energy( 0.5 );
+        double e0 = tree.kenergy + tree.penergy;
+        double worst = 0;
+        scalar dt = (scalar) (span / nstep);
+        for (int s = 0; s < nstep; s++) {
+            tree.compute_forces( 0.5, dt, true );
+            worst = std::max( worst, std::fabs( (tree.kenergy + tree.penergy - e0) / e0 ) );
+        }
+
+        if (last > 0) {
+            double order = std::log2( last / worst );
+            printf( "  %-8d  %12.4e  %14.4e  %8.2f\n", nstep, (double) dt, worst, order );
+            ok = ok && order > 1.7;
+        } else {
+            printf( "  %-8d  %12.4e  %14.4e  %8s\n", nstep, (double) dt, worst, "-" );
+        }
+        last = worst;
+    }
+
+    printf( "# %s\n", ok ? "second order" : "NOT second order" );
+    return ok;
+}
+
+/**
+ * force errors of the far field with softening: every solver (tree walk at every
+ * multipole order, fmm) against a direct sum with the same softening, for no softening,
+ * plummer and spline, on a plummer sphere with eps = a/20. higher orders have to stay
+ * better than the monopole, and softening can't make a solver much worse than it is
+ * without (the expansions are of the softened potential, see multipole.h and fmm.h).
+ *
+ * @returns true if all of them are fine.
+*/
+bool softened( const bench_config &cfg ) {
+    int n = std::min( cfg.nmax, 20000 );
+    int nsample = std::min( n, 1000 );
+    double a = 1 * PC;
+    std::vector<scalar> ic[7];
+    plummer( n, a, ic );
+
+    printf( "# softened force errors, N = %d, %d sampled bodies, eps = a/20\n", n, nsample );
+    printf( "# %-8s  %-10s  %6s  %12s  %12s\n", "soften", "solver", "theta", "median err", "99% err" );
+
+    const char* softs[] = { "none", "plummer", "spline" };
+    soften_mode modes[] = { SOFTEN_NONE, SOFTEN_PLUMMER, SOFTEN_SPLINE };
+    const char* names[] = { "mono", "quad", "oct", "fmm p=4" };
+    scalar thetas[] = { 0.5, 0.5, 0.5, 0.7 };
+    double plain[4];
+
+    bool ok = true;
+    for (int m = 0; m < 3; m++) {
+        scalar size = 50 * PC;
+        Octree tree( -size/2, -size/2, -size/2, size );
+        tree.set_threads( cfg.nthreads );
+        tree.set_softening( modes[m], (scalar) (a / 20) );
+        tree.build_tree( n, ic[0].data(), ic[1].data(), ic[2].data(), ic[3].data(), ic[4].data(), ic[5].data(), ic[6].data() );
+
+        force_reference ref;
+        tree.direct_reference( nsample, ref );
+
+        double mono = 0;
+        for (int o = 0; o < 4; o++) {
+            if (o < 3) {
+                tree.set_solver( SOLVER_TREE );
+                tree.set_order( o == 0 ? ORDER_MONOPOLE : (o == 1 ? ORDER_QUADRUPOLE : ORDER_OCTUPOLE) );
+            } else {
+                tree.set_solver( SOLVER_FMM, 4 );
+            }
+            tree.rebuild_tree( );
+            tree.walk_tree( thetas[o], true, false );
+
+            std::vector<double> err = sorted_errors( tree, ref );
+            double median = err[nsample / 2];
+            if (m == 0)
+                plain[o] = median;
+            if (o == 0)
+                mono = median;
+
+            bool fine = median < 2 * plain[o] && (o == 0 || o == 3 || median < mono);
+            ok = ok && fine;
+            printf( "  %-8s  %-10s  %6.2f  %12.3e  %12.3e%s\n", softs[m], names[o], (double) thetas[o], median,
+                    err[(int) (0.99 * (nsample - 1))], fine ? "" : "  <- too large" );
+        }
+    }
+
+    printf( "# %s\n", ok ? "softening ok" : "softening BREAKS the far field" );
+    return ok;
+}
+
+/**
+ * writes the bodies as text initial conditions and loads them again.
+ *
+ * @param ic the bodies, see plummer
+ * @param n number of bodies
+ * @param per_body one line per body instead of one row per quantity
+ * @param head written before the values (blank lines, say)
+ * @param eol line ending
+ * @param pool threads for loading
+ * @param out filled with what was loaded
+ *
+ * @returns false if the file couldn't be written or loaded.
+*/
+bool round_trip( const std::vector<scalar> *ic, int n, bool per_body, const char *head, const char *eol,
+                 ThreadPool *pool, initial_conditions &out ) {
+    char fname[] = "/tmp/globr-bench-ic-XXXXXX";
+    int fd = mkstemp( fname );
+    if (fd < 0) return false;
+    FILE *f = fdopen( fd, "w" );
+    if (f == NULL) { close( fd ); unlink( fname ); return false; }
+
+    fprintf( f, "%s", head );
+    int lines = per_body ? n : IC_ROWS, values = per_body ? IC_ROWS : n;
+    for (int l = 0; l < lines; l++) {
+        for (int v = 0; v < values; v++)
+            fprintf( f, v ? " %.9e" : "%.9e", (double) (per_body ? ic[v][l] : ic[l][v]) );
+        fprintf( f, "%s", eol );
+    }
+    fclose( f );
+
+    bool ok = load_initial_conditions( fname, out, pool );
+    unlink( fname );
+    return ok;
+}
+
+/**
+ * reads the same bodies back from text initial conditions in every layout the loader
+ * takes, see round_trip. all of them have to give the same values as seven plain rows,
+ * and those the bodies to within the 10 digits they were written with.
+ *
+ * @returns true if they all do.
+*/
+bool ic_layouts( const bench_config &cfg ) {
+    int n = std::min( cfg.nmax, 1000 );
+    std::vector<scalar> ic[7];
+    plummer( n, 1 * PC, ic );
+    ThreadPool pool( cfg.nthreads );
+
+    const char* names[] = { "rows", "per body", "blank line", "blank lines", "crlf" };
+    bool per_body[] = { false, true, false, true, false };
+    const char* heads[] = { "", "", "\n", " \t\n\n  \n", "\r\n" };
+    const char* eols[] = { "\n", "\n", "\n", "\n", "\r\n" };
+
+    printf( "# initial conditions layouts, N = %d\n", n );
+    printf( "# %-12s  %6s  %12s\n", "layout", "same", "max rel err" );
+
+    bool ok = true;
+    initial_conditions ref;
+    for (int k = 0; k < 5; k++) {
+        initial_conditions got;
+        bool loaded = round_trip( ic, n, per_body[k], heads[k], eols[k], &pool, got );
+        if (k == 0)
+            ref = got;
+
+        bool same = loaded && got.n == n && got.data == ref.data;
+        double worst = 0;
+        for (int r = 0; same && r < IC_ROWS; r++)
+            for (int i = 0; i < n; i++)
+                if (ic[r][i] != 0)
+                    worst = std::max( worst, std::fabs( (double) got.row( r )[i] / ic[r][i] - 1 ) );
+        same = same && worst < 1e-6;
+
+        ok = ok && same;
+        printf( "  %-12s  %6s  %12.3e\n", names[k], same ? "yes" : "no", worst );
+    }
+
+    printf( "# %s\n", ok ? "all layouts load" : "a layout DOESN'T load" );
+    return ok;
+}
+
+/**
+ * picks a run back up from a checkpoint and steps it once.
+ *
+ * @param fname checkpoint file
+ * @param set applies the restarted run's force settings to a tree (before load_checkpoint)
+ * @param again ... and once more afterwards, which throws out the checkpoint's accelerations
+ * @param dt timestep [s]
+ * @param pos filled with the positions after the step
+*/
+template <class Settings>
+void restarted( const char *fname, Settings set, bool again, scalar dt, const bench_config &cfg, std::vector<double> &pos ) {
+    pos.clear();
+    Octree tree;
+    tree.set_threads( cfg.nthreads );
+    set( tree );
+    checkpoint_header h;
+    if (!tree.load_checkpoint( fname, h ))
+        return;
+    if (again)
+        set( tree );
+
+    tree.compute_forces( 0.5, dt );
+    std::vector<double> vel( 3 * tree.n );
+    pos.resize( 3 * tree.n );
+    tree.get_bodies( pos.data(), vel.data() );
+}
+
+/**
+ * checkpoints a softened plummer sphere a few steps in and restarts it, once with the
+ * same settings, which has to go on exactly as the run itself does, and once each with
+ * other softening, multipole order and solver, which have to start with a fresh force
+ * pass (see Octree::load_checkpoint): the same positions after a step as when their
+ * setters clear the accelerations after the load.
+ *
+ * @returns true if they all do.
+*/
+bool restarts( const bench_config &cfg ) {
+    int n = std::min( cfg.nmax, 2000 );
+    double a = 1 * PC;
+    std::vector<scalar> ic[7];
+    plummer( n, a, ic );
+    scalar eps = 10000; // [AU], as the command line and the checkpoint have it
+    scalar dt = (scalar) (std::sqrt( a * a * a / (G * 0.5 * MSUN * n) ) / 200);
+
+    scalar size = 50 * PC;
+    Octree tree( -size/2, -size/2, -size/2, size );
+    tree.set_threads( cfg.nthreads );
+    tree.set_softening( SOFTEN_PLUMMER, eps * AU );
+    tree.build_tree( n, ic[0].data(), ic[1].data(), ic[2].data(), ic[3].data(), ic[4].data(), ic[5].data(), ic[6].data() );
+    for (int s = 0; s < 3; s++)
+        tree.compute_forces( 0.5, dt );
+
+    checkpoint_header h;
+    std::memset( &h, 0, sizeof(h) );
+    h.multipole = ORDER_MONOPOLE;
+    h.solver = SOLVER_TREE;
+    h.fmm_order = 4;
+    h.soften = SOFTEN_PLUMMER;
+    h.eps = eps;
+    std::strncpy( h.kernel, tree.kernel_name, CHECKPOINT_KERNEL - 1 );
+
+    char fname[] = "/tmp/globr-bench-ckpt-XXXXXX";
+    int fd = mkstemp( fname );
+    if (fd < 0 || !tree.save_checkpoint( fname, h )) {
+        printf( "# couldn't write a checkpoint\n" );
+        if (fd >= 0) { close( fd ); unlink( fname ); }
+        return false;
+    }
+    close( fd );
+
+    tree.compute_forces( 0.5, dt );
+    std::vector<double> run( 3 * n ), vel( 3 * n );
+    tree.get_bodies( run.data(), vel.data() );
+
+    printf( "# restarts of a plummer sphere, N = %d, plummer softening %g AU, monopole tree walk\n", n, (double) eps );
+    printf( "# %-18s  %6s\n", "restarted with", "same" );
+
+    std::vector<double> got, fresh;
+    restarted( fname, [&]( Octree &t ) { t.set_softening( SOFTEN_PLUMMER, eps * AU ); }, false, dt, cfg, got );
+    bool ok = got == run;
+    printf( "  %-18s  %6s\n", "the same settings", ok ? "yes" : "no" );
+
+    const char* names[] = { "eps 2x", "spline softening", "quadrupole", "fmm" };
+    for (int k = 0; k < 4; k++) {
+        auto set = [&]( Octree &t ) {
+            t.set_softening( k == 1 ? SOFTEN_SPLINE : SOFTEN_PLUMMER, (k == 0 ? 2 * eps : eps) * AU );
+            if (k == 2) t.set_order( ORDER_QUADRUPOLE );
+            if (k == 3) t.set_solver( SOLVER_FMM, 4 );
+        };
+        restarted( fname, set, false, dt, cfg, got );
+        restarted( fname, set, true, dt, cfg, fresh );
+        bool same = !got.empty() && got == fresh;
+        ok = ok && same;
+        printf( "  %-18s  %6s\n", names[k], same ? "yes" : "no" );
+    }
+    unlink( fname );
+
+    printf( "# %s\n", ok ? "restarts ok" : "a restart DOESN'T pick up right" );
+    return ok;
+}
+
+/**
+ * a plummer sphere with one star on its way out, 9 pc from the center with --escape 10
+ * pc, then both moved by hand as a drift would: the cluster 2 pc one way, the star half
+ * a parsec the other. that puts the star past the escape radius, but not as seen from
+ * the cluster's old center of mass, so update_tree has to find the new one whether it
+ * refits the tree or not.
+ *
+ * @returns true if the star leaves the tree both ways.
+*/
+bool escapes( const bench_config &cfg ) {
+    int n = std::min( cfg.nmax, 2000 );
+    std::vector<scalar> ic[7];
+    plummer( n, 0.3 * PC, ic );
+    for (int k = 0; k < 7; k++)
+        ic[k].push_back( 0 );
+    ic[0][n] = -9 * PC;
+    ic[3][n] = -2e4;
+    ic[6][n] = 0.5;
+
+    printf( "# an escaper past --escape 10 pc after a drift, N = %d\n", n + 1 );
+    printf( "# %-10s  %8s\n", "refit", "ejected" );
+
+    bool ok = true;
+    scalar refits[] = { 0, 0.05 };
+    for (int k = 0; k < 2; k++) {
+        scalar size = 50 * PC;
+        Octree tree( -size/2, -size/2, -size/2, size );
+        tree.set_threads( cfg.nthreads );
+        tree.set_refit( refits[k] );
+        tree.set_escape( 10 * PC );
+        tree.build_tree( n + 1, ic[0].data(), ic[1].data(), ic[2].data(), ic[3].data(), ic[4].data(), ic[5].data(), ic[6].data() );
+
+        for (int i = 0; i < tree.n; i++)
+            tree.p.x[i] += (tree.p.id[i] == n) ? -0.5 * PC : 2 * PC;
+        tree.update_tree( );
+
+        bool left = tree.stats.ejected == 1 && tree.ntree == n;
+        ok = ok && left;
+        printf( "  %-10.2f  %8d%s\n", (double) refits[k], tree.stats.ejected, left ? "" : "  <- should be 1" );
+    }
+
+    printf( "# %s\n", ok ? "escapers leave" : "an escaper DOESN'T leave" );
+    return ok;
+}
+
+int main( int argc, char *argv[] ) {
+
+    bench_config cfg = parse_args( argc, argv );
+
+    if (std::strcmp( cfg.mode, "accuracy" ) == 0) {
+        accuracy( cfg );
+        return 0;
+    } else if (std::strcmp( cfg.mode, "refit" ) == 0) {
+        refit( cfg );
+        return 0;
+    } else if (std::strcmp( cfg.mode, "suite" ) == 0) {
+        suite( cfg );
+        return 0;
+    } else if (std::strcmp( cfg.mode, "convergence" ) == 0) {
+        return convergence( cfg ) ? 0 : 1;
+    } else if (std::strcmp( cfg.mode, "softening" ) == 0) {
+        return softened( cfg ) ? 0 : 1;
+    } else if (std::strcmp( cfg.mode, "ic" ) == 0) {
+        return ic_layouts( cfg ) ? 0 : 1;
+    } else if (std::strcmp( cfg.mode, "restart" ) == 0) {
+        return restarts( cfg ) ? 0 : 1;
+    } else if (std::strcmp( cfg.mode, "escape" ) == 0) {
+        return escapes( cfg ) ? 0 : 1;
+    } else if (std::strcmp( cfg.mode, "build" ) != 0) {
+        printf( "Unknown benchmark: %s\n", cfg.mode );
+        return 1;
+    }
+
+    printf( "# tree build benchmark, %d thread(s), %d rebuild(s) per point\n", cfg.nthreads, cfg.reps );
+    printf( "# %-10s  %14s  %14s  %10s  %10s  %6s\n", "N", "insert [s]", "morton [s]", "speedup", "nodes", "same" );
+
+    bool ok = true;
+    for (int n = 1000; n <= cfg.nmax; n *= 10) {
+        std::vector<scalar> ic[7];
+        plummer( n, 1 * PC, ic );
+
+        int nodes_insert, nodes_morton;
+        double t_insert = time_build( ic, n, BUILD_INSERT, cfg, &nodes_insert );
+        double t_morton = time_build( ic, n, BUILD_MORTON, cfg, &nodes_morton );
+
+        bool same = same_build( ic, n, cfg );
+        ok = ok && same;
+
+        printf( "  %-10d  %14.4e  %14.4e  %10.2f  %10d  %6s\n", n, t_insert, t_morton, t_insert / t_morton, nodes_morton,
+                same ? "yes" : "no" );
+    }
+
+    if (!ok)
+        printf( "# the morton build on %d threads doesn't make the same tree as on one\n", cfg.nthreads );
+    return ok ? 0 : 1;
+}
@@ -10,6 +10,7 @@ Body::Body( ) {
     this->vel = {0, 0, 0};
     this->acc = {0, 0, 0};
     this->mass = 0.0;
+    this->id = 0;
 
 }
 
@@ -30,5 +31,6 @@ Body::Body( scalar x, scalar y, scalar z, scalar vx, scalar vy, scalar vz, scala
     this->vel = {vx, vy, vz};
     this->acc = {0, 0, 0};
     this->mass = m;
+    this->id = 0;
 
 }
\ No newline at end of file
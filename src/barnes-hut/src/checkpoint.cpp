@@ -0,0 +1,127 @@
+#include "checkpoint.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <unistd.h>
+
+/**
+ * writes a checkpoint atomically: everything goes to fname.tmp first, which is synced
+ * to disk and only then renamed over fname. a job killed halfway through leaves the
+ * previous checkpoint as it was.
+ *
+ * @param fname checkpoint file
+ * @param h header, magic, version, n, scalar_size and the node counts are filled in here
+ * @param p bodies, in tree order
+ * @param nodes the tree
+ * @param pairs kepler pairs
+ *
+ * @returns false if anything went wrong (fname is untouched then).
+*/
+bool write_checkpoint( const char *fname, const checkpoint_header &h, const Particles &p, const std::vector<Node> &nodes,
+                       const std::vector<kepler_pair> &pairs ) {
+    std::string tmp = std::string( fname ) + ".tmp";
+
+    checkpoint_header head = h;
+    memcpy( head.magic, CHECKPOINT_MAGIC, sizeof(head.magic) );
+    head.version = CHECKPOINT_VERSION;
+    head.n = p.n;
+    head.scalar_size = sizeof(scalar);
+    head.node_size = sizeof(Node);
+    head.nnodes = (int32_t) nodes.size();
+    head.npairs = (int32_t) pairs.size();
+
+    FILE *fout = fopen( tmp.c_str(), "wb" );
+    if (fout == NULL) return false;
+
+    const std::vector<scalar> *arrays[] = { &p.x, &p.y, &p.z, &p.vx, &p.vy, &p.vz, &p.ax, &p.ay, &p.az, &p.m };
+
+    bool ok = fwrite( &head, sizeof(head), 1, fout ) == 1;
+    for (const std::vector<scalar> *a : arrays)
+        ok = ok && fwrite( a->data(), sizeof(scalar), p.n, fout ) == (size_t) p.n;
+    ok = ok && fwrite( p.id.data(), sizeof(int), p.n, fout ) == (size_t) p.n;
+    ok = ok && fwrite( p.rung.data(), sizeof(int), p.n, fout ) == (size_t) p.n;
+    ok = ok && fwrite( nodes.data(), sizeof(Node), nodes.size(), fout ) == nodes.size();
+    ok = ok && fwrite( pairs.data(), sizeof(kepler_pair), pairs.size(), fout ) == pairs.size();
+
+    ok = ok && fflush( fout ) == 0 && fsync( fileno( fout ) ) == 0;
+    ok = (fclose( fout ) == 0) && ok;
+    ok = ok && rename( tmp.c_str(), fname ) == 0;
+
+    if (!ok) remove( tmp.c_str() );
+    return ok;
+}
+
+/**
+ * reads just the header of a checkpoint, to get the settings of a run before the tree
+ * is set up.
+ *
+ * @param fname checkpoint file
+ * @param h filled with the header
+ *
+ * @returns false (after saying why) if it isn't a checkpoint this build can use.
+*/
+bool read_checkpoint_header( const char *fname, checkpoint_header &h ) {
+    FILE *fin = fopen( fname, "rb" );
+    if (fin == NULL) {
+        perror( "Error opening checkpoint" );
+        return false;
+    }
+
+    bool ok = fread( &h, sizeof(h), 1, fin ) == 1;
+    fclose( fin );
+
+    if (!ok || memcmp( h.magic, CHECKPOINT_MAGIC, sizeof(h.magic) ) != 0 || h.version != CHECKPOINT_VERSION) {
+        printf( "%s: not a globr checkpoint\n", fname );
+        return false;
+    }
+    if (h.scalar_size != (int) sizeof(scalar)) {
+        printf( "%s: written with %d byte scalars, this build uses %d\n", fname, h.scalar_size, (int) sizeof(scalar) );
+        return false;
+    }
+    if (h.node_size != (int) sizeof(Node) || h.nnodes < 1 || h.npairs < 0) {
+        printf( "%s: tree written by a different build (%d byte nodes, this one uses %d)\n", fname, h.node_size, (int) sizeof(Node) );
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * reads a whole checkpoint.
+ *
+ * @param fname checkpoint file
+ * @param h filled with the header
+ * @param p resized and filled with the bodies, in the order they were saved
+ * @param nodes filled with the tree
+ * @param pairs filled with the kepler pairs
+ *
+ * @returns false (after saying why) if the file is unusable or truncated.
+*/
+bool read_checkpoint( const char *fname, checkpoint_header &h, Particles &p, std::vector<Node> &nodes,
+                      std::vector<kepler_pair> &pairs ) {
+    if (!read_checkpoint_header( fname, h ))
+        return false;
+
+    FILE *fin = fopen( fname, "rb" );
+    if (fin == NULL) return false;
+
+    p.resize( h.n );
+    std::vector<scalar> *arrays[] = { &p.x, &p.y, &p.z, &p.vx, &p.vy, &p.vz, &p.ax, &p.ay, &p.az, &p.m };
+
+    bool ok = fseek( fin, sizeof(h), SEEK_SET ) == 0;
+    for (std::vector<scalar> *a : arrays)
+        ok = ok && fread( a->data(), sizeof(scalar), h.n, fin ) == (size_t) h.n;
+    ok = ok && fread( p.id.data(), sizeof(int), h.n, fin ) == (size_t) h.n;
+    ok = ok && fread( p.rung.data(), sizeof(int), h.n, fin ) == (size_t) h.n;
+
+    nodes.assign( h.nnodes, Node( vec(), 0 ) );
+    ok = ok && fread( nodes.data(), sizeof(Node), h.nnodes, fin ) == (size_t) h.nnodes;
+    pairs.resize( h.npairs );
+    ok = ok && fread( pairs.data(), sizeof(kepler_pair), h.npairs, fin ) == (size_t) h.npairs;
+    fclose( fin );
+
+    if (!ok)
+        printf( "%s: truncated checkpoint\n", fname );
+    return ok;
+}
@@ -0,0 +1,42 @@
+#include "snapshot.h"
+
+#include <stdio.h>
+#include <string>
+
+/**
+ * turns binary snapshots back into the old text tables, for anything that still
+ * reads .dat files. every globr_{run}_0000000.snap becomes globr_{run}_0000000.dat
+ * next to it.
+ *
+ * usage: ./globr-convert ../data/run/globr_run_*.snap
+*/
+int main( int argc, char *argv[] ) {
+
+    if (argc < 2) {
+        printf( "usage: %s snapshot.snap [snapshot.snap ...]\n", argv[0] );
+        return 1;
+    }
+
+    snapshot s;
+    int failed = 0;
+
+    for (int i = 1; i < argc; i++) {
+        std::string in = argv[i];
+        std::string out = in;
+
+        size_t dot = out.rfind( '.' );
+        if (dot != std::string::npos && out.find( '/', dot ) == std::string::npos)
+            out.erase( dot );
+        out += ".dat";
+
+        if (!read_binary( in.c_str(), s )) {
+            printf( "Not a globr snapshot: %s\n", in.c_str() );
+            failed++;
+        } else if (!write_text( out.c_str(), s )) {
+            printf( "Couldn't write %s\n", out.c_str() );
+            failed++;
+        }
+    }
+
+    return failed ? 1 : 0;
+}
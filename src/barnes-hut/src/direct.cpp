@@ -0,0 +1,209 @@
+#include "direct.h"
+
+#include <algorithm>
+#include <cmath>
+
+Direct::Direct( ) {
+}
+
+/**
+ * copies bodies [first, first + count) into a tile, relative to o, and clears its sums.
+*/
+void Direct::load( tile &t, const Particles &p, int first, int count, vec o ) const {
+    t.resize( count );
+    for (int k = 0; k < count; k++) {
+        int i = first + k;
+        t.x[k] = (kscalar) (p.x[i] - o.x);
+        t.y[k] = (kscalar) (p.y[i] - o.y);
+        t.z[k] = (kscalar) (p.z[i] - o.z);
+        t.gm[k] = (kscalar) (G * p.m[i]);
+    }
+}
+
+/**
+ * all pairs, tile against tile, see the class comment. the circle method: with an even
+ * number of tiles m (an empty one is added if needed), tile m - 1 stays put and the
+ * others rotate, so round r pairs m - 1 with r and (r + k) with (r - k) mod (m - 1).
+ * the tiles' own pairs go first, all in one round.
+ *
+ * @param p the particles
+ * @param n number of bodies to sum over, [0, n) of p
+ * @param pool threads to spread the tile pairs over
+ * @param tkernel tile kernel
+ * @param soft softening
+*/
+void Direct::pairs( Particles &p, int n, ThreadPool *pool, tile_kernel tkernel, const softening &soft ) {
+    int ntile = (n + DIRECT_TILE - 1) / DIRECT_TILE;
+    int m = ntile + (ntile % 2);
+    acc.assign( 3 * (size_t) n, 0.0 );
+
+    auto add = [&]( const tile &t, int first ) {
+        for (int k = 0; k < t.count; k++) {
+            acc[3 * (size_t) (first + k)] += t.ax[k];
+            acc[3 * (size_t) (first + k) + 1] += t.ay[k];
+            acc[3 * (size_t) (first + k) + 2] += t.az[k];
+        }
+    };
+
+    pool->parallel_for( ntile, 1, [&]( int begin, int end, int tid ) {
+        tile &a = work[tid].a;
+        for (int t = begin; t < end; t++) {
+            int first = t * DIRECT_TILE;
+            load( a, p, first, std::min( DIRECT_TILE, n - first ), p.pos( first ) );
+            tkernel( a, a, soft );
+            add( a, first );
+        }
+    });
+
+    for (int r = 0; r < m - 1; r++) {
+        pool->parallel_for( m / 2, 1, [&]( int begin, int end, int tid ) {
+            tile &a = work[tid].a, &b = work[tid].b;
+            for (int k = begin; k < end; k++) {
+                int u = (k == 0) ? m - 1 : (r + k) % (m - 1);
+                int v = (k == 0) ? r : (r - k + m - 1) % (m - 1);
+                if (u >= ntile || v >= ntile)
+                    continue;
+
+                int fa = u * DIRECT_TILE, fb = v * DIRECT_TILE;
+                vec o = p.pos( fa );
+                load( a, p, fa, std::min( DIRECT_TILE, n - fa ), o );
+                load( b, p, fb, std::min( DIRECT_TILE, n - fb ), o );
+                tkernel( a, b, soft );
+                add( a, fa );
+                add( b, fb );
+            }
+        });
+    }
+
+    for (int i = 0; i < n; i++) {
+        p.ax[i] = acc[3 * (size_t) i];
+        p.ay[i] = acc[3 * (size_t) i + 1];
+        p.az[i] = acc[3 * (size_t) i + 2];
+    }
+}
+
+/**
+ * one side at a time: every tile of bodies that need results gets a list of all n
+ * bodies (relative to its first one) and runs the force kernel and/or potential sum
+ * over it, body by body.
+ *
+ * @param p the particles
+ * @param n number of bodies to sum over, [0, n) of p
+ * @param pool threads to spread the tiles over
+ * @param kernel force kernel
+ * @param soft softening
+ * @param forces fill in p.ax, p.ay, p.az
+ * @param potential fill in p.pot
+ * @param mask optional, one flag per body, only the flagged ones get new results
+*/
+void Direct::one_sided( Particles &p, int n, ThreadPool *pool, accel_kernel kernel, const softening &soft,
+                        bool forces, bool potential, const char *mask ) {
+    int ntile = (n + DIRECT_TILE - 1) / DIRECT_TILE;
+
+    pool->parallel_for( ntile, 1, [&]( int begin, int end, int tid ) {
+        ilist &src = work[tid].src;
+        for (int t = begin; t < end; t++) {
+            int first = t * DIRECT_TILE, last = std::min( first + DIRECT_TILE, n );
+
+            bool any = mask == nullptr;
+            for (int i = first; i < last && !any; i++)
+                any = mask[i];
+            if (!any)
+                continue;
+
+            src.clear( p.pos( first ) );
+            for (int j = 0; j < n; j++)
+                src.push( p.x[j], p.y[j], p.z[j], (scalar) (G * p.m[j]) );
+
+            for (int i = first; i < last; i++) {
+                if (mask && !mask[i])
+                    continue;
+                if (forces) {
+                    vec a = kernel( p.x[i], p.y[i], p.z[i], src, soft );
+                    p.ax[i] = a.x;
+                    p.ay[i] = a.y;
+                    p.az[i] = a.z;
+                }
+                if (potential)
+                    p.pot[i] = -potential_sum( p.x[i], p.y[i], p.z[i], src, soft );
+            }
+        }
+    });
+}
+
+/**
+ * fills in the accelerations and/or potentials of bodies [0, n), summed over [0, n).
+ *
+ * @param p the particles
+ * @param n number of bodies, the tree's (escapers are left to the caller)
+ * @param pool threads to spread the work over
+ * @param kernel force kernel, for the one-sided sums
+ * @param tkernel tile kernel, for all pairs at once
+ * @param soft softening
+ * @param forces fill in p.ax, p.ay, p.az
+ * @param potential fill in p.pot
+ * @param mask optional, one flag per body, only the flagged ones get new results
+*/
+void Direct::compute( Particles &p, int n, ThreadPool *pool, accel_kernel kernel, tile_kernel tkernel,
+                      const softening &soft, bool forces, bool potential, const char *mask ) {
+    if (n == 0)
+        return;
+    work.resize( pool->size() );
+
+    if (forces && mask == nullptr) {
+        pairs( p, n, pool, tkernel, soft );
+        forces = false;
+    }
+    if (forces || potential)
+        one_sided( p, n, pool, kernel, soft, forces, potential, mask );
+}
+
+/**
+ * the factor the force kernels multiply the separation with to get one source's pull,
+ * softening included, in double.
+*/
+static inline double exact_pull( double gm, double r2, const softening &soft ) {
+    double h = soft.h();
+    if (r2 < h * h) {
+        double u = std::sqrt( r2 ) / h;
+        double w = (u < 0.5) ? 10.666666667 + u*u * (32.0 * u - 38.4)
+                             : 21.333333333 - 48.0 * u + 38.4 * u*u - 10.666666667 * u*u*u - 0.066666667 / (u*u*u);
+        return gm * w / (h * h * h);
+    }
+    double inv = 1 / std::sqrt( r2 + soft.eps2() );
+    return gm * inv * inv * inv;
+}
+
+/**
+ * sums the accelerations of every (n / nsample)-th body directly, in double, as the
+ * reference for force errors.
+ *
+ * @param p the particles
+ * @param n number of bodies to sample from and sum over, [0, n) of p
+ * @param pool threads to spread the sample over
+ * @param soft softening
+ * @param nsample number of bodies to sample, at most n
+ * @param ref filled with the sample
+*/
+void Direct::reference( const Particles &p, int n, ThreadPool *pool, const softening &soft, int nsample,
+                        force_reference &ref ) const {
+    nsample = std::min( nsample, n );
+    ref.id.resize( nsample );
+    ref.acc.resize( 3 * (size_t) nsample );
+
+    pool->parallel_for( nsample, 16, [&]( int begin, int end, int ) {
+        for (int s = begin; s < end; s++) {
+            int i = (int) ((long) s * n / nsample);
+            double ax = 0, ay = 0, az = 0;
+            for (int j = 0; j < n; j++) {
+                double dx = (double) p.x[j] - p.x[i], dy = (double) p.y[j] - p.y[i], dz = (double) p.z[j] - p.z[i];
+                double r2 = dx*dx + dy*dy + dz*dz;
+                if (r2 == 0) continue;
+                double f = exact_pull( G * p.m[j], r2, soft );
+                ax += f * dx; ay += f * dy; az += f * dz;
+            }
+            ref.id[s] = p.id[i];
+            ref.acc[3*s] = ax; ref.acc[3*s + 1] = ay; ref.acc[3*s + 2] = az;
+        }
+    });
+}
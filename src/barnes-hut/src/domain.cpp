@@ -0,0 +1,461 @@
+#include "domain.h"
+#include "ic.h"
+#include "morton.h"
+#include "snapshot.h"
+
+#include <algorithm>
+#include <cmath>
+#include <stdio.h>
+#include <string.h>
+
+/**
+ * constructor, no bodies yet (see scatter).
+ *
+ * @param comm the ranks taking part, usually MPI_COMM_WORLD
+*/
+Domain::Domain( MPI_Comm comm ) {
+    this->comm = comm;
+    MPI_Comm_rank( comm, &this->rank );
+    MPI_Comm_size( comm, &this->size );
+    this->ntotal = 0;
+    this->kenergy = 0;
+    this->penergy = 0;
+    this->energies = false;
+    this->have_acc = false;
+    this->extent = 0;
+
+    scount.resize( size ); sdispl.resize( size );
+    rcount.resize( size ); rdispl.resize( size );
+}
+
+/**
+ * hands the initial conditions out: rank 0 has them all and sends every rank an equal
+ * share, which builds its tree from it. decompose then sorts out who really owns what.
+ *
+ * @param tree this rank's tree, set up but still empty
+ * @param n number of bodies, only needed on rank 0
+ * @param rows the IC_ROWS arrays of n values (see initial_conditions), only read on rank 0
+*/
+void Domain::scatter( Octree &tree, int n, scalar *rows ) {
+    MPI_Bcast( &n, 1, MPI_INT, 0, comm );
+    this->ntotal = n;
+
+    for (int r = 0; r < size; r++) {
+        int first = (int) ((long) n * r / size), last = (int) ((long) n * (r + 1) / size);
+        scount[r] = (last - first) * (int) sizeof(scalar);
+        sdispl[r] = first * (int) sizeof(scalar);
+    }
+    int first = sdispl[rank] / (int) sizeof(scalar);
+    int count = scount[rank] / (int) sizeof(scalar);
+
+    std::vector<scalar> mine( (size_t) IC_ROWS * count );
+    for (int k = 0; k < IC_ROWS; k++)
+        MPI_Scatterv( rank == 0 ? rows + (size_t) k * n : nullptr, scount.data(), sdispl.data(), MPI_BYTE,
+                      mine.data() + (size_t) k * count, scount[rank], MPI_BYTE, 0, comm );
+
+    scalar *row[IC_ROWS];
+    for (int k = 0; k < IC_ROWS; k++)
+        row[k] = mine.data() + (size_t) k * count;
+    tree.build_tree( count, row[IC_X], row[IC_Y], row[IC_Z], row[IC_VX], row[IC_VY], row[IC_VZ], row[IC_M] );
+
+    for (int i = 0; i < count; i++)
+        tree.p.id[i] += first; // ids are positions in the initial conditions, not in the share
+
+    decompose( tree );
+}
+
+/**
+ * swaps how many units every rank sends every other one (scount), and works out the
+ * displacements on both sides.
+ *
+ * @returns the number of units this rank gets.
+*/
+long Domain::counts( ) {
+    MPI_Alltoall( scount.data(), 1, MPI_INT, rcount.data(), 1, MPI_INT, comm );
+
+    long total = 0;
+    int s = 0;
+    for (int r = 0; r < size; r++) {
+        sdispl[r] = s;
+        rdispl[r] = (int) total;
+        s += scount[r];
+        total += rcount[r];
+    }
+    return total;
+}
+
+/**
+ * sends what counts set up, units of unit bytes.
+ *
+ * @param send everything going out, in rank order
+ * @param recv room for everything coming in, see counts
+ * @param unit size of one unit [bytes]
+*/
+void Domain::alltoallv( const void *send, void *recv, int unit ) {
+    std::vector<int> sc( size ), sd( size ), rc( size ), rd( size );
+    for (int r = 0; r < size; r++) {
+        sc[r] = scount[r] * unit; sd[r] = sdispl[r] * unit;
+        rc[r] = rcount[r] * unit; rd[r] = rdispl[r] * unit;
+    }
+    MPI_Alltoallv( send, sc.data(), sd.data(), MPI_BYTE, recv, rc.data(), rd.data(), MPI_BYTE, comm );
+}
+
+/**
+ * splits the bodies up between the ranks along the morton curve of the whole cluster,
+ * so every rank ends up with one run of it of about the same cost, and sends everybody
+ * where they belong.
+ *
+ * a body costs as many interactions as it had in its last walk (at least 1, for bodies
+ * that haven't been walked yet). the cuts are found by bisecting the key range, all
+ * splitters at once: about 63 rounds of summing up the cost left of every candidate over
+ * all ranks. bodies sharing a key can't be split up, and neither can a single body, so with
+ * very few bodies per rank some will do more than others.
+ *
+ * @param tree this rank's tree; its bodies are replaced, the tree itself is left stale,
+ *             and so are the accelerations
+*/
+void Domain::decompose( Octree &tree ) {
+    Particles &p = tree.p;
+    int n = tree.n;
+
+    // the cube around everybody
+    double box[6] = { HUGE_VAL, HUGE_VAL, HUGE_VAL, HUGE_VAL, HUGE_VAL, HUGE_VAL }; // lower corner, minus upper corner
+    for (int i = 0; i < n; i++) {
+        box[0] = std::fmin( box[0], p.x[i] ); box[3] = std::fmin( box[3], -p.x[i] );
+        box[1] = std::fmin( box[1], p.y[i] ); box[4] = std::fmin( box[4], -p.y[i] );
+        box[2] = std::fmin( box[2], p.z[i] ); box[5] = std::fmin( box[5], -p.z[i] );
+    }
+    MPI_Allreduce( MPI_IN_PLACE, box, 6, MPI_DOUBLE, MPI_MIN, comm );
+
+    vec corner = { (scalar) box[0], (scalar) box[1], (scalar) box[2] };
+    this->extent = (scalar) std::fmax( -box[3] - box[0], std::fmax( -box[4] - box[1], -box[5] - box[2] ) );
+    if (!(extent > 0))
+        this->extent = 1; // everybody in one spot (or nobody at all)
+
+    // this rank's bodies along the curve, and the running cost
+    keys.resize( n );
+    order.resize( n );
+    for (int i = 0; i < n; i++) {
+        keys[i] = morton_key( p.pos( i ), corner, extent );
+        order[i] = i;
+    }
+    sort_keys( keys, order, kbuf, obuf, tree.pool );
+
+    std::vector<double> sum( n + 1, 0.0 );
+    for (int k = 0; k < n; k++)
+        sum[k + 1] = sum[k] + std::fmax( p.cost[order[k]], 1.0f );
+
+    double total = sum[n];
+    MPI_Allreduce( MPI_IN_PLACE, &total, 1, MPI_DOUBLE, MPI_SUM, comm );
+
+    // splitter s cuts at the smallest key with at least (s + 1) / size of the cost left of it
+    int nsplit = size - 1;
+    std::vector<uint64_t> lo( nsplit, 0 ), hi( nsplit, 1ULL << 63 ), mid( nsplit );
+    below.resize( nsplit );
+    while (lo != hi) { // below is summed over all ranks, so they all take the same turns
+        for (int s = 0; s < nsplit; s++) {
+            mid[s] = lo[s] + (hi[s] - lo[s]) / 2;
+            below[s] = sum[std::lower_bound( keys.begin(), keys.end(), mid[s] ) - keys.begin()];
+        }
+        MPI_Allreduce( MPI_IN_PLACE, below.data(), nsplit, MPI_DOUBLE, MPI_SUM, comm );
+        for (int s = 0; s < nsplit; s++) {
+            if (below[s] >= total * (s + 1) / size)
+                hi[s] = mid[s];
+            else
+                lo[s] = mid[s] + 1;
+        }
+    }
+
+    // keys are sorted, so every rank's bodies are one run of them
+    out.resize( n );
+    std::fill( scount.begin(), scount.end(), 0 );
+    int dest = 0;
+    for (int k = 0; k < n; k++) {
+        while (dest < nsplit && keys[k] >= hi[dest])
+            dest++;
+        scount[dest]++;
+
+        int i = order[k];
+        out[k] = { p.x[i], p.y[i], p.z[i], p.vx[i], p.vy[i], p.vz[i], p.m[i], p.cost[i], p.id[i] };
+    }
+    stats.migrated += n - scount[rank];
+
+    long nin = counts( );
+    in.resize( nin );
+    alltoallv( out.data(), in.data(), sizeof(migrant) );
+
+    p.resize( (int) nin );
+    for (int i = 0; i < (int) nin; i++) {
+        const migrant &b = in[i];
+        p.x[i] = b.x;   p.y[i] = b.y;   p.z[i] = b.z;
+        p.vx[i] = b.vx; p.vy[i] = b.vy; p.vz[i] = b.vz;
+        p.m[i] = b.m;
+        p.cost[i] = b.cost;
+        p.id[i] = b.id;
+        p.rung[i] = 0;
+    }
+    tree.n = tree.ntree = (int) nin;
+}
+
+/**
+ * appends the locally essential tree of another rank to list: what its bodies need
+ * to know about the subtree under node idx. a node that passes the group walk's opening
+ * test (see Node::get_force_group) for the whole box of the other rank's bodies goes as
+ * one point mass at its center of mass, a leaf that doesn't as its bodies, and
+ * everything else is opened.
+ *
+ * @param tree this rank's tree, of its own bodies
+ * @param idx node to start from
+ * @param bmin lower corner of the other rank's bodies [m]
+ * @param bmax upper corner of the other rank's bodies [m]
+ * @param theta opening criterion, 0 sends every body
+ * @param list list to append to
+*/
+void Domain::essential( const Octree &tree, int idx, vec bmin, vec bmax, scalar theta, std::vector<ghost> &list ) const {
+    const Node &nd = tree.nodes[idx];
+    if (nd.count == 0 || nd.mass == 0)
+        return;
+
+    scalar ex = std::fmax( std::fmax( bmin.x - nd.com.x, nd.com.x - bmax.x ), (scalar) 0 );
+    scalar ey = std::fmax( std::fmax( bmin.y - nd.com.y, nd.com.y - bmax.y ), (scalar) 0 );
+    scalar ez = std::fmax( std::fmax( bmin.z - nd.com.z, nd.com.z - bmax.z ), (scalar) 0 );
+    scalar rmin = std::sqrt( ex*ex + ey*ey + ez*ez );
+
+    if (rmin > 0 && nd.size / rmin < theta) {
+        list.push_back( { nd.com.x, nd.com.y, nd.com.z, nd.mass } );
+        return;
+    }
+
+    if (!nd.is_internal()) {
+        const Particles &p = tree.p;
+        for (int j = nd.first; j < nd.first + nd.count; j++)
+            list.push_back( { p.x[j], p.y[j], p.z[j], p.m[j] } );
+        return;
+    }
+
+    for (int c = 0; c < 8; c++)
+        if (nd.children[c] >= 0)
+            essential( tree, nd.children[c], bmin, bmax, theta, list );
+}
+
+/**
+ * fills in the accelerations and/or potentials of this rank's bodies, pulled by the
+ * bodies of all ranks:
+ *
+ * 1. the tree is built over this rank's bodies alone,
+ * 2. the ranks swap the boxes around their bodies, and every rank sends every other one
+ *    its locally essential tree (see essential) as a list of ghosts,
+ * 3. the tree is rebuilt over the rank's bodies and the ghosts it got, and walked for
+ *    the rank's own bodies only (see Octree::walk_tree's mask),
+ * 4. the ghosts are dropped again.
+ *
+ * every body's cost (interactions in this walk) is kept for the next decompose.
+ *
+ * @param tree this rank's tree; comes out stale, with the bodies in tree order
+ * @param theta opening criterion
+ * @param forces fill in p.ax, p.ay, p.az
+ * @param potential fill in p.pot
+*/
+void Domain::walk( Octree &tree, scalar theta, bool forces, bool potential ) {
+    double start = MPI_Wtime();
+    Particles &p = tree.p;
+    int n = tree.n;
+
+    tree.ntree = n;
+    tree.rebuild_tree( );
+
+    // boxes of everybody's bodies, empty ones inside out
+    std::vector<double> boxes( 6 * (size_t) size );
+    double *b = &boxes[6 * (size_t) rank];
+    b[0] = b[1] = b[2] = HUGE_VAL;
+    b[3] = b[4] = b[5] = -HUGE_VAL;
+    for (int i = 0; i < n; i++) {
+        b[0] = std::fmin( b[0], p.x[i] ); b[3] = std::fmax( b[3], p.x[i] );
+        b[1] = std::fmin( b[1], p.y[i] ); b[4] = std::fmax( b[4], p.y[i] );
+        b[2] = std::fmin( b[2], p.z[i] ); b[5] = std::fmax( b[5], p.z[i] );
+    }
+    MPI_Allgather( MPI_IN_PLACE, 0, MPI_DATATYPE_NULL, boxes.data(), 6, MPI_DOUBLE, comm );
+
+    // the direct sums want every body as it is
+    scalar open = (tree.solver == SOLVER_DIRECT) ? 0 : theta;
+
+    sent.clear();
+    for (int r = 0; r < size; r++) {
+        size_t before = sent.size();
+        const double *o = &boxes[6 * (size_t) r];
+        if (r != rank && n > 0 && o[0] <= o[3])
+            essential( tree, 0, vec( o[0], o[1], o[2] ), vec( o[3], o[4], o[5] ), open, sent );
+        scount[r] = (int) (sent.size() - before);
+    }
+
+    long ng = counts( );
+    got.resize( ng );
+    alltoallv( sent.data(), got.data(), sizeof(ghost) );
+
+    // the ghosts join the tree, with an id of -1
+    p.resize( n + (int) ng );
+    for (int k = 0; k < (int) ng; k++) {
+        int i = n + k;
+        p.x[i] = got[k].x;  p.y[i] = got[k].y;  p.z[i] = got[k].z;
+        p.vx[i] = 0;        p.vy[i] = 0;        p.vz[i] = 0;
+        p.ax[i] = 0;        p.ay[i] = 0;        p.az[i] = 0;
+        p.m[i] = got[k].m;
+        p.id[i] = -1;
+        p.rung[i] = 0;
+    }
+    tree.n = tree.ntree = n + (int) ng;
+    tree.rebuild_tree( );
+
+    mine.resize( tree.n );
+    for (int i = 0; i < tree.n; i++)
+        mine[i] = p.id[i] >= 0;
+
+    double walk_start = MPI_Wtime();
+    tree.walk_tree( theta, forces, potential, mine.data() );
+    double walk_end = MPI_Wtime();
+
+    // and leave again, the rank's bodies keep their tree order
+    order.resize( tree.n );
+    int own = 0, other = n;
+    for (int i = 0; i < tree.n; i++)
+        order[mine[i] ? own++ : other++] = i;
+    p.permute( order, pbuf, tree.pool );
+    p.resize( n );
+    tree.n = tree.ntree = n;
+
+    stats.steps++;
+    stats.ghosts += ng;
+    stats.interactions += (double) tree.walked.pp + tree.walked.pc;
+    stats.walk += walk_end - walk_start;
+    stats.exchange += (walk_start - start) + (MPI_Wtime() - walk_end);
+}
+
+/**
+ * advances all bodies by dt: kick-drift-kick leapfrog, the bodies are handed around
+ * between the drift and the force pass. the accelerations carry over to the next step,
+ * so there's one force pass per step.
+ *
+ * @param tree this rank's tree
+ * @param theta opening criterion
+ * @param dt timestep [s]
+*/
+void Domain::step( Octree &tree, scalar theta, scalar dt ) {
+    if (!have_acc)
+        walk( tree, theta, true, false );
+
+    scalar hdt = 0.5 * dt;
+    tree.kick_drift( hdt, dt );
+
+    double start = MPI_Wtime();
+    decompose( tree );
+    stats.exchange += MPI_Wtime() - start;
+
+    walk( tree, theta, true, false );
+    have_acc = true;
+    tree.kick( hdt );
+}
+
+/**
+ * total kinetic and potential energy of all ranks' bodies, see Octree::compute_energy.
+ *
+ * @param tree this rank's tree
+ * @param theta opening criterion
+*/
+void Domain::compute_energy( Octree &tree, scalar theta ) {
+    walk( tree, theta, false, true );
+
+    tree.kick( 0, true ); // no kick, only this rank's sums
+    double e[2] = { tree.kenergy, tree.penergy };
+    MPI_Allreduce( MPI_IN_PLACE, e, 2, MPI_DOUBLE, MPI_SUM, comm );
+
+    kenergy = e[0];
+    penergy = e[1];
+    energies = true;
+}
+
+/**
+ * writes a binary snapshot (see snapshot.h) of all ranks' bodies, all ranks at once
+ * with mpi-io. every rank's share of every array is scattered all over the file (the
+ * arrays are in initial conditions order), so each describes its share with a file view
+ * and one collective write lets mpi-io gather it into large writes.
+ *
+ * @param fname output file
+ * @param tree this rank's tree
+ * @param step integer timestep
+ * @param time physical time of timestep [s]
+ * @param theta opening criterion
+ *
+ * @returns false on every rank if the file couldn't be written.
+*/
+bool Domain::write_snapshot( const char *fname, const Octree &tree, int step, scalar time, scalar theta ) const {
+    const Particles &p = tree.p;
+    int n = tree.n;
+
+    std::vector<int> byid( n );
+    for (int i = 0; i < n; i++)
+        byid[i] = i;
+    std::sort( byid.begin(), byid.end(), [&]( int a, int b ) { return p.id[a] < p.id[b]; } );
+
+    const scalar *src[NFIELDS] = { p.m.data(), p.x.data(), p.y.data(), p.z.data(),
+                                   p.vx.data(), p.vy.data(), p.vz.data() };
+    std::vector<float> data( (size_t) NFIELDS * n );
+    std::vector<MPI_Aint> where( (size_t) NFIELDS * n );
+    for (int f = 0; f < NFIELDS; f++) {
+        for (int k = 0; k < n; k++) {
+            size_t j = (size_t) f * n + k;
+            data[j] = (float) src[f][byid[k]];
+            where[j] = (MPI_Aint) (sizeof(snapshot_header) + sizeof(float) * ((size_t) f * ntotal + p.id[byid[k]]));
+        }
+    }
+
+    MPI_File fh;
+    int err = MPI_File_open( comm, fname, MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &fh );
+    if (err != MPI_SUCCESS)
+        return false;
+    MPI_File_set_size( fh, (MPI_Offset) (sizeof(snapshot_header) + sizeof(float) * NFIELDS * (size_t) ntotal) );
+
+    int ok = 1;
+    if (rank == 0) {
+        snapshot s;
+        s.resize( 0 );
+        s.head.n = (int32_t) ntotal;
+        s.head.step = step;
+        s.head.time = time;
+        s.head.theta = theta;
+        s.head.size = extent;
+        s.head.energies = energies ? 1 : 0;
+        s.head.kenergy = energies ? kenergy : 0;
+        s.head.penergy = energies ? penergy : 0;
+        ok = MPI_File_write_at( fh, 0, &s.head, sizeof(s.head), MPI_BYTE, MPI_STATUS_IGNORE ) == MPI_SUCCESS;
+    }
+
+    MPI_Datatype view;
+    MPI_Type_create_hindexed_block( NFIELDS * n, 1, where.data(), MPI_FLOAT, &view );
+    MPI_Type_commit( &view );
+    MPI_File_set_view( fh, 0, MPI_FLOAT, view, "native", MPI_INFO_NULL );
+    ok = ok && MPI_File_write_all( fh, data.data(), NFIELDS * n, MPI_FLOAT, MPI_STATUS_IGNORE ) == MPI_SUCCESS;
+    MPI_Type_free( &view );
+    MPI_File_close( &fh );
+
+    MPI_Allreduce( MPI_IN_PLACE, &ok, 1, MPI_INT, MPI_MIN, comm );
+    return ok != 0;
+}
+
+/**
+ * prints, on rank 0, how the work was spread over the ranks: the walk time and the
+ * interactions of the busiest rank against the average are what the balancing is after.
+*/
+void Domain::report( ) const {
+    double t[3] = { stats.walk, stats.interactions, stats.exchange }, tmax[3], tsum[3];
+    long c[2] = { stats.ghosts, stats.migrated }, csum[2];
+    MPI_Reduce( t, tmax, 3, MPI_DOUBLE, MPI_MAX, 0, comm );
+    MPI_Reduce( t, tsum, 3, MPI_DOUBLE, MPI_SUM, 0, comm );
+    MPI_Reduce( c, csum, 2, MPI_LONG, MPI_SUM, 0, comm );
+
+    if (rank != 0)
+        return;
+    double walk = tsum[0] / size, work = tsum[1] / size;
+    printf("mpi: %d ranks, walk %.3f s on the slowest rank (%.2f x the mean, %.2f x the mean interactions), exchange %.3f s, %.0f ghosts per rank and pass, %ld bodies moved\n",
+           size, tmax[0], walk > 0 ? tmax[0] / walk : 1.0, work > 0 ? tmax[1] / work : 1.0, tmax[2],
+           stats.steps > 0 ? (double) csum[0] / size / stats.steps : 0.0, csum[1]);
+}
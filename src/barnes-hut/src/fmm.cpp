@@ -0,0 +1,399 @@
+#include "fmm.h"
+
+#include <algorithm>
+#include <cmath>
+
+/**
+ * constructor, order 4 (35 coefficients per expansion) and leaves of up to 64 bodies.
+*/
+FMM::FMM( ) {
+    this->nd = nullptr;
+    this->theta2 = 0;
+    this->eps2 = 0;
+    this->hsoft = 0;
+    this->leaf = 64;
+    set_order( 4 );
+}
+
+/**
+ * sets the expansion order and rebuilds the index tables.
+ *
+ * multi-indices are sorted by total order, so everything of order t - 1 comes before
+ * anything of order t (the power and derivative recursions rely on that).
+ *
+ * @param p expansion order, 1 .. 8
+*/
+void FMM::set_order( int p ) {
+    if (p < 1) p = 1;
+    if (p > 8) p = 8;
+    this->order = p;
+
+    std::vector<int> na, nb, nc;
+    std::vector<int> index( (p + 1) * (p + 1) * (p + 1), -1 );
+    auto idx = [&]( int a, int b, int c ) {
+        return (a < 0 || b < 0 || c < 0 || a + b + c > p) ? -1 : index[(a * (p + 1) + b) * (p + 1) + c];
+    };
+
+    for (int t = 0; t <= p; t++) {
+        for (int a = t; a >= 0; a--) {
+            for (int b = t - a; b >= 0; b--) {
+                int c = t - a - b;
+                index[(a * (p + 1) + b) * (p + 1) + c] = (int) na.size();
+                na.push_back( a ); nb.push_back( b ); nc.push_back( c );
+            }
+        }
+    }
+    this->ncoef = (int) na.size();
+
+    total.resize( ncoef );
+    rec_axis.resize( ncoef ); rec_one.resize( ncoef ); rec_two.resize( ncoef ); rec_n.resize( ncoef );
+    for (int q = 0; q < 3; q++) grad[q].clear();
+    sum_start.assign( 1, 0 ); sum_m.clear(); sum_km.clear();
+    m2l_start.assign( 1, 0 ); m2l_m.clear(); m2l_km.clear();
+    sub_start.assign( 1, 0 ); sub_j.clear(); sub_kj.clear();
+    nlow = 0;
+
+    for (int k = 0; k < ncoef; k++) {
+        int a = na[k], b = nb[k], c = nc[k];
+        total[k] = a + b + c;
+
+        // recurse along the first axis with a nonzero index
+        int axis = (a > 0) ? 0 : (b > 0) ? 1 : 2;
+        int e[3] = { axis == 0, axis == 1, axis == 2 };
+        rec_axis[k] = axis;
+        rec_n[k] = (axis == 0) ? a : (axis == 1) ? b : c;
+        rec_one[k] = (k == 0) ? -1 : idx( a - e[0], b - e[1], c - e[2] );
+        rec_two[k] = (k == 0) ? -1 : idx( a - 2*e[0], b - 2*e[1], c - 2*e[2] );
+
+        if (total[k] < p) {
+            grad[0].push_back( idx( a + 1, b, c ) );
+            grad[1].push_back( idx( a, b + 1, c ) );
+            grad[2].push_back( idx( a, b, c + 1 ) );
+            nlow++;
+        }
+
+        for (int m = 0; m < ncoef && total[k] + na[m] + nb[m] + nc[m] <= p; m++) {
+            sum_m.push_back( m );
+            sum_km.push_back( idx( a + na[m], b + nb[m], c + nc[m] ) );
+        }
+        sum_start.push_back( (int) sum_m.size() );
+
+        // the same without the dipole terms, which vanish about the center of mass
+        for (int m = 0; m < ncoef && total[k] + na[m] + nb[m] + nc[m] <= p; m++) {
+            if (na[m] + nb[m] + nc[m] == 1) continue;
+            m2l_m.push_back( m );
+            m2l_km.push_back( idx( a + na[m], b + nb[m], c + nc[m] ) );
+        }
+        m2l_start.push_back( (int) m2l_m.size() );
+
+        for (int j = 0; j < ncoef; j++) {
+            if (na[j] <= a && nb[j] <= b && nc[j] <= c) {
+                sub_j.push_back( j );
+                sub_kj.push_back( idx( a - na[j], b - nb[j], c - nc[j] ) );
+            }
+        }
+        sub_start.push_back( (int) sub_j.size() );
+    }
+}
+
+/**
+ * v^n / n! for every multi-index n.
+*/
+void FMM::powers( double x, double y, double z, double *pw ) const {
+    double v[3] = { x, y, z };
+    pw[0] = 1;
+    for (int k = 1; k < ncoef; k++)
+        pw[k] = pw[rec_one[k]] * v[rec_axis[k]] / rec_n[k];
+}
+
+/**
+ * all partial derivatives of 1/r at (x, y, z) up to order p, with the mcmurchie-davidson
+ * style recursion on the auxiliary g_m = (-1)^m (2m-1)!! / r^(2m+1):
+ *   R^m_000 = g_m,   R^m_(a+1)bc = a R^(m+1)_(a-1)bc + x R^(m+1)_abc   (same for b and c)
+ * and d^(a,b,c) (1/r) = R^0_abc, left in the first ncoef entries of d.
+ *
+ * the recursion holds for any function of r^2, so with plummer softening the same code
+ * with r^2 + eps^2 in the g_m gives the derivatives of 1/sqrt(r^2 + eps^2), and the
+ * expansions are of the softened potential.
+ *
+ * @param d scratch of (p + 1) * ncoef doubles
+*/
+void FMM::derivatives( double x, double y, double z, double *d ) const {
+    double v[3] = { x, y, z };
+    double inv = 1 / std::sqrt( x*x + y*y + z*z + eps2 );
+    double inv2 = inv * inv;
+
+    double g = inv;
+    for (int m = 0; m <= order; m++) {
+        d[m * ncoef] = g;
+        g *= -(2 * m + 1) * inv2;
+    }
+
+    for (int k = 1; k < ncoef; k++) {
+        double xk = v[rec_axis[k]];
+        double nm1 = rec_n[k] - 1;
+        int one = rec_one[k], two = rec_two[k];
+        int mmax = order - total[k];
+
+        if (two < 0) {
+            for (int m = 0; m <= mmax; m++)
+                d[m * ncoef + k] = xk * d[(m + 1) * ncoef + one];
+        } else {
+            for (int m = 0; m <= mmax; m++)
+                d[m * ncoef + k] = xk * d[(m + 1) * ncoef + one] + nm1 * d[(m + 1) * ncoef + two];
+        }
+    }
+}
+
+/**
+ * multipoles of every node about its center of mass, M_n = sum m (-d)^n / n!, straight
+ * from the bodies for leaves (P2M) and shifted up from the children otherwise (M2M).
+ * children always come after their parent in the node array, so one backwards sweep
+ * sees every child before its parent. nodes below an fmm leaf are never used and skipped.
+*/
+void FMM::upward( const Particles &p ) {
+    int nn = (int) M.size() / ncoef;
+    std::vector<double> pw( ncoef );
+
+    for (int i = nn - 1; i >= 0; i--) {
+        const Node &node = nd[i];
+        if (node.parent >= 0 && is_leaf( node.parent ))
+            continue;
+
+        double *mi = &M[(size_t) i * ncoef];
+        std::fill( mi, mi + ncoef, 0.0 );
+        cx[i] = node.com.x; cy[i] = node.com.y; cz[i] = node.com.z;
+        rmax[i] = 0;
+
+        if (node.mass == 0)
+            continue;
+
+        if (is_leaf( i )) {
+            for (int j = node.first; j < node.first + node.count; j++) {
+                double dx = p.x[j] - cx[i], dy = p.y[j] - cy[i], dz = p.z[j] - cz[i];
+                powers( -dx, -dy, -dz, pw.data() );
+                for (int k = 0; k < ncoef; k++)
+                    mi[k] += p.m[j] * pw[k];
+                rmax[i] = std::max( rmax[i], std::sqrt( dx*dx + dy*dy + dz*dz ) );
+            }
+            continue;
+        }
+
+        for (int q = 0; q < 8; q++) {
+            int c = node.children[q];
+            if (c < 0 || nd[c].mass == 0) continue;
+
+            double sx = cx[c] - cx[i], sy = cy[c] - cy[i], sz = cz[c] - cz[i];
+            powers( -sx, -sy, -sz, pw.data() );
+            const double *mc = &M[(size_t) c * ncoef];
+            for (int k = 0; k < ncoef; k++) {
+                double sum = 0;
+                for (int t = sub_start[k]; t < sub_start[k + 1]; t++)
+                    sum += mc[sub_j[t]] * pw[sub_kj[t]];
+                mi[k] += sum;
+            }
+            rmax[i] = std::max( rmax[i], std::sqrt( sx*sx + sy*sy + sz*sz ) + rmax[c] );
+        }
+    }
+}
+
+/**
+ * adds the field of node b to the local expansion of node a (M2L):
+ *   L_k += sum_m D_(k+m)(ca - cb) M_m,  |k| + |m| <= p
+*/
+void FMM::m2l( int a, int b, scratch &s ) {
+    derivatives( cx[a] - cx[b], cy[a] - cy[b], cz[a] - cz[b], s.d.data() );
+    const double *d = s.d.data();
+    const double *mb = &M[(size_t) b * ncoef];
+    double *la = &L[(size_t) a * ncoef];
+
+    for (int k = 0; k < ncoef; k++) {
+        double sum = 0;
+        for (int t = m2l_start[k]; t < m2l_start[k + 1]; t++)
+            sum += d[m2l_km[t]] * mb[m2l_m[t]];
+        la[k] += sum;
+    }
+}
+
+/**
+ * dual tree walk: everything node b does to the bodies of node a. well separated pairs
+ * interact through their expansions, close leaves are saved for the direct sum, and
+ * anything else gets split, the bigger node first. with the spline, pairs that have
+ * bodies closer than its softening length are never well separated: the expansions
+ * are newtonian, the spline only past that.
+*/
+void FMM::interact( int a, int b, scratch &s ) {
+    const Node &A = nd[a], &B = nd[b];
+    if (A.mass == 0 || B.mass == 0) return;
+
+    double dx = cx[a] - cx[b], dy = cy[a] - cy[b], dz = cz[a] - cz[b];
+    double d2 = dx*dx + dy*dy + dz*dz;
+    double rs = rmax[a] + rmax[b];
+    if (a != b && rs * rs < theta2 * d2 && (hsoft == 0 || std::sqrt( d2 ) - rs >= hsoft)) {
+        m2l( a, b, s );
+        return;
+    }
+
+    bool la = is_leaf( a ), lb = is_leaf( b );
+    if (la && lb) {
+        s.pairs.push_back( { a, b } );
+        return;
+    }
+
+    if (lb || (!la && rmax[a] > rmax[b])) {
+        for (int q = 0; q < 8; q++)
+            if (A.children[q] >= 0) interact( A.children[q], b, s );
+    } else {
+        for (int q = 0; q < 8; q++)
+            if (B.children[q] >= 0) interact( a, B.children[q], s );
+    }
+}
+
+/**
+ * pushes the local expansion of node a down to its children (L2L), all the way to the
+ * leaves: L_j(child) += sum_m L_(j+m)(a) t^m / m!, t = c_child - c_a.
+*/
+void FMM::downward( int a, scratch &s ) {
+    if (is_leaf( a ))
+        return;
+
+    const Node &A = nd[a];
+    const double *lp = &L[(size_t) a * ncoef];
+    double *pw = s.pw.data();
+
+    for (int q = 0; q < 8; q++) {
+        int c = A.children[q];
+        if (c < 0 || nd[c].mass == 0) continue;
+
+        powers( cx[c] - cx[a], cy[c] - cy[a], cz[c] - cz[a], pw );
+        double *lc = &L[(size_t) c * ncoef];
+        for (int j = 0; j < ncoef; j++) {
+            double sum = 0;
+            for (int t = sum_start[j]; t < sum_start[j + 1]; t++)
+                sum += lp[sum_km[t]] * pw[sum_m[t]];
+            lc[j] += sum;
+        }
+        downward( c, s );
+    }
+}
+
+/**
+ * everything for the bodies of one task subtree: the dual walk against the whole tree,
+ * the downward pass, and then per leaf the local expansion (L2P) plus the direct sum
+ * over all close leaves, with the regular force kernel.
+*/
+void FMM::evaluate( int task, Particles &p, accel_kernel kernel, const softening &soft, bool forces, bool potential, const char *mask, scratch &s ) {
+
+    // fresh locals for the subtree
+    std::vector<int> &stack = s.stack;
+    stack.assign( 1, task );
+    while (!stack.empty()) {
+        int a = stack.back();
+        stack.pop_back();
+        std::fill( &L[(size_t) a * ncoef], &L[(size_t) a * ncoef] + ncoef, 0.0 );
+        if (is_leaf( a ))
+            continue;
+        for (int q = 0; q < 8; q++)
+            if (nd[a].children[q] >= 0) stack.push_back( nd[a].children[q] );
+    }
+
+    s.pairs.clear();
+    interact( task, 0, s );
+    downward( task, s );
+
+    std::stable_sort( s.pairs.begin(), s.pairs.end(), []( const leaf_pair &u, const leaf_pair &v ) { return u.a < v.a; } );
+
+    double *pw = s.pw.data();
+    for (size_t k = 0; k < s.pairs.size(); ) {
+        int a = s.pairs[k].a;
+
+        s.pp.clear( nd[a].com );
+        for (; k < s.pairs.size() && s.pairs[k].a == a; k++) {
+            const Node &B = nd[s.pairs[k].b];
+            for (int j = B.first; j < B.first + B.count; j++)
+                s.pp.push( p.x[j], p.y[j], p.z[j], (scalar) (G * p.m[j]) );
+        }
+
+        const Node &A = nd[a];
+        const double *la = &L[(size_t) a * ncoef];
+        for (int i = A.first; i < A.first + A.count; i++) {
+            if (mask && !mask[i])
+                continue;
+            powers( p.x[i] - cx[a], p.y[i] - cy[a], p.z[i] - cz[a], pw );
+
+            if (forces) {
+                // a = G grad sum_k L_k e^k / k!, one order lower
+                double ax = 0, ay = 0, az = 0;
+                for (int j = 0; j < nlow; j++) {
+                    ax += la[grad[0][j]] * pw[j];
+                    ay += la[grad[1][j]] * pw[j];
+                    az += la[grad[2][j]] * pw[j];
+                }
+                vec acc = kernel( p.x[i], p.y[i], p.z[i], s.pp, soft );
+                p.ax[i] = acc.x + (scalar) (G * ax);
+                p.ay[i] = acc.y + (scalar) (G * ay);
+                p.az[i] = acc.z + (scalar) (G * az);
+            }
+            if (potential) {
+                double phi = 0;
+                for (int j = 0; j < ncoef; j++)
+                    phi += la[j] * pw[j];
+                p.pot[i] = -( G * phi + potential_sum( p.x[i], p.y[i], p.z[i], s.pp, soft ) );
+            }
+        }
+    }
+}
+
+/**
+ * fills in the accelerations and/or potentials of all bodies.
+ *
+ * @param nodes the tree, with masses and centers of mass up to date
+ * @param p the particles, in tree order
+ * @param pool threads to spread the tasks over
+ * @param theta opening criterion, (rA + rB) / distance between the centers
+ * @param kernel force kernel for the direct sums
+ * @param soft softening, of the direct sums and the expansions alike
+ * @param forces fill in p.ax, p.ay, p.az
+ * @param potential fill in p.pot
+ * @param mask optional, one flag per body, only the flagged ones get new results
+*/
+void FMM::compute( const std::vector<Node> &nodes, Particles &p, ThreadPool *pool, scalar theta,
+                   accel_kernel kernel, const softening &soft, bool forces, bool potential, const char *mask ) {
+    int nn = (int) nodes.size();
+    this->nd = nodes.data();
+    this->theta2 = (double) theta * theta;
+    this->eps2 = soft.eps2();
+    this->hsoft = soft.h();
+
+    M.resize( (size_t) nn * ncoef );
+    L.resize( (size_t) nn * ncoef );
+    cx.resize( nn ); cy.resize( nn ); cz.resize( nn );
+    rmax.resize( nn );
+
+    upward( p );
+
+    // tasks: the topmost nodes with at most 1/64 of the bodies (or leaves). fixed by the
+    // tree alone, so the split (and the result) doesn't change with the thread count
+    int ntask = std::max( nodes[0].count / 64, 1 );
+    tasks.clear();
+    for (int i = 0; i < nn; i++) {
+        const Node &node = nodes[i];
+        if (node.count == 0)
+            continue;
+        bool small = node.count <= ntask || is_leaf( i );
+        bool parent_small = node.parent >= 0 && (nodes[node.parent].count <= ntask || is_leaf( node.parent ));
+        if (small && !parent_small)
+            tasks.push_back( i );
+    }
+
+    work.resize( pool->size() );
+    for (size_t t = 0; t < work.size(); t++) {
+        work[t].d.resize( (order + 1) * ncoef );
+        work[t].pw.resize( ncoef );
+    }
+
+    pool->parallel_for( (int) tasks.size(), 1, [&]( int begin, int end, int tid ) {
+        for (int t = begin; t < end; t++)
+            evaluate( tasks[t], p, kernel, soft, forces, potential, mask, work[tid] );
+    });
+}
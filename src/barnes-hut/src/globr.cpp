@@ -0,0 +1,178 @@
+#include "globr.h"
+#include "tree.h"
+#include "util.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/** a tree and the settings that take more than one option to set */
+struct globr_tree {
+    Octree tree;
+    soften_mode soften = SOFTEN_NONE;
+    scalar eps = 0; /** softening length [m] */
+    int fmm_order = 4;
+};
+
+/**
+ * makes a new, empty tree with the same defaults as globr.
+ *
+ * @param nthreads threads for the force passes, 0 or less for one per hardware thread
+ *
+ * @returns the tree, free it with globr_destroy.
+*/
+globr_tree *globr_create( int nthreads ) {
+    globr_tree *t = new globr_tree;
+    t->tree.set_threads( nthreads );
+    return t;
+}
+
+/** frees a tree from globr_create */
+void globr_destroy( globr_tree *t ) {
+    delete t;
+}
+
+/**
+ * changes one setting, named like globr's command line flags (without the dashes),
+ * with the value as it would be given there:
+ *
+ * - threads, leaf, group, rungs, fmm-order: integers
+ * - build (morton, insert), walk (group, body), multipole (mono, quad, oct),
+ *   solver (tree, fmm, direct), soften (none, plummer, spline), kernel (see set_kernel)
+ * - eta, refit: numbers
+ * - eps, pairs, escape: lengths, in meters here (not AU or pc)
+ *
+ * the walk's group size goes with walk, the fmm order with solver, so set those first.
+ *
+ * @param t the tree
+ * @param name setting
+ * @param value its new value
+ *
+ * @returns 1 if it was set, 0 if the setting or its value is unknown.
+*/
+int globr_set_option( globr_tree *t, const char *name, const char *value ) {
+    Octree &tree = t->tree;
+
+    if (strcmp( name, "threads" ) == 0) {
+        tree.set_threads( atoi( value ) );
+    } else if (strcmp( name, "leaf" ) == 0) {
+        tree.set_leaf_size( atoi( value ) );
+    } else if (strcmp( name, "group" ) == 0) {
+        tree.set_walk( tree.walk, atoi( value ) );
+    } else if (strcmp( name, "rungs" ) == 0) {
+        tree.set_timesteps( atoi( value ), tree.eta );
+    } else if (strcmp( name, "eta" ) == 0) {
+        tree.set_timesteps( tree.max_rung, atof( value ) );
+    } else if (strcmp( name, "refit" ) == 0) {
+        tree.set_refit( atof( value ) );
+    } else if (strcmp( name, "escape" ) == 0) {
+        tree.set_escape( atof( value ) );
+    } else if (strcmp( name, "pairs" ) == 0) {
+        tree.set_pairs( atof( value ) );
+    } else if (strcmp( name, "build" ) == 0) {
+        if (strcmp( value, "morton" ) == 0) tree.set_build( BUILD_MORTON );
+        else if (strcmp( value, "insert" ) == 0) tree.set_build( BUILD_INSERT );
+        else return 0;
+    } else if (strcmp( name, "walk" ) == 0) {
+        if (strcmp( value, "group" ) == 0) tree.set_walk( WALK_GROUP, tree.group_size );
+        else if (strcmp( value, "body" ) == 0) tree.set_walk( WALK_BODY, tree.group_size );
+        else return 0;
+    } else if (strcmp( name, "multipole" ) == 0) {
+        if (strcmp( value, "mono" ) == 0) tree.set_order( ORDER_MONOPOLE );
+        else if (strcmp( value, "quad" ) == 0) tree.set_order( ORDER_QUADRUPOLE );
+        else if (strcmp( value, "oct" ) == 0) tree.set_order( ORDER_OCTUPOLE );
+        else return 0;
+    } else if (strcmp( name, "fmm-order" ) == 0) {
+        t->fmm_order = atoi( value );
+        tree.set_solver( tree.solver, t->fmm_order );
+    } else if (strcmp( name, "solver" ) == 0) {
+        if (strcmp( value, "tree" ) == 0) tree.set_solver( SOLVER_TREE, t->fmm_order );
+        else if (strcmp( value, "fmm" ) == 0) tree.set_solver( SOLVER_FMM, t->fmm_order );
+        else if (strcmp( value, "direct" ) == 0) tree.set_solver( SOLVER_DIRECT, t->fmm_order );
+        else return 0;
+    } else if (strcmp( name, "soften" ) == 0) {
+        if (strcmp( value, "none" ) == 0) t->soften = SOFTEN_NONE;
+        else if (strcmp( value, "plummer" ) == 0) t->soften = SOFTEN_PLUMMER;
+        else if (strcmp( value, "spline" ) == 0) t->soften = SOFTEN_SPLINE;
+        else return 0;
+        tree.set_softening( t->soften, t->eps );
+    } else if (strcmp( name, "eps" ) == 0) {
+        t->eps = atof( value );
+        tree.set_softening( t->soften, t->eps );
+    } else if (strcmp( name, "kernel" ) == 0) {
+        return tree.set_kernel( value ) ? 1 : 0;
+    } else {
+        return 0;
+    }
+    return 1;
+}
+
+/**
+ * replaces the bodies and builds the tree over them, see Octree::set_bodies.
+ *
+ * @param t the tree
+ * @param n number of bodies
+ * @param pos positions, n x 3 [m]
+ * @param vel velocities, n x 3 [m/s]; NULL for all at rest
+ * @param mass masses [solar mass]
+*/
+void globr_set_bodies( globr_tree *t, int n, const double *pos, const double *vel, const double *mass ) {
+    t->tree.set_bodies( n, pos, vel, mass );
+}
+
+/** number of bodies in the tree */
+int globr_count( const globr_tree *t ) {
+    return t->tree.n;
+}
+
+/**
+ * copies the bodies out, see Octree::get_bodies.
+ *
+ * @param t the tree
+ * @param pos filled with the positions, n x 3 [m]; NULL to skip
+ * @param vel filled with the velocities, n x 3 [m/s]; NULL to skip
+*/
+void globr_get_bodies( const globr_tree *t, double *pos, double *vel ) {
+    t->tree.get_bodies( pos, vel );
+}
+
+/**
+ * one force pass over the bodies as they are, without moving them: what an integrator
+ * of the caller's own needs for every stage.
+ *
+ * @param t the tree
+ * @param theta opening criterion
+ * @param acc filled with the accelerations, n x 3 [m/s^2]
+ * @param pot filled with the potentials, n [J/kg]; NULL to skip them (they cost about
+ *            another force pass)
+*/
+void globr_accelerations( globr_tree *t, double theta, double *acc, double *pot ) {
+    t->tree.walk_tree( (scalar) theta, true, pot != nullptr );
+    t->tree.get_accelerations( acc, pot );
+}
+
+/**
+ * advances the bodies with globr's own integrator, see Octree::compute_forces.
+ *
+ * @param t the tree
+ * @param theta opening criterion
+ * @param dt timestep [s]
+ * @param nstep number of steps
+*/
+void globr_step( globr_tree *t, double theta, double dt, int nstep ) {
+    for (int s = 0; s < nstep; s++)
+        t->tree.compute_forces( (scalar) theta, (scalar) dt );
+}
+
+/**
+ * total kinetic and potential energy, see Octree::compute_energy.
+ *
+ * @param t the tree
+ * @param theta opening criterion
+ * @param kenergy filled with the kinetic energy [J]
+ * @param penergy filled with the potential energy [J]
+*/
+void globr_energy( globr_tree *t, double theta, double *kenergy, double *penergy ) {
+    t->tree.compute_energy( (scalar) theta );
+    *kenergy = t->tree.kenergy;
+    *penergy = t->tree.penergy;
+}
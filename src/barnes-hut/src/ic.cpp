@@ -0,0 +1,269 @@
+#include "ic.h"
+
+#include <atomic>
+#include <cmath>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define IC_CHUNK (1 << 20) // bytes of text per parallel parsing job
+
+static inline bool is_space( char c ) {
+    return c == ' ' || c == '\n' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
+
+static inline bool is_digit( char c ) {
+    return c >= '0' && c <= '9';
+}
+
+/**
+ * parses one decimal number (like 1.2345e+16) starting at s. up to 19 significant
+ * digits go into an integer mantissa, which is then scaled by an exact power of ten
+ * where there is one; plenty for a float. anything unusual (inf, nan, hex floats)
+ * goes to strtod instead.
+ *
+ * @param s start of the number
+ * @param end end of the buffer
+ * @param out the parsed value
+ *
+ * @returns pointer just past the number, or nullptr if it isn't one.
+*/
+static const char *parse_number( const char *s, const char *end, scalar *out ) {
+    static const double p10[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+                                  1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+    const char *start = s;
+
+    bool neg = false;
+    if (s < end && (*s == '-' || *s == '+')) neg = (*s++ == '-');
+
+    uint64_t mant = 0;
+    int digits = 0, exp10 = 0;
+    bool any = false;
+
+    for (; s < end && is_digit( *s ); s++, any = true) {
+        if (digits < 19) {
+            mant = mant * 10 + (*s - '0');
+            if (mant) digits++;
+        } else {
+            exp10++;
+        }
+    }
+
+    if (s < end && *s == '.') {
+        for (s++; s < end && is_digit( *s ); s++, any = true) {
+            if (digits < 19) {
+                mant = mant * 10 + (*s - '0');
+                if (mant) digits++;
+                exp10--;
+            }
+        }
+    }
+
+    if (any && s < end && (*s == 'e' || *s == 'E')) {
+        s++;
+        bool eneg = false;
+        if (s < end && (*s == '-' || *s == '+')) eneg = (*s++ == '-');
+
+        int e = 0;
+        bool edigits = false;
+        for (; s < end && is_digit( *s ); s++, edigits = true)
+            if (e < 100000) e = e * 10 + (*s - '0');
+
+        if (!edigits) any = false;
+        exp10 += eneg ? -e : e;
+    }
+
+    if (!any || (s < end && !is_space( *s ))) {
+        // not a plain decimal number, let the c library have a go at it
+        char token[64];
+        size_t len = 0;
+        while (start + len < end && !is_space( start[len] ) && len < sizeof(token) - 1) len++;
+        memcpy( token, start, len );
+        token[len] = '\0';
+
+        char *stop;
+        double v = strtod( token, &stop );
+        if (len == 0 || *stop != '\0') return nullptr;
+        *out = (scalar) v;
+        return start + len;
+    }
+
+    double v = (double) mant;
+    if (mant != 0 && exp10 != 0) {
+        if (exp10 > 0 && exp10 <= 22) v *= p10[exp10];
+        else if (exp10 < 0 && exp10 >= -22) v /= p10[-exp10];
+        else v *= std::pow( 10.0, exp10 );
+    }
+
+    *out = (scalar) (neg ? -v : v);
+    return s;
+}
+
+/**
+ * counts the whitespace separated tokens in [s, end).
+*/
+static long count_tokens( const char *s, const char *end ) {
+    long count = 0;
+    bool in_token = false;
+
+    for (; s < end; s++) {
+        bool space = is_space( *s );
+        count += (!space && !in_token);
+        in_token = !space;
+    }
+
+    return count;
+}
+
+/**
+ * parses a text file already in memory: cut into chunks on token boundaries, count
+ * the tokens of every chunk, then parse all chunks in parallel straight to where their
+ * values go.
+*/
+static bool load_text( const char *fname, const char *buf, size_t size, initial_conditions &ic, ThreadPool *pool ) {
+
+    // chunk boundaries, every chunk starts right after a whitespace (or at 0)
+    int nchunks = (int) (size / IC_CHUNK) + 1;
+    std::vector<size_t> bounds( nchunks + 1 );
+    for (int k = 0; k <= nchunks; k++) {
+        size_t b = (k == nchunks) ? size : (size_t) ((double) size * k / nchunks);
+        while (b > 0 && b < size && !is_space( buf[b - 1] )) b++;
+        bounds[k] = b;
+    }
+
+    std::vector<long> offsets( nchunks + 1, 0 );
+    pool->parallel_for( nchunks, 1, [&]( int begin, int end, int tid ) {
+        for (int k = begin; k < end; k++)
+            offsets[k + 1] = count_tokens( buf + bounds[k], buf + bounds[k + 1] );
+    } );
+    for (int k = 0; k < nchunks; k++)
+        offsets[k + 1] += offsets[k];
+
+    long total = offsets[nchunks];
+    if (total == 0 || total % IC_ROWS != 0 || total / IC_ROWS > 0x7fffffff) {
+        printf( "%s: %ld values, expected 7 rows (x, y, z, vx, vy, vz, m) of N values\n", fname, total );
+        return false;
+    }
+    int n = (int) (total / IC_ROWS);
+
+    // seven rows of n values, or n lines of seven values, going by the first line that
+    // isn't blank
+    const char *line = buf, *end = buf + size;
+    long first = 0;
+    while (true) {
+        const char *eol = (const char *) memchr( line, '\n', end - line );
+        first = count_tokens( line, eol ? eol : end );
+        if (first > 0 || eol == nullptr) break;
+        line = eol + 1;
+    }
+    bool per_body = (first == IC_ROWS && n != IC_ROWS);
+    if (first != n && !per_body) {
+        printf( "%s: first line has %ld values, expected %d (one row per quantity) or 7 (one line per body)\n",
+                fname, first, n );
+        return false;
+    }
+
+    ic.n = n;
+    ic.data.resize( total );
+    scalar *data = ic.data.data();
+    std::atomic<long> bad( -1 );
+
+    pool->parallel_for( nchunks, 1, [&]( int begin, int end, int tid ) {
+        for (int k = begin; k < end; k++) {
+            const char *s = buf + bounds[k], *stop = buf + bounds[k + 1];
+            long t = offsets[k];
+
+            while (true) {
+                while (s < stop && is_space( *s )) s++;
+                if (s >= stop) break;
+
+                scalar v;
+                const char *next = parse_number( s, stop, &v );
+                if (next == nullptr) {
+                    bad.store( t );
+                    break;
+                }
+
+                long at = per_body ? (t % IC_ROWS) * n + t / IC_ROWS : t;
+                data[at] = v;
+                s = next;
+                t++;
+            }
+        }
+    } );
+
+    if (bad.load() >= 0) {
+        printf( "%s: value %ld isn't a number\n", fname, bad.load() );
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * reads a binary file already in memory, see ic_header.
+*/
+static bool load_binary( const char *fname, const char *buf, size_t size, initial_conditions &ic ) {
+    ic_header h;
+    memcpy( &h, buf, sizeof(h) );
+
+    if (h.version != IC_VERSION || h.n <= 0 ||
+        size != sizeof(h) + (size_t) IC_ROWS * h.n * sizeof(float)) {
+        printf( "%s: broken binary initial conditions (version %d, %d bodies, %zu bytes)\n",
+                fname, h.version, h.n, size );
+        return false;
+    }
+
+    ic.n = h.n;
+    ic.data.resize( (size_t) IC_ROWS * h.n );
+    const float *src = (const float *) (buf + sizeof(h));
+    for (size_t i = 0; i < ic.data.size(); i++)
+        ic.data[i] = src[i];
+
+    return true;
+}
+
+/**
+ * loads initial conditions from a text or binary file (see initial_conditions), which
+ * one is decided by the file's first bytes. the file is memory mapped, and text gets
+ * parsed on every thread of the pool.
+ *
+ * @param fname initial conditions file
+ * @param ic filled with the bodies
+ * @param pool threads for parsing
+ *
+ * @returns false (after saying why) if the file can't be read or doesn't make sense.
+*/
+bool load_initial_conditions( const char *fname, initial_conditions &ic, ThreadPool *pool ) {
+    int fd = open( fname, O_RDONLY );
+    if (fd < 0) {
+        perror( "Error opening file" );
+        return false;
+    }
+
+    struct stat st;
+    if (fstat( fd, &st ) != 0 || st.st_size == 0) {
+        printf( "%s: empty file\n", fname );
+        close( fd );
+        return false;
+    }
+    size_t size = (size_t) st.st_size;
+
+    void *map = mmap( nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0 );
+    close( fd );
+    if (map == MAP_FAILED) {
+        perror( "Error mapping file" );
+        return false;
+    }
+
+    const char *buf = (const char *) map;
+    bool binary = size >= sizeof(ic_header) && memcmp( buf, IC_MAGIC, sizeof(IC_MAGIC) ) == 0;
+    bool ok = binary ? load_binary( fname, buf, size, ic ) : load_text( fname, buf, size, ic, pool );
+
+    munmap( map, size );
+    return ok;
+}
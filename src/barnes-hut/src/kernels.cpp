@@ -0,0 +1,448 @@
+#include "kernels.h"
+
+#include <cstring>
+
+#include "simd.h"
+
+/**
+ * acceleration factor of the spline kernel inside h: the source pulls with gm * f * dr,
+ * where f is 1/r^3 from h on. 1/h^3 is multiplied in one 1/h at a time, like 1/r^3
+ * everywhere else.
+*/
+static inline kscalar spline_factor( kscalar gm, kscalar r2, kscalar h ) {
+    kscalar hinv = 1 / h;
+    kscalar u = std::sqrt( r2 ) * hinv;
+    kscalar w;
+    if (u < (kscalar) 0.5)
+        w = (kscalar) 10.666666667 + u*u * ((kscalar) 32.0 * u - (kscalar) 38.4);
+    else
+        w = (kscalar) 21.333333333 - (kscalar) 48.0 * u + (kscalar) 38.4 * u*u - (kscalar) 10.666666667 * u*u*u 
+            - (kscalar) 0.066666667 / (u*u*u);
+    return gm * hinv * hinv * hinv * w;
+}
+
+/**
+ * one source's pull on a target dr = (dx, dy, dz) away, softened. the same math as the
+ * vector kernels, for the scalar kernel and their leftovers.
+*/
+static inline kscalar pull( kscalar gm, kscalar r2, const softening &soft, kscalar h ) {
+    if (r2 < h * h)
+        return spline_factor( gm, r2, h );
+    kscalar inv = 1 / std::sqrt( r2 + (kscalar) soft.eps2() );
+    return gm * inv * inv * inv;
+}
+
+/**
+ * plain c++ kernel, used when the cpu has no avx2 (or isn't x86 at all, e.g. apple silicon).
+ * 
+ * the acceleration is gm / r^3 * dr, multiplied out one 1/r at a time: with r ~ 1e16 m, 
+ * 1/r^3 on its own underflows a float. sources sitting exactly on the target are skipped,
+ * which is how a bucket's interaction list can include the target body itself.
+ * 
+ * the math is done in kscalar, on positions relative to the list's origin; the sum is
+ * kept in scalar, i.e. in double for mixed builds.
+ * 
+ * @param tx target position, x [m]
+ * @param ty target position, y [m]
+ * @param tz target position, z [m]
+ * @param src interaction list
+ * @param soft softening
+ * 
+ * @returns the acceleration of the target [m/s^2].
+*/
+vec accel_scalar( scalar tx, scalar ty, scalar tz, const ilist &src, const softening &soft ) {
+    scalar ax = 0, ay = 0, az = 0;
+    kscalar px = (kscalar) (tx - src.ox), py = (kscalar) (ty - src.oy), pz = (kscalar) (tz - src.oz);
+    kscalar h = soft.h();
+
+    for (int j = 0; j < src.count; j++) {
+        kscalar dx = src.x[j] - px;
+        kscalar dy = src.y[j] - py;
+        kscalar dz = src.z[j] - pz;
+        kscalar r2 = dx*dx + dy*dy + dz*dz;
+        if (r2 == 0) continue;
+        kscalar s = pull( src.gm[j], r2, soft, h );
+        ax += s * dx;
+        ay += s * dy;
+        az += s * dz;
+    }
+
+    return { ax, ay, az };
+}
+
+#ifdef SIMD_X86
+
+/**
+ * pulls of the sources j .. j + 7 with nonzero bits in near (the ones inside the spline
+ * kernel's h), which the vector kernels leave out. p is the target, relative to the
+ * list's origin.
+*/
+static inline vec near_pulls( kscalar px, kscalar py, kscalar pz, const ilist &src, const softening &soft, int j, unsigned near ) {
+    vec acc;
+    for (; near; near &= near - 1) {
+        int k = j + __builtin_ctz( near );
+        kscalar dx = src.x[k] - px, dy = src.y[k] - py, dz = src.z[k] - pz;
+        kscalar s = spline_factor( src.gm[k], dx*dx + dy*dy + dz*dz, soft.h() );
+        acc += vec( s * dx, s * dy, s * dz );
+    }
+    return acc;
+}
+
+/**
+ * avx2 + fma kernel, 8 sources per iteration. the leftover (count % 8) sources go 
+ * through the scalar loop, and so do sources inside the spline's h (rare: only the
+ * closest neighbours of the target ever are).
+*/
+__attribute__((target("avx2,fma")))
+vec accel_avx2( scalar tx, scalar ty, scalar tz, const ilist &src, const softening &soft ) {
+    const kscalar tpx = (kscalar) (tx - src.ox), tpy = (kscalar) (ty - src.oy), tpz = (kscalar) (tz - src.oz);
+    __m256 px = _mm256_set1_ps( tpx ), py = _mm256_set1_ps( tpy ), pz = _mm256_set1_ps( tpz );
+    sum8 ax, ay, az;
+    const __m256 one = _mm256_set1_ps( 1.0f );
+    const __m256 zero = _mm256_setzero_ps();
+    const kscalar h = soft.h();
+    const __m256 eps2 = _mm256_set1_ps( soft.eps2() ), h2 = _mm256_set1_ps( h * h );
+    vec near;
+
+    int j = 0;
+    for (; j + 8 <= src.count; j += 8) {
+        __m256 dx = _mm256_sub_ps( _mm256_loadu_ps( &src.x[j] ), px );
+        __m256 dy = _mm256_sub_ps( _mm256_loadu_ps( &src.y[j] ), py );
+        __m256 dz = _mm256_sub_ps( _mm256_loadu_ps( &src.z[j] ), pz );
+        __m256 r2 = _mm256_fmadd_ps( dz, dz, _mm256_fmadd_ps( dy, dy, _mm256_mul_ps( dx, dx ) ) );
+        __m256 inv = _mm256_div_ps( one, _mm256_sqrt_ps( _mm256_add_ps( r2, eps2 ) ) );
+        __m256 s = _mm256_mul_ps( _mm256_mul_ps( _mm256_mul_ps( _mm256_loadu_ps( &src.gm[j] ), inv ), inv ), inv );
+        __m256 in = _mm256_cmp_ps( r2, h2, _CMP_LT_OQ );
+        __m256 keep = _mm256_andnot_ps( in, _mm256_cmp_ps( r2, zero, _CMP_GT_OQ ) ); // r = 0 is the target itself
+        s = _mm256_and_ps( s, keep );
+        ax.fma( s, dx );
+        ay.fma( s, dy );
+        az.fma( s, dz );
+
+        unsigned close = (unsigned) _mm256_movemask_ps( _mm256_and_ps( in, _mm256_cmp_ps( r2, zero, _CMP_GT_OQ ) ) );
+        if (close)
+            near += near_pulls( tpx, tpy, tpz, src, soft, j, close );
+    }
+
+    vec acc = { ax.total(), ay.total(), az.total() };
+    acc += near;
+
+    for (; j < src.count; j++) {
+        kscalar dx = src.x[j] - tpx, dy = src.y[j] - tpy, dz = src.z[j] - tpz;
+        kscalar r2 = dx*dx + dy*dy + dz*dz;
+        if (r2 == 0) continue;
+        kscalar s = pull( src.gm[j], r2, soft, h );
+        acc += vec( s * dx, s * dy, s * dz );
+    }
+
+    return acc;
+}
+
+// gcc 12's avx-512 headers trip -Wuninitialized on their own _mm512_undefined_ps() placeholders
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+
+/**
+ * avx-512 kernel, 16 sources per iteration; the tail is done with masked loads, and 
+ * masked-off lanes (and sources at r = 0) are zeroed before they're accumulated. sources
+ * inside the spline's h are left to the scalar code, like in accel_avx2.
+*/
+__attribute__((target("avx512f")))
+vec accel_avx512( scalar tx, scalar ty, scalar tz, const ilist &src, const softening &soft ) {
+    const kscalar tpx = (kscalar) (tx - src.ox), tpy = (kscalar) (ty - src.oy), tpz = (kscalar) (tz - src.oz);
+    __m512 px = _mm512_set1_ps( tpx ), py = _mm512_set1_ps( tpy ), pz = _mm512_set1_ps( tpz );
+    sum16 ax, ay, az;
+    const __m512 one = _mm512_set1_ps( 1.0f );
+    const __m512 zero = _mm512_setzero_ps();
+    const kscalar h = soft.h();
+    const __m512 eps2 = _mm512_set1_ps( soft.eps2() ), h2 = _mm512_set1_ps( h * h );
+    vec near;
+
+    for (int j = 0; j < src.count; j += 16) {
+        int left = src.count - j;
+        __mmask16 k = (left >= 16) ? (__mmask16) 0xffff : (__mmask16) ((1u << left) - 1);
+
+        __m512 dx = _mm512_sub_ps( _mm512_maskz_loadu_ps( k, &src.x[j] ), px );
+        __m512 dy = _mm512_sub_ps( _mm512_maskz_loadu_ps( k, &src.y[j] ), py );
+        __m512 dz = _mm512_sub_ps( _mm512_maskz_loadu_ps( k, &src.z[j] ), pz );
+        __m512 r2 = _mm512_fmadd_ps( dz, dz, _mm512_fmadd_ps( dy, dy, _mm512_mul_ps( dx, dx ) ) );
+        __m512 inv = _mm512_div_ps( one, _mm512_sqrt_ps( _mm512_add_ps( r2, eps2 ) ) );
+        __m512 s = _mm512_mul_ps( _mm512_mul_ps( _mm512_mul_ps( _mm512_maskz_loadu_ps( k, &src.gm[j] ), inv ), inv ), inv );
+        __mmask16 live = k & _mm512_cmp_ps_mask( r2, zero, _CMP_GT_OQ );
+        __mmask16 in = live & _mm512_cmp_ps_mask( r2, h2, _CMP_LT_OQ );
+        s = _mm512_maskz_mov_ps( live & ~in, s );
+        ax.fma( s, dx );
+        ay.fma( s, dy );
+        az.fma( s, dz );
+
+        if (in) {
+            near += near_pulls( tpx, tpy, tpz, src, soft, j, in & 0xff );
+            near += near_pulls( tpx, tpy, tpz, src, soft, j + 8, (in >> 8) & 0xff );
+        }
+    }
+
+    vec acc = { ax.total(), ay.total(), az.total() };
+    acc += near;
+    return acc;
+}
+
+#pragma GCC diagnostic pop
+
+#else
+
+// no x86 vector units (or a double build), the "simd" kernels just fall back to the scalar one.
+vec accel_avx2( scalar tx, scalar ty, scalar tz, const ilist &src, const softening &soft ) { return accel_scalar( tx, ty, tz, src, soft ); }
+vec accel_avx512( scalar tx, scalar ty, scalar tz, const ilist &src, const softening &soft ) { return accel_scalar( tx, ty, tz, src, soft ); }
+
+#endif
+
+/**
+ * sums gm / r over an interaction list, i.e. minus the gravitational potential at the
+ * target. only needed on output steps, so this one stays scalar (but sums in double).
+ * softened the same way as the forces.
+ * 
+ * @param tx target position, x [m]
+ * @param ty target position, y [m]
+ * @param tz target position, z [m]
+ * @param src interaction list
+ * @param soft softening
+ * 
+ * @returns sum of gm / r over the sources [J/kg].
+*/
+double potential_sum( scalar tx, scalar ty, scalar tz, const ilist &src, const softening &soft ) {
+    double phi = 0;
+    double eps2 = soft.eps2(), h = soft.h();
+    // rounded like the sources, so the target still finds itself at r = 0
+    double px = (kscalar) (tx - src.ox), py = (kscalar) (ty - src.oy), pz = (kscalar) (tz - src.oz);
+
+    for (int j = 0; j < src.count; j++) {
+        double dx = src.x[j] - px;
+        double dy = src.y[j] - py;
+        double dz = src.z[j] - pz;
+        double r2 = dx*dx + dy*dy + dz*dz;
+        if (r2 == 0)
+            continue;
+
+        if (r2 < h * h) {
+            // spline, monaghan & lattanzio
+            double u = std::sqrt( r2 ) / h;
+            double w = (u < 0.5) ? -2.8 + u*u * (5.333333333 + u*u * (6.4 * u - 9.6))
+                                 : -3.2 + 0.066666667 / u + u*u * (10.666666667 + u * (-16.0 + u * (9.6 - 2.133333333 * u)));
+            phi -= src.gm[j] * w / h;
+        } else {
+            phi += src.gm[j] / std::sqrt( r2 + eps2 );
+        }
+    }
+
+    return phi;
+}
+
+/**
+ * picks a force kernel at runtime.
+ * 
+ * "auto" takes the widest kernel the cpu supports. asking for a kernel the cpu can't run 
+ * falls back to the next narrower one instead of crashing on an illegal instruction.
+ * double builds only have the scalar kernel.
+ * 
+ * @param name "auto", "avx512", "avx2" or "scalar"
+ * @param picked set to the name of the kernel that was actually chosen
+ * 
+ * @returns the kernel, or nullptr if the name is unknown.
+*/
+accel_kernel pick_kernel( const char *name, const char **picked ) {
+    bool avx512 = false, avx2 = false;
+
+#ifdef SIMD_X86
+    __builtin_cpu_init();
+    avx512 = __builtin_cpu_supports( "avx512f" );
+    avx2 = __builtin_cpu_supports( "avx2" ) && __builtin_cpu_supports( "fma" );
+#endif
+
+    bool any = std::strcmp( name, "auto" ) == 0;
+
+    if (!any && std::strcmp( name, "avx512" ) != 0 && std::strcmp( name, "avx2" ) != 0 && std::strcmp( name, "scalar" ) != 0)
+        return nullptr;
+
+    if ((any || std::strcmp( name, "avx512" ) == 0) && avx512) {
+        *picked = "avx512";
+        return accel_avx512;
+    }
+    if ((any || std::strcmp( name, "avx512" ) == 0 || std::strcmp( name, "avx2" ) == 0) && avx2) {
+        *picked = "avx2";
+        return accel_avx2;
+    }
+
+    *picked = "scalar";
+    return accel_scalar;
+}
+
+/**
+ * one pair of the direct solver, i in tile a and j in tile b: the pull of j is added to
+ * (sx, sy, sz), the sum for i, and the opposite pull of i to j's sums in b. the scalar
+ * tile kernel, the vector kernels' leftovers and their sources inside the spline's h.
+*/
+static inline void tile_pair( tile &a, int i, tile &b, int j, const softening &soft, kscalar h,
+                              scalar &sx, scalar &sy, scalar &sz ) {
+    kscalar dx = b.x[j] - a.x[i], dy = b.y[j] - a.y[i], dz = b.z[j] - a.z[i];
+    kscalar r2 = dx*dx + dy*dy + dz*dz;
+    if (r2 == 0)
+        return;
+    kscalar sj = pull( b.gm[j], r2, soft, h ), si = pull( a.gm[i], r2, soft, h );
+    sx += sj * dx; sy += sj * dy; sz += sj * dz;
+    b.ax[j] -= si * dx; b.ay[j] -= si * dy; b.az[j] -= si * dz;
+}
+
+/**
+ * plain c++ tile kernel.
+ *
+ * @param a first tile
+ * @param b second tile, or a itself
+ * @param soft softening
+*/
+void tile_scalar( tile &a, tile &b, const softening &soft ) {
+    kscalar h = soft.h();
+    bool same = &a == &b;
+
+    for (int i = 0; i < a.count; i++) {
+        scalar sx = 0, sy = 0, sz = 0;
+        for (int j = same ? i + 1 : 0; j < b.count; j++)
+            tile_pair( a, i, b, j, soft, h, sx, sy, sz );
+        a.ax[i] += sx; a.ay[i] += sy; a.az[i] += sz;
+    }
+}
+
+#ifdef SIMD_X86
+
+/**
+ * avx2 + fma tile kernel: each body of a against 8 bodies of b at a time. both pulls
+ * come from the same 1/r, multiplied out one factor at a time as in accel_avx2 (the
+ * 1/r^3 on its own would underflow); b's sums are loaded, updated and stored back.
+ * leftovers and pairs inside the spline's h go through tile_pair.
+*/
+__attribute__((target("avx2,fma")))
+void tile_avx2( tile &a, tile &b, const softening &soft ) {
+    const __m256 one = _mm256_set1_ps( 1.0f );
+    const __m256 zero = _mm256_setzero_ps();
+    const kscalar h = soft.h();
+    const __m256 eps2 = _mm256_set1_ps( soft.eps2() ), h2 = _mm256_set1_ps( h * h );
+    bool same = &a == &b;
+
+    for (int i = 0; i < a.count; i++) {
+        __m256 px = _mm256_set1_ps( a.x[i] ), py = _mm256_set1_ps( a.y[i] ), pz = _mm256_set1_ps( a.z[i] );
+        __m256 gi = _mm256_set1_ps( a.gm[i] );
+        sum8 sx, sy, sz;
+        scalar nx = 0, ny = 0, nz = 0;
+
+        int j = same ? i + 1 : 0;
+        for (; j + 8 <= b.count; j += 8) {
+            __m256 dx = _mm256_sub_ps( _mm256_loadu_ps( &b.x[j] ), px );
+            __m256 dy = _mm256_sub_ps( _mm256_loadu_ps( &b.y[j] ), py );
+            __m256 dz = _mm256_sub_ps( _mm256_loadu_ps( &b.z[j] ), pz );
+            __m256 r2 = _mm256_fmadd_ps( dz, dz, _mm256_fmadd_ps( dy, dy, _mm256_mul_ps( dx, dx ) ) );
+            __m256 inv = _mm256_div_ps( one, _mm256_sqrt_ps( _mm256_add_ps( r2, eps2 ) ) );
+            __m256 inv2 = _mm256_mul_ps( inv, inv );
+            __m256 in = _mm256_cmp_ps( r2, h2, _CMP_LT_OQ );
+            __m256 live = _mm256_cmp_ps( r2, zero, _CMP_GT_OQ );
+            __m256 keep = _mm256_andnot_ps( in, live );
+            __m256 sj = _mm256_and_ps( _mm256_mul_ps( _mm256_mul_ps( _mm256_loadu_ps( &b.gm[j] ), inv ), inv2 ), keep );
+            __m256 si = _mm256_and_ps( _mm256_mul_ps( _mm256_mul_ps( gi, inv ), inv2 ), keep );
+            sx.fma( sj, dx );
+            sy.fma( sj, dy );
+            sz.fma( sj, dz );
+            _mm256_storeu_ps( &b.ax[j], _mm256_fnmadd_ps( si, dx, _mm256_loadu_ps( &b.ax[j] ) ) );
+            _mm256_storeu_ps( &b.ay[j], _mm256_fnmadd_ps( si, dy, _mm256_loadu_ps( &b.ay[j] ) ) );
+            _mm256_storeu_ps( &b.az[j], _mm256_fnmadd_ps( si, dz, _mm256_loadu_ps( &b.az[j] ) ) );
+
+            unsigned close = (unsigned) _mm256_movemask_ps( _mm256_and_ps( in, live ) );
+            for (; close; close &= close - 1)
+                tile_pair( a, i, b, j + __builtin_ctz( close ), soft, h, nx, ny, nz );
+        }
+        for (; j < b.count; j++)
+            tile_pair( a, i, b, j, soft, h, nx, ny, nz );
+
+        a.ax[i] += sx.total() + nx;
+        a.ay[i] += sy.total() + ny;
+        a.az[i] += sz.total() + nz;
+    }
+}
+
+// gcc 12's avx-512 headers trip -Wuninitialized on their own _mm512_undefined_ps() placeholders
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+
+/**
+ * avx-512 tile kernel, 16 bodies of b at a time, the tail with masked loads and stores.
+ * otherwise the same as tile_avx2.
+*/
+__attribute__((target("avx512f")))
+void tile_avx512( tile &a, tile &b, const softening &soft ) {
+    const __m512 one = _mm512_set1_ps( 1.0f );
+    const __m512 zero = _mm512_setzero_ps();
+    const kscalar h = soft.h();
+    const __m512 eps2 = _mm512_set1_ps( soft.eps2() ), h2 = _mm512_set1_ps( h * h );
+    bool same = &a == &b;
+
+    for (int i = 0; i < a.count; i++) {
+        __m512 px = _mm512_set1_ps( a.x[i] ), py = _mm512_set1_ps( a.y[i] ), pz = _mm512_set1_ps( a.z[i] );
+        __m512 gi = _mm512_set1_ps( a.gm[i] );
+        sum16 sx, sy, sz;
+        scalar nx = 0, ny = 0, nz = 0;
+
+        for (int j = same ? i + 1 : 0; j < b.count; j += 16) {
+            int left = b.count - j;
+            __mmask16 k = (left >= 16) ? (__mmask16) 0xffff : (__mmask16) ((1u << left) - 1);
+
+            __m512 dx = _mm512_sub_ps( _mm512_maskz_loadu_ps( k, &b.x[j] ), px );
+            __m512 dy = _mm512_sub_ps( _mm512_maskz_loadu_ps( k, &b.y[j] ), py );
+            __m512 dz = _mm512_sub_ps( _mm512_maskz_loadu_ps( k, &b.z[j] ), pz );
+            __m512 r2 = _mm512_fmadd_ps( dz, dz, _mm512_fmadd_ps( dy, dy, _mm512_mul_ps( dx, dx ) ) );
+            __m512 inv = _mm512_div_ps( one, _mm512_sqrt_ps( _mm512_add_ps( r2, eps2 ) ) );
+            __m512 inv2 = _mm512_mul_ps( inv, inv );
+            __mmask16 live = k & _mm512_cmp_ps_mask( r2, zero, _CMP_GT_OQ );
+            __mmask16 in = live & _mm512_cmp_ps_mask( r2, h2, _CMP_LT_OQ );
+            __m512 sj = _mm512_maskz_mov_ps( live & ~in, _mm512_mul_ps( _mm512_mul_ps( _mm512_maskz_loadu_ps( k, &b.gm[j] ), inv ), inv2 ) );
+            __m512 si = _mm512_maskz_mov_ps( live & ~in, _mm512_mul_ps( _mm512_mul_ps( gi, inv ), inv2 ) );
+            sx.fma( sj, dx );
+            sy.fma( sj, dy );
+            sz.fma( sj, dz );
+            _mm512_mask_storeu_ps( &b.ax[j], k, _mm512_fnmadd_ps( si, dx, _mm512_maskz_loadu_ps( k, &b.ax[j] ) ) );
+            _mm512_mask_storeu_ps( &b.ay[j], k, _mm512_fnmadd_ps( si, dy, _mm512_maskz_loadu_ps( k, &b.ay[j] ) ) );
+            _mm512_mask_storeu_ps( &b.az[j], k, _mm512_fnmadd_ps( si, dz, _mm512_maskz_loadu_ps( k, &b.az[j] ) ) );
+
+            for (unsigned close = in; close; close &= close - 1)
+                tile_pair( a, i, b, j + __builtin_ctz( close ), soft, h, nx, ny, nz );
+        }
+
+        a.ax[i] += sx.total() + nx;
+        a.ay[i] += sy.total() + ny;
+        a.az[i] += sz.total() + nz;
+    }
+}
+
+#pragma GCC diagnostic pop
+
+#else
+
+// no x86 vector units (or a double build), the "simd" tile kernels fall back to the scalar one.
+void tile_avx2( tile &a, tile &b, const softening &soft ) { tile_scalar( a, b, soft ); }
+void tile_avx512( tile &a, tile &b, const softening &soft ) { tile_scalar( a, b, soft ); }
+
+#endif
+
+/**
+ * picks the tile kernel that goes with a force kernel (see pick_kernel), so both use
+ * the same instruction set.
+ *
+ * @param picked name of the force kernel in use: "avx512", "avx2" or "scalar"
+ *
+ * @returns the kernel.
+*/
+tile_kernel pick_tile_kernel( const char *picked ) {
+    if (std::strcmp( picked, "avx512" ) == 0)
+        return tile_avx512;
+    if (std::strcmp( picked, "avx2" ) == 0)
+        return tile_avx2;
+    return tile_scalar;
+}
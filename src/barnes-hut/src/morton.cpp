@@ -0,0 +1,79 @@
+#include "morton.h"
+
+#include <algorithm>
+
+#define RADIX_BITS 8
+#define RADIX (1 << RADIX_BITS)
+
+/**
+ * sorts morton keys (and their body indices along with them) with a parallel LSD radix 
+ * sort, 8 bits per pass. every thread counts digits in its own slice of the array, the 
+ * counts are turned into per-thread write offsets, and then every thread scatters its 
+ * slice. the sort is stable, so bodies with equal keys keep their relative order.
+ * 
+ * passes where every key has the same digit (very common for the top bits of a 
+ * compact cluster) are skipped.
+ * 
+ * @param keys morton keys, sorted in place
+ * @param idx body indices that travel with the keys
+ * @param kbuf scratch space for keys, resized as needed
+ * @param ibuf scratch space for indices, resized as needed
+ * @param pool threads to sort with
+*/
+void sort_keys( std::vector<uint64_t> &keys, std::vector<int> &idx, 
+                std::vector<uint64_t> &kbuf, std::vector<int> &ibuf, ThreadPool *pool ) {
+
+    int n = (int) keys.size();
+    int nblk = pool->size();
+    if (n < 4096) nblk = 1; // not worth waking anyone up
+
+    kbuf.resize( n );
+    ibuf.resize( n );
+    std::vector<int> counts( (size_t) nblk * RADIX );
+
+    for (int shift = 0; shift < 64; shift += RADIX_BITS) {
+
+        // >>> counting digits in every slice
+        pool->parallel_for( nblk, 1, [&]( int b, int, int ) {
+            int *cnt = &counts[(size_t) b * RADIX];
+            std::fill( cnt, cnt + RADIX, 0 );
+            int lo = (int) ((long) n * b / nblk), hi = (int) ((long) n * (b + 1) / nblk);
+            for (int i = lo; i < hi; i++)
+                cnt[(keys[i] >> shift) & (RADIX - 1)]++;
+        });
+
+        // every key in the same bucket? nothing to do for this digit.
+        bool skip = false;
+        for (int d = 0; d < RADIX; d++) {
+            int total = 0;
+            for (int b = 0; b < nblk; b++) total += counts[(size_t) b * RADIX + d];
+            if (total == n) skip = true;
+            if (total != 0) break;
+        }
+        if (skip) continue;
+
+        // >>> exclusive prefix sum, digit-major then slice, so the scatter stays stable
+        int offset = 0;
+        for (int d = 0; d < RADIX; d++) {
+            for (int b = 0; b < nblk; b++) {
+                int c = counts[(size_t) b * RADIX + d];
+                counts[(size_t) b * RADIX + d] = offset;
+                offset += c;
+            }
+        }
+
+        // >>> scattering every slice to its place
+        pool->parallel_for( nblk, 1, [&]( int b, int, int ) {
+            int *pos = &counts[(size_t) b * RADIX];
+            int lo = (int) ((long) n * b / nblk), hi = (int) ((long) n * (b + 1) / nblk);
+            for (int i = lo; i < hi; i++) {
+                int p = pos[(keys[i] >> shift) & (RADIX - 1)]++;
+                kbuf[p] = keys[i];
+                ibuf[p] = idx[i];
+            }
+        });
+
+        keys.swap( kbuf );
+        idx.swap( ibuf );
+    }
+}
@@ -0,0 +1,480 @@
+#include "multipole.h"
+
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+#include "simd.h"
+
+/** (i, j) of every component of s, and (i, j, k) of every component of t */
+static const int S_IJ[6][2] = { {0,0}, {1,1}, {2,2}, {0,1}, {0,2}, {1,2} };
+static const int T_IJK[10][3] = { {0,0,0}, {1,1,1}, {2,2,2}, {0,0,1}, {0,0,2},
+                                  {0,1,1}, {1,1,2}, {0,2,2}, {1,2,2}, {0,1,2} };
+
+/** component of s for any (i, j) */
+static inline int s_index( int i, int j ) {
+    static const int idx[3][3] = { {0,3,4}, {3,1,5}, {4,5,2} };
+    return idx[i][j];
+}
+
+/**
+ * zeroes all moments (the center of mass is left alone).
+*/
+void multipole::clear( ) {
+    for (int k = 0; k < 6; k++) s[k] = 0;
+    for (int k = 0; k < 10; k++) t[k] = 0;
+}
+
+/**
+ * adds one body to the moments of a leaf.
+ *
+ * @param m mass of the body [kg]
+ * @param dx position of the body relative to the center of mass, x [m]
+ * @param dy position of the body relative to the center of mass, y [m]
+ * @param dz position of the body relative to the center of mass, z [m]
+ * @param order highest moment needed, ORDER_QUADRUPOLE or ORDER_OCTUPOLE
+*/
+void multipole::add_body( double m, double dx, double dy, double dz, int order ) {
+    double d[3] = { dx, dy, dz };
+
+    for (int k = 0; k < 6; k++)
+        s[k] += m * d[S_IJ[k][0]] * d[S_IJ[k][1]];
+
+    if (order >= ORDER_OCTUPOLE) {
+        for (int k = 0; k < 10; k++)
+            t[k] += m * d[T_IJK[k][0]] * d[T_IJK[k][1]] * d[T_IJK[k][2]];
+    }
+}
+
+/**
+ * adds a child's moments to ours, shifted from the child's center of mass to ours
+ * (parallel axis theorem). our center of mass has to be set already.
+ *
+ * @param c the child's moments
+ * @param mc the child's mass [kg]
+ * @param order highest moment needed, ORDER_QUADRUPOLE or ORDER_OCTUPOLE
+*/
+void multipole::add_child( const multipole &c, double mc, int order ) {
+    double d[3] = { c.cx - cx, c.cy - cy, c.cz - cz };
+
+    for (int k = 0; k < 6; k++)
+        s[k] += c.s[k] + mc * d[S_IJ[k][0]] * d[S_IJ[k][1]];
+
+    if (order >= ORDER_OCTUPOLE) {
+        // the child's dipole about its own center of mass is zero, so there's no first moment term
+        for (int k = 0; k < 10; k++) {
+            int i = T_IJK[k][0], j = T_IJK[k][1], l = T_IJK[k][2];
+            t[k] += c.t[k] + c.s[s_index( i, j )] * d[l] + c.s[s_index( i, l )] * d[j]
+                  + c.s[s_index( j, l )] * d[i] + mc * d[i] * d[j] * d[l];
+        }
+    }
+}
+
+/**
+ * turns the raw moments into what the kernels use:
+ *   q = G ( 3 s - tr(s) delta ) / h^2
+ *   o = G ( 15 t - 3 (v_i delta_jk + v_j delta_ik + v_k delta_ij) ) / h^3,  v_i = t_ijj
+ * plus the traces G tr(s) / h^2 and G v / h^3, for plummer softening.
+ *
+ * @param h node size [m]
+ * @param order highest moment needed, ORDER_QUADRUPOLE or ORDER_OCTUPOLE
+*/
+void multipole::finish( scalar h, int order ) {
+    double h2 = (double) h * h;
+    double trs = s[0] + s[1] + s[2];
+
+    for (int k = 0; k < 6; k++)
+        q[k] = (scalar) (G * (3 * s[k] - (k < 3 ? trs : 0)) / h2);
+    tr = (scalar) (G * trs / h2);
+
+    for (int k = 0; k < 10; k++)
+        o[k] = 0;
+    v[0] = v[1] = v[2] = 0;
+    if (order < ORDER_OCTUPOLE)
+        return;
+
+    double vt[3] = { t[0] + t[5] + t[7], t[3] + t[1] + t[8], t[4] + t[6] + t[2] };
+    for (int k = 0; k < 10; k++) {
+        int i = T_IJK[k][0], j = T_IJK[k][1], l = T_IJK[k][2];
+        double trt = (j == l ? vt[i] : 0) + (i == l ? vt[j] : 0) + (i == j ? vt[l] : 0);
+        o[k] = (scalar) (G * (15 * t[k] - 3 * trt) / (h2 * h));
+    }
+    for (int i = 0; i < 3; i++)
+        v[i] = (scalar) (G * vt[i] / (h2 * h));
+}
+
+/**
+ * adds an accepted node to the list.
+ *
+ * @param node index of the node (and its moments)
+ * @param pgm G * mass of the node [m^3/s^2]
+ * @param ph size of the node [m]
+*/
+void mlist::push( int node, scalar pgm, scalar ph ) {
+    if (count == (int) x.size()) {
+        size_t grow = x.empty() ? 256 : 2 * x.size();
+        x.resize( grow ); y.resize( grow ); z.resize( grow ); gm.resize( grow ); h.resize( grow ); tr.resize( grow );
+        for (int k = 0; k < 6; k++) q[k].resize( grow );
+        for (int k = 0; k < 10; k++) o[k].resize( grow );
+        for (int k = 0; k < 3; k++) v[k].resize( grow );
+    }
+
+    const multipole &mp = base[node];
+    x[count] = (kscalar) (mp.cx - ox); y[count] = (kscalar) (mp.cy - oy); z[count] = (kscalar) (mp.cz - oz);
+    gm[count] = (kscalar) pgm;
+    h[count] = (kscalar) ph;
+
+    // moments too small to show next to the monopole are dropped. they're roundoff (the
+    // center of mass of a one-body node in double is an ulp off the body) and only feed
+    // denormals into the kernels, which slows them down a lot.
+    scalar tiny = std::numeric_limits<kscalar>::epsilon() * std::fabs( pgm );
+    for (int k = 0; k < 6; k++) q[k][count] = (std::fabs( mp.q[k] ) < tiny) ? 0 : (kscalar) mp.q[k];
+    tr[count] = (std::fabs( mp.tr ) < tiny) ? 0 : (kscalar) mp.tr;
+    if (order >= ORDER_OCTUPOLE) {
+        for (int k = 0; k < 10; k++) o[k][count] = (std::fabs( mp.o[k] ) < tiny) ? 0 : (kscalar) mp.o[k];
+        for (int k = 0; k < 3; k++) v[k][count] = (std::fabs( mp.v[k] ) < tiny) ? 0 : (kscalar) mp.v[k];
+    }
+    count++;
+}
+
+/**
+ * acceleration from node j of the list, one node at a time. with n the unit vector from
+ * the node's center of mass to the target, r the distance and h the node size:
+ *
+ *   a = -gm n / r^2  +  (h^2 / r^4) ( q n - 5/2 (n q n) n )  +  (h^3 / r^5) ( o n n / 2 - 7/6 (o n n n) n )
+ *
+ * with plummer softening r becomes sqrt(r^2 + eps^2) everywhere (n too, which is then
+ * a bit shorter than 1), and with e = eps^2 / r^2 the traces add
+ *
+ *   (h^2 / r^4) 5/2 e tr n  +  (h^3 / r^5) e ( 21/2 (v n) n - 3/2 v )
+ *
+ * everything is multiplied out from 1/r and h/r, so no intermediate leaves float range.
+ * the target is relative to the list's origin, the sum is kept in scalar.
+*/
+static inline void accel_one( const mlist &src, int j, kscalar tx, kscalar ty, kscalar tz, kscalar eps2, scalar &ax, scalar &ay, scalar &az ) {
+    kscalar rx = tx - src.x[j], ry = ty - src.y[j], rz = tz - src.z[j];
+    kscalar inv = 1 / std::sqrt( rx*rx + ry*ry + rz*rz + eps2 );
+    kscalar nx = rx * inv, ny = ry * inv, nz = rz * inv;
+    kscalar inv2 = inv * inv;
+    kscalar hi = src.h[j] * inv;
+
+    kscalar qnx = src.q[0][j]*nx + src.q[3][j]*ny + src.q[4][j]*nz;
+    kscalar qny = src.q[3][j]*nx + src.q[1][j]*ny + src.q[5][j]*nz;
+    kscalar qnz = src.q[4][j]*nx + src.q[5][j]*ny + src.q[2][j]*nz;
+    kscalar qnn = nx*qnx + ny*qny + nz*qnz;
+
+    kscalar c2 = hi * hi * inv2;
+    kscalar sn = -src.gm[j] * inv2 - 2.5f * c2 * qnn;
+    kscalar vx = c2 * qnx, vy = c2 * qny, vz = c2 * qnz;
+    kscalar e = eps2 * inv2;
+    if (eps2 > 0)
+        sn += 2.5f * c2 * e * src.tr[j];
+
+    if (src.order >= ORDER_OCTUPOLE) {
+        const std::vector<kscalar> *o = src.o;
+        kscalar xx = nx*nx, yy = ny*ny, zz = nz*nz, xy = 2*nx*ny, xz = 2*nx*nz, yz = 2*ny*nz;
+        kscalar onx = o[0][j]*xx + o[5][j]*yy + o[7][j]*zz + o[3][j]*xy + o[4][j]*xz + o[9][j]*yz;
+        kscalar ony = o[3][j]*xx + o[1][j]*yy + o[8][j]*zz + o[5][j]*xy + o[9][j]*xz + o[6][j]*yz;
+        kscalar onz = o[4][j]*xx + o[6][j]*yy + o[2][j]*zz + o[9][j]*xy + o[7][j]*xz + o[8][j]*yz;
+        kscalar onnn = nx*onx + ny*ony + nz*onz;
+
+        kscalar c3 = c2 * hi;
+        sn -= (7.0f / 6.0f) * c3 * onnn;
+        vx += 0.5f * c3 * onx;
+        vy += 0.5f * c3 * ony;
+        vz += 0.5f * c3 * onz;
+
+        if (eps2 > 0) {
+            kscalar ce = c3 * e;
+            sn += 10.5f * ce * (src.v[0][j]*nx + src.v[1][j]*ny + src.v[2][j]*nz);
+            vx -= 1.5f * ce * src.v[0][j];
+            vy -= 1.5f * ce * src.v[1][j];
+            vz -= 1.5f * ce * src.v[2][j];
+        }
+    }
+
+    ax += vx + sn * nx;
+    ay += vy + sn * ny;
+    az += vz + sn * nz;
+}
+
+/**
+ * plain c++ multipole kernel.
+ *
+ * @param tx target position, x [m]
+ * @param ty target position, y [m]
+ * @param tz target position, z [m]
+ * @param src accepted nodes
+ * @param soft softening
+ *
+ * @returns the acceleration of the target [m/s^2].
+*/
+vec multipole_scalar( scalar tx, scalar ty, scalar tz, const mlist &src, const softening &soft ) {
+    scalar ax = 0, ay = 0, az = 0;
+    kscalar px = (kscalar) (tx - src.ox), py = (kscalar) (ty - src.oy), pz = (kscalar) (tz - src.oz);
+    kscalar eps2 = (kscalar) soft.eps2();
+
+    for (int j = 0; j < src.count; j++)
+        accel_one( src, j, px, py, pz, eps2, ax, ay, az );
+
+    return { ax, ay, az };
+}
+
+#ifdef SIMD_X86
+
+/**
+ * avx2 + fma multipole kernel, 8 nodes per iteration, same math as accel_one. the
+ * leftover (count % 8) nodes go through the scalar code.
+*/
+__attribute__((target("avx2,fma")))
+vec multipole_avx2( scalar tx, scalar ty, scalar tz, const mlist &src, const softening &soft ) {
+    const kscalar tpx = (kscalar) (tx - src.ox), tpy = (kscalar) (ty - src.oy), tpz = (kscalar) (tz - src.oz);
+    __m256 px = _mm256_set1_ps( tpx ), py = _mm256_set1_ps( tpy ), pz = _mm256_set1_ps( tpz );
+    sum8 ax, ay, az;
+    const __m256 one = _mm256_set1_ps( 1.0f ), two = _mm256_set1_ps( 2.0f ), half = _mm256_set1_ps( 0.5f );
+    const __m256 c52 = _mm256_set1_ps( 2.5f ), c76 = _mm256_set1_ps( 7.0f / 6.0f );
+    const __m256 c212 = _mm256_set1_ps( 10.5f ), c32 = _mm256_set1_ps( 1.5f );
+    const kscalar teps2 = (kscalar) soft.eps2();
+    const __m256 eps2 = _mm256_set1_ps( teps2 );
+    bool oct = src.order >= ORDER_OCTUPOLE, plummer = teps2 > 0;
+
+    int j = 0;
+    for (; j + 8 <= src.count; j += 8) {
+        __m256 rx = _mm256_sub_ps( px, _mm256_loadu_ps( &src.x[j] ) );
+        __m256 ry = _mm256_sub_ps( py, _mm256_loadu_ps( &src.y[j] ) );
+        __m256 rz = _mm256_sub_ps( pz, _mm256_loadu_ps( &src.z[j] ) );
+        __m256 r2 = _mm256_add_ps( _mm256_fmadd_ps( rz, rz, _mm256_fmadd_ps( ry, ry, _mm256_mul_ps( rx, rx ) ) ), eps2 );
+        __m256 inv = _mm256_div_ps( one, _mm256_sqrt_ps( r2 ) );
+        __m256 nx = _mm256_mul_ps( rx, inv ), ny = _mm256_mul_ps( ry, inv ), nz = _mm256_mul_ps( rz, inv );
+        __m256 inv2 = _mm256_mul_ps( inv, inv );
+        __m256 hi = _mm256_mul_ps( _mm256_loadu_ps( &src.h[j] ), inv );
+
+        __m256 q0 = _mm256_loadu_ps( &src.q[0][j] ), q1 = _mm256_loadu_ps( &src.q[1][j] ), q2 = _mm256_loadu_ps( &src.q[2][j] );
+        __m256 q3 = _mm256_loadu_ps( &src.q[3][j] ), q4 = _mm256_loadu_ps( &src.q[4][j] ), q5 = _mm256_loadu_ps( &src.q[5][j] );
+        __m256 qnx = _mm256_fmadd_ps( q4, nz, _mm256_fmadd_ps( q3, ny, _mm256_mul_ps( q0, nx ) ) );
+        __m256 qny = _mm256_fmadd_ps( q5, nz, _mm256_fmadd_ps( q1, ny, _mm256_mul_ps( q3, nx ) ) );
+        __m256 qnz = _mm256_fmadd_ps( q2, nz, _mm256_fmadd_ps( q5, ny, _mm256_mul_ps( q4, nx ) ) );
+        __m256 qnn = _mm256_fmadd_ps( nz, qnz, _mm256_fmadd_ps( ny, qny, _mm256_mul_ps( nx, qnx ) ) );
+
+        __m256 c2 = _mm256_mul_ps( _mm256_mul_ps( hi, hi ), inv2 );
+        __m256 gm = _mm256_loadu_ps( &src.gm[j] );
+        __m256 sn = _mm256_fnmadd_ps( _mm256_mul_ps( c52, c2 ), qnn, _mm256_sub_ps( _mm256_setzero_ps(), _mm256_mul_ps( gm, inv2 ) ) );
+        __m256 vx = _mm256_mul_ps( c2, qnx ), vy = _mm256_mul_ps( c2, qny ), vz = _mm256_mul_ps( c2, qnz );
+        __m256 e = _mm256_mul_ps( eps2, inv2 );
+        if (plummer)
+            sn = _mm256_fmadd_ps( _mm256_mul_ps( c52, _mm256_mul_ps( c2, e ) ), _mm256_loadu_ps( &src.tr[j] ), sn );
+
+        if (oct) {
+            __m256 xx = _mm256_mul_ps( nx, nx ), yy = _mm256_mul_ps( ny, ny ), zz = _mm256_mul_ps( nz, nz );
+            __m256 xy = _mm256_mul_ps( two, _mm256_mul_ps( nx, ny ) );
+            __m256 xz = _mm256_mul_ps( two, _mm256_mul_ps( nx, nz ) );
+            __m256 yz = _mm256_mul_ps( two, _mm256_mul_ps( ny, nz ) );
+            __m256 o[10];
+            for (int k = 0; k < 10; k++)
+                o[k] = _mm256_loadu_ps( &src.o[k][j] );
+
+            __m256 onx = _mm256_fmadd_ps( o[9], yz, _mm256_fmadd_ps( o[4], xz, _mm256_fmadd_ps( o[3], xy,
+                         _mm256_fmadd_ps( o[7], zz, _mm256_fmadd_ps( o[5], yy, _mm256_mul_ps( o[0], xx ) ) ) ) ) );
+            __m256 ony = _mm256_fmadd_ps( o[6], yz, _mm256_fmadd_ps( o[9], xz, _mm256_fmadd_ps( o[5], xy,
+                         _mm256_fmadd_ps( o[8], zz, _mm256_fmadd_ps( o[1], yy, _mm256_mul_ps( o[3], xx ) ) ) ) ) );
+            __m256 onz = _mm256_fmadd_ps( o[8], yz, _mm256_fmadd_ps( o[7], xz, _mm256_fmadd_ps( o[9], xy,
+                         _mm256_fmadd_ps( o[2], zz, _mm256_fmadd_ps( o[6], yy, _mm256_mul_ps( o[4], xx ) ) ) ) ) );
+            __m256 onnn = _mm256_fmadd_ps( nz, onz, _mm256_fmadd_ps( ny, ony, _mm256_mul_ps( nx, onx ) ) );
+
+            __m256 c3 = _mm256_mul_ps( c2, hi );
+            sn = _mm256_fnmadd_ps( _mm256_mul_ps( c76, c3 ), onnn, sn );
+            __m256 hc3 = _mm256_mul_ps( half, c3 );
+            vx = _mm256_fmadd_ps( hc3, onx, vx );
+            vy = _mm256_fmadd_ps( hc3, ony, vy );
+            vz = _mm256_fmadd_ps( hc3, onz, vz );
+
+            if (plummer) {
+                __m256 v0 = _mm256_loadu_ps( &src.v[0][j] ), v1 = _mm256_loadu_ps( &src.v[1][j] ), v2 = _mm256_loadu_ps( &src.v[2][j] );
+                __m256 vn = _mm256_fmadd_ps( nz, v2, _mm256_fmadd_ps( ny, v1, _mm256_mul_ps( nx, v0 ) ) );
+                __m256 ce = _mm256_mul_ps( c3, e ), tce = _mm256_mul_ps( c32, ce );
+                sn = _mm256_fmadd_ps( _mm256_mul_ps( c212, ce ), vn, sn );
+                vx = _mm256_fnmadd_ps( tce, v0, vx );
+                vy = _mm256_fnmadd_ps( tce, v1, vy );
+                vz = _mm256_fnmadd_ps( tce, v2, vz );
+            }
+        }
+
+        ax.add( _mm256_fmadd_ps( sn, nx, vx ) );
+        ay.add( _mm256_fmadd_ps( sn, ny, vy ) );
+        az.add( _mm256_fmadd_ps( sn, nz, vz ) );
+    }
+
+    scalar sx = ax.total(), sy = ay.total(), sz = az.total();
+    for (; j < src.count; j++)
+        accel_one( src, j, tpx, tpy, tpz, teps2, sx, sy, sz );
+
+    return { sx, sy, sz };
+}
+
+// gcc 12's avx-512 headers trip -Wuninitialized on their own _mm512_undefined_ps() placeholders
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+
+/**
+ * avx-512 multipole kernel, 16 nodes per iteration, same math as accel_one. the tail is
+ * done with masked loads, and masked-off lanes are left out of the sums.
+*/
+__attribute__((target("avx512f")))
+vec multipole_avx512( scalar tx, scalar ty, scalar tz, const mlist &src, const softening &soft ) {
+    const kscalar tpx = (kscalar) (tx - src.ox), tpy = (kscalar) (ty - src.oy), tpz = (kscalar) (tz - src.oz);
+    __m512 px = _mm512_set1_ps( tpx ), py = _mm512_set1_ps( tpy ), pz = _mm512_set1_ps( tpz );
+    sum16 ax, ay, az;
+    const __m512 one = _mm512_set1_ps( 1.0f ), two = _mm512_set1_ps( 2.0f ), half = _mm512_set1_ps( 0.5f );
+    const __m512 c52 = _mm512_set1_ps( 2.5f ), c76 = _mm512_set1_ps( 7.0f / 6.0f );
+    const __m512 c212 = _mm512_set1_ps( 10.5f ), c32 = _mm512_set1_ps( 1.5f );
+    const kscalar teps2 = (kscalar) soft.eps2();
+    const __m512 eps2 = _mm512_set1_ps( teps2 );
+    bool oct = src.order >= ORDER_OCTUPOLE, plummer = teps2 > 0;
+
+    for (int j = 0; j < src.count; j += 16) {
+        int left = src.count - j;
+        __mmask16 k = (left >= 16) ? (__mmask16) 0xffff : (__mmask16) ((1u << left) - 1);
+
+        __m512 rx = _mm512_sub_ps( px, _mm512_maskz_loadu_ps( k, &src.x[j] ) );
+        __m512 ry = _mm512_sub_ps( py, _mm512_maskz_loadu_ps( k, &src.y[j] ) );
+        __m512 rz = _mm512_sub_ps( pz, _mm512_maskz_loadu_ps( k, &src.z[j] ) );
+        __m512 r2 = _mm512_add_ps( _mm512_fmadd_ps( rz, rz, _mm512_fmadd_ps( ry, ry, _mm512_mul_ps( rx, rx ) ) ), eps2 );
+        __m512 inv = _mm512_div_ps( one, _mm512_sqrt_ps( r2 ) );
+        __m512 nx = _mm512_mul_ps( rx, inv ), ny = _mm512_mul_ps( ry, inv ), nz = _mm512_mul_ps( rz, inv );
+        __m512 inv2 = _mm512_mul_ps( inv, inv );
+        __m512 hi = _mm512_mul_ps( _mm512_maskz_loadu_ps( k, &src.h[j] ), inv );
+
+        __m512 q0 = _mm512_maskz_loadu_ps( k, &src.q[0][j] ), q1 = _mm512_maskz_loadu_ps( k, &src.q[1][j] );
+        __m512 q2 = _mm512_maskz_loadu_ps( k, &src.q[2][j] ), q3 = _mm512_maskz_loadu_ps( k, &src.q[3][j] );
+        __m512 q4 = _mm512_maskz_loadu_ps( k, &src.q[4][j] ), q5 = _mm512_maskz_loadu_ps( k, &src.q[5][j] );
+        __m512 qnx = _mm512_fmadd_ps( q4, nz, _mm512_fmadd_ps( q3, ny, _mm512_mul_ps( q0, nx ) ) );
+        __m512 qny = _mm512_fmadd_ps( q5, nz, _mm512_fmadd_ps( q1, ny, _mm512_mul_ps( q3, nx ) ) );
+        __m512 qnz = _mm512_fmadd_ps( q2, nz, _mm512_fmadd_ps( q5, ny, _mm512_mul_ps( q4, nx ) ) );
+        __m512 qnn = _mm512_fmadd_ps( nz, qnz, _mm512_fmadd_ps( ny, qny, _mm512_mul_ps( nx, qnx ) ) );
+
+        __m512 c2 = _mm512_mul_ps( _mm512_mul_ps( hi, hi ), inv2 );
+        __m512 gm = _mm512_maskz_loadu_ps( k, &src.gm[j] );
+        __m512 sn = _mm512_fnmadd_ps( _mm512_mul_ps( c52, c2 ), qnn, _mm512_sub_ps( _mm512_setzero_ps(), _mm512_mul_ps( gm, inv2 ) ) );
+        __m512 vx = _mm512_mul_ps( c2, qnx ), vy = _mm512_mul_ps( c2, qny ), vz = _mm512_mul_ps( c2, qnz );
+        __m512 e = _mm512_mul_ps( eps2, inv2 );
+        if (plummer)
+            sn = _mm512_fmadd_ps( _mm512_mul_ps( c52, _mm512_mul_ps( c2, e ) ), _mm512_maskz_loadu_ps( k, &src.tr[j] ), sn );
+
+        if (oct) {
+            __m512 xx = _mm512_mul_ps( nx, nx ), yy = _mm512_mul_ps( ny, ny ), zz = _mm512_mul_ps( nz, nz );
+            __m512 xy = _mm512_mul_ps( two, _mm512_mul_ps( nx, ny ) );
+            __m512 xz = _mm512_mul_ps( two, _mm512_mul_ps( nx, nz ) );
+            __m512 yz = _mm512_mul_ps( two, _mm512_mul_ps( ny, nz ) );
+            __m512 o[10];
+            for (int c = 0; c < 10; c++)
+                o[c] = _mm512_maskz_loadu_ps( k, &src.o[c][j] );
+
+            __m512 onx = _mm512_fmadd_ps( o[9], yz, _mm512_fmadd_ps( o[4], xz, _mm512_fmadd_ps( o[3], xy,
+                         _mm512_fmadd_ps( o[7], zz, _mm512_fmadd_ps( o[5], yy, _mm512_mul_ps( o[0], xx ) ) ) ) ) );
+            __m512 ony = _mm512_fmadd_ps( o[6], yz, _mm512_fmadd_ps( o[9], xz, _mm512_fmadd_ps( o[5], xy,
+                         _mm512_fmadd_ps( o[8], zz, _mm512_fmadd_ps( o[1], yy, _mm512_mul_ps( o[3], xx ) ) ) ) ) );
+            __m512 onz = _mm512_fmadd_ps( o[8], yz, _mm512_fmadd_ps( o[7], xz, _mm512_fmadd_ps( o[9], xy,
+                         _mm512_fmadd_ps( o[2], zz, _mm512_fmadd_ps( o[6], yy, _mm512_mul_ps( o[4], xx ) ) ) ) ) );
+            __m512 onnn = _mm512_fmadd_ps( nz, onz, _mm512_fmadd_ps( ny, ony, _mm512_mul_ps( nx, onx ) ) );
+
+            __m512 c3 = _mm512_mul_ps( c2, hi );
+            sn = _mm512_fnmadd_ps( _mm512_mul_ps( c76, c3 ), onnn, sn );
+            __m512 hc3 = _mm512_mul_ps( half, c3 );
+            vx = _mm512_fmadd_ps( hc3, onx, vx );
+            vy = _mm512_fmadd_ps( hc3, ony, vy );
+            vz = _mm512_fmadd_ps( hc3, onz, vz );
+
+            if (plummer) {
+                __m512 v0 = _mm512_maskz_loadu_ps( k, &src.v[0][j] ), v1 = _mm512_maskz_loadu_ps( k, &src.v[1][j] );
+                __m512 v2 = _mm512_maskz_loadu_ps( k, &src.v[2][j] );
+                __m512 vn = _mm512_fmadd_ps( nz, v2, _mm512_fmadd_ps( ny, v1, _mm512_mul_ps( nx, v0 ) ) );
+                __m512 ce = _mm512_mul_ps( c3, e ), tce = _mm512_mul_ps( c32, ce );
+                sn = _mm512_fmadd_ps( _mm512_mul_ps( c212, ce ), vn, sn );
+                vx = _mm512_fnmadd_ps( tce, v0, vx );
+                vy = _mm512_fnmadd_ps( tce, v1, vy );
+                vz = _mm512_fnmadd_ps( tce, v2, vz );
+            }
+        }
+
+        // a masked-off lane can sit right on the target (0/0), so it's kept out of the sums
+        ax.add( _mm512_maskz_mov_ps( k, _mm512_fmadd_ps( sn, nx, vx ) ) );
+        ay.add( _mm512_maskz_mov_ps( k, _mm512_fmadd_ps( sn, ny, vy ) ) );
+        az.add( _mm512_maskz_mov_ps( k, _mm512_fmadd_ps( sn, nz, vz ) ) );
+    }
+
+    return { ax.total(), ay.total(), az.total() };
+}
+
+#pragma GCC diagnostic pop
+
+#else
+
+// no x86 vector units (or a double build), the "simd" kernels just fall back to the scalar one.
+vec multipole_avx2( scalar tx, scalar ty, scalar tz, const mlist &src, const softening &soft ) { return multipole_scalar( tx, ty, tz, src, soft ); }
+vec multipole_avx512( scalar tx, scalar ty, scalar tz, const mlist &src, const softening &soft ) { return multipole_scalar( tx, ty, tz, src, soft ); }
+
+#endif
+
+/**
+ * potential version of the multipole kernels, monopole included:
+ *   phi = -( gm / r + (h^2 / r^3) (n q n) / 2 + (h^3 / r^4) (o n n n) / 6 )
+ * softened like the kernels, where the traces add
+ *   (h^2 / r^3) e tr / 2  +  (h^3 / r^4) 3/2 e (v n)
+ * only needed on output steps, so this one stays scalar (but sums in double).
+ *
+ * @param tx target position, x [m]
+ * @param ty target position, y [m]
+ * @param tz target position, z [m]
+ * @param src accepted nodes
+ * @param soft softening
+ *
+ * @returns the potential at the target [J/kg].
+*/
+double potential_multipole( scalar tx, scalar ty, scalar tz, const mlist &src, const softening &soft ) {
+    double phi = 0;
+    double px = tx - src.ox, py = ty - src.oy, pz = tz - src.oz;
+    double eps2 = soft.eps2();
+
+    for (int j = 0; j < src.count; j++) {
+        double rx = px - src.x[j], ry = py - src.y[j], rz = pz - src.z[j];
+        double inv = 1 / std::sqrt( rx*rx + ry*ry + rz*rz + eps2 );
+        double nx = rx * inv, ny = ry * inv, nz = rz * inv;
+        double hi = src.h[j] * inv;
+        double e = eps2 * inv * inv;
+
+        double qnn = src.q[0][j]*nx*nx + src.q[1][j]*ny*ny + src.q[2][j]*nz*nz
+                   + 2 * (src.q[3][j]*nx*ny + src.q[4][j]*nx*nz + src.q[5][j]*ny*nz);
+        double term = src.gm[j] + 0.5 * hi * hi * (qnn - e * src.tr[j]);
+
+        if (src.order >= ORDER_OCTUPOLE) {
+            const std::vector<kscalar> *o = src.o;
+            double onnn = o[0][j]*nx*nx*nx + o[1][j]*ny*ny*ny + o[2][j]*nz*nz*nz
+                        + 3 * (o[3][j]*nx*nx*ny + o[4][j]*nx*nx*nz + o[5][j]*nx*ny*ny
+                             + o[6][j]*ny*ny*nz + o[7][j]*nx*nz*nz + o[8][j]*ny*nz*nz)
+                        + 6 * o[9][j]*nx*ny*nz;
+            double vn = src.v[0][j]*nx + src.v[1][j]*ny + src.v[2][j]*nz;
+            term += hi * hi * hi * (onnn / 6.0 - 1.5 * e * vn);
+        }
+
+        phi -= term * inv;
+    }
+
+    return phi;
+}
+
+/**
+ * picks the multipole kernel that goes with a force kernel (see pick_kernel), so both
+ * use the same instruction set.
+ *
+ * @param picked name of the force kernel in use: "avx512", "avx2" or "scalar"
+ *
+ * @returns the kernel.
+*/
+multipole_kernel pick_multipole_kernel( const char *picked ) {
+    if (std::strcmp( picked, "avx512" ) == 0)
+        return multipole_avx512;
+    if (std::strcmp( picked, "avx2" ) == 0)
+        return multipole_avx2;
+    return multipole_scalar;
+}
@@ -1,44 +1,33 @@
 #include "node.h"
-#include "body.h"
+#include "profile.h"
 #include "util.h"
 #include <iostream>
 
 /** 
  * constructor, basic. all fields aside from position and size are set to 
- * zero or null pointers.
+ * zero or -1 (no child, no bodies).
  * 
  * @param c the coordinates of the upper left corner of the node
  * @param s the physical size of the node's domain [m]
+ * @param p index of the parent node, -1 for the root
 */
-Node::Node( vec c, scalar s) {
+Node::Node( vec c, scalar s, int p ) {
     this->mass = 0.;
     this->dx = s;
+    this->size = s;
     this->nchildren = 0;
     this->corner = c;
     this->com = {0, 0, 0}; // workaround to get a zero vector, lazy :/
     
-    this->parent = nullptr;
-    this->particle = nullptr;
+    this->parent = p;
+    this->first = -1;
+    this->count = 0;
     
     for (int i = 0; i < 8; i++) {
-        this->children[i] = nullptr;
+        this->children[i] = -1;
     }
 }
 
-/** 
- * destructor, because i forgot to destroy the children (oops)
- * 
- * note that we DON'T destroy the particle (body) here >> 
- * that pointer is still needed by the tree to rebuild.
- */
-Node::~Node( ) {
-    this->parent = nullptr;
-    this->particle = nullptr;
-    for (int i = 0; i < 8; i++) {
-        this->children[i] = nullptr;
-    } 
-}
-
 /** 
  * checks if a node is internal to the tree.
  * 
@@ -46,7 +35,7 @@ Node::~Node( ) {
  * 
  * @returns true if the node is internal (has children); false otherwise.
  */
-bool Node::is_internal( ) {
+bool Node::is_internal( ) const {
     if (nchildren > 0)
         return true;
     return false;
@@ -58,7 +47,7 @@ bool Node::is_internal( ) {
  * 
  * @returns true if v inside this node; false otherwise.
 */
-bool Node::contains( vec v ) {
+bool Node::contains( vec v ) const {
 
     if ( ( v.x > this->corner.x && v.x <= this->corner.x + this->dx ) &&
             ( v.y > this->corner.y && v.y <= this->corner.y + this->dx ) &&
@@ -69,151 +58,244 @@ bool Node::contains( vec v ) {
 }
 
 /**
- * recursively inserts a particle (body) into this node (or its children).
+ * updates the total node mass (e.g. if we added a body or a child node.)
  * 
- * psuedocode taken from Thomas Trost's lecture slides [here](https://www.tp1.ruhr-uni-bochum.de/~grauer/lectures/compI_IIWS1819/pdfs/lec10.pdf)
+ * with mp set, also fills in the node's higher moments about its center of mass: 
+ * summed over the bucket for a leaf, shifted up from the children otherwise.
+ * 
+ * this is also the refit of a tree whose bodies have moved since it was built (see 
+ * Octree::update_tree): bodies that left their leaf's cell stay in that leaf, and the 
+ * node's size (and its parents', if need be) grows to cover them, so the opening test
+ * stays as safe as on a fresh tree.
  * 
- * @param b the body to be added to the node.
+ * @param nodes the tree's flat node array that our child indices point into
+ * @param p the particles, in tree order
+ * @param mp the tree's moments, indexed like nodes (nullptr for monopole only)
+ * @param order highest moment to fill in, see multipole_order
+ * @param lo optional, set to the lower corner of the bounding box of the node's bodies
+ * @param hi optional, set to the upper corner of that box
+ * @param done optional, subtrees below this node that are already fit (see upward_cut);
+ *             their results are taken as they are
+ * 
+ * @returns the number of bodies in this subtree that are outside their leaf's cell.
 */
-void Node::insert( Body* b) {
+int Node::update_mass( Node* nodes, const Particles &p, multipole *mp, int order, vec *lo, vec *hi, const upward_cut *done ) {
 
+    if (done && done->slot[this - nodes] >= 0) {
+        int s = done->slot[this - nodes];
+        if (lo) *lo = done->lo[s];
+        if (hi) *hi = done->hi[s];
+        return done->migrants[s];
+    }
+    
+    // summing in double, mass * position in metres overflows a float
+    double tmass = 0;
+    double tx = 0, ty = 0, tz = 0;
 
-    if ( particle == nullptr && !is_internal() ) {
-        // creates a new particle if this node doesn't have one
-        particle = b;
-        return;
-    } else if ( is_internal() ) {
-        int q = get_quadrant(this->dx, this->corner, b->pos);
-        if (children[q] == nullptr) {
-            vec cnew = get_new_corner(q, this->corner, this->dx);
-            children[q] = new Node( cnew, this->dx/2);
-            children[q]->parent = this;
-            nchildren++;
+    vec top = corner + vec( dx, dx, dx );
+    vec bmin = top, bmax = corner; // an empty box, as far as the cell is concerned
+    int migrants = 0;
+
+    if (!is_internal()) {
+        // a leaf: add up the bucket
+        for (int j = first; j < first + count; j++) {
+            double m = p.m[j];
+            tmass += m;
+            tx += p.x[j] * m;
+            ty += p.y[j] * m;
+            tz += p.z[j] * m;
+
+            if (p.x[j] < bmin.x) bmin.x = p.x[j];
+            if (p.y[j] < bmin.y) bmin.y = p.y[j];
+            if (p.z[j] < bmin.z) bmin.z = p.z[j];
+            if (p.x[j] > bmax.x) bmax.x = p.x[j];
+            if (p.y[j] > bmax.y) bmax.y = p.y[j];
+            if (p.z[j] > bmax.z) bmax.z = p.z[j];
+            migrants += p.x[j] < corner.x || p.x[j] > top.x || p.y[j] < corner.y || p.y[j] > top.y ||
+                        p.z[j] < corner.z || p.z[j] > top.z;
         }
-        children[q]->insert( b );
-        return;
-    } 
+    } else {
+        // otherwise, go through the children!
+        for (int i = 0; i < 8; i++) {
+            if (children[i] >= 0) {
+                Node &child = nodes[children[i]];
+                vec clo, chi;
+                migrants += child.update_mass( nodes, p, mp, order, &clo, &chi, done );
+                double cm = child.mass;
+                tmass += cm;
+                tx += child.com.x * cm; // weighted sum!
+                ty += child.com.y * cm;
+                tz += child.com.z * cm;
+
+                bmin = { std::fmin( bmin.x, clo.x ), std::fmin( bmin.y, clo.y ), std::fmin( bmin.z, clo.z ) };
+                bmax = { std::fmax( bmax.x, chi.x ), std::fmax( bmax.y, chi.y ), std::fmax( bmax.z, chi.z ) };
+            }
+        }
+    }
 
-    // inserting this node's particle into a new subdivision/node.
-    int qold = get_quadrant( dx, corner, particle->pos);
-    int qnew = get_quadrant( dx, corner, b->pos);
+    // the smallest cube around the cell's center that holds the cell and all of the bodies
+    size = dx;
+    if (bmin.x < corner.x || bmin.y < corner.y || bmin.z < corner.z || bmax.x > top.x || bmax.y > top.y || bmax.z > top.z) {
+        vec c = corner + vec( dx/2, dx/2, dx/2 );
+        scalar half = std::fmax( std::fmax( c.x - bmin.x, bmax.x - c.x ),
+                      std::fmax( std::fmax( c.y - bmin.y, bmax.y - c.y ), std::fmax( c.z - bmin.z, bmax.z - c.z ) ) );
+        size = std::fmax( dx, 2 * half );
+    }
+    if (lo) *lo = bmin;
+    if (hi) *hi = bmax;
 
-    if (children[qold] == nullptr) { // if there's not already a node there
-        vec cnew = get_new_corner(qold, this->corner, this->dx);
-        children[qold] = new Node( cnew, this->dx/2);
-        children[qold]->parent = this;
-        nchildren++;
+    if (tmass > 0) {
+        mass = tmass;
+        com = { (scalar) (tx / tmass), (scalar) (ty / tmass), (scalar) (tz / tmass) }; // final weighted sum
+    } else { // if the node is empty for some reason...
+        mass = 0;
+        com = {0, 0, 0};
     }
 
-    children[qold]->insert(particle);
-    particle = nullptr;
+    if (mp == nullptr || order < ORDER_QUADRUPOLE)
+        return migrants;
+
+    multipole &own = mp[this - nodes];
+    own.cx = com.x;
+    own.cy = com.y;
+    own.cz = com.z;
+    own.clear();
 
-    if (children[qnew] == nullptr) { // if there's not already a node there
-        vec cnew = get_new_corner(qnew, this->corner, this->dx);
-        children[qnew] = new Node( cnew, this->dx/2);
-        children[qnew]->parent = this;
-        nchildren++;
+    if (!is_internal()) {
+        for (int j = first; j < first + count; j++)
+            own.add_body( p.m[j], p.x[j] - own.cx, p.y[j] - own.cy, p.z[j] - own.cz, order );
+    } else {
+        for (int i = 0; i < 8; i++) {
+            if (children[i] >= 0)
+                own.add_child( mp[children[i]], nodes[children[i]].mass, order );
+        }
     }
+    own.finish( dx, order );
 
-    children[qnew]->insert(b);
+    return migrants;
 
-    update_mass( ); // not sure if this needs to happen here or not
-    return;
-    
 }
 
 /**
- * updates the total node mass (e.g. if we added a body or a child node.)
+ * walks this node (and, if needed, its children) and collects everything that pulls 
+ * on body i: single bodies from nearby leaf buckets go in the particle-particle list, 
+ * far away nodes go in the particle-cell list as one point mass at their center of mass.
+ * the actual sums are done afterwards by a (simd) force kernel, see kernels.h.
+ * 
+ * a node that holds body i itself is always opened, whatever theta says, so a body
+ * never feels its own mass through a cell.
+ * 
+ * this only reads from the tree and the particles, so any number of threads can walk
+ * the tree at the same time, each with its own lists.
+ * 
+ * psuedocode taken from Thomas Trost's lecture slides [here](https://www.tp1.ruhr-uni-bochum.de/~grauer/lectures/compI_IIWS1819/pdfs/lec10.pdf)
+ * 
+ * @param nodes the tree's flat node array that our child indices point into
+ * @param p the particles, in tree order
+ * @param i the body we're calculating the acceleration of
+ * @param theta threshold criteria for barnes-hut, ratio of node width (size) to distance to center of mass.
+ * @param pp particle-particle interaction list to append to
+ * @param pc particle-cell interaction list to append to
+ * @param pm list for accepted nodes with their moments, used instead of pc above monopole order
+ *           (except within the spline's softening length, where only the softened monopole is right)
+ * 
 */
-void Node::update_mass( ) {
-    
-    // if this is a node with no children and one body:
-
-    if (!is_internal()) {
-
-        if (particle != nullptr) {
-            mass = particle->mass;
-            com = particle->pos;
+void Node::get_force( const Node* nodes, const Particles &p, int i, scalar theta, ilist &pp, ilist &pc, 
+                      mlist *pm ) const {
+    // this is where the magic of barnes hut happens.
+    if (mass == 0) { return; }
+
+    if (!owns( i )) {
+        vec rdiff = com - p.pos( i );
+        scalar r = rdiff.norm();
+
+        // barnes-hut approximation for this node
+        if ( size / r < theta ) {
+            if (pm && r >= pm->near)
+                pm->push( this - nodes, (scalar) (G * mass), dx );
+            else
+                pc.push( com.x, com.y, com.z, (scalar) (G * mass) );
             return;
-        } 
+        }
+    }
 
-        // if the node is empty for some reason...
-        mass = 0;
-        com = {0, 0, 0};
+    // a bucket close by: every body in it interacts directly
+    if (!is_internal()) {
+        for (int j = first; j < first + count; j++) {
+            if (j != i)
+                pp.push( p.x[j], p.y[j], p.z[j], (scalar) (G * p.m[j]) );
+        }
         return;
     }
 
-    // otherwise, go through the children!
-    scalar tmass = 0;
-    vec tcom = {};
+    // otherwise, we look at the child nodes (recursion)
+    PROFILE_COUNT( profile_openings );
+    for (int c = 0; c < 8; c++) {
 
-    for (int i = 0; i < 8; i++) {
-        if (children[i] != nullptr) {
-            children[i]->update_mass( );
-            tmass += children[i]->mass;
-            tcom += (children[i]->com * children[i]->mass); // weighted sum!
+        if ( children[c] >= 0 ) {
+            nodes[children[c]].get_force( nodes, p, i, theta, pp, pc, pm );
         }
     }
 
-    if (tmass > 0) {
-        mass = tmass;
-        com = tcom * (1 / tmass); // final weighted sum
-    } else { // if all children are empty.
-        mass = 0;
-        com = {0, 0, 0};
-    }
-
-    return;
-
 }
 
 /**
- * calculates the net force this node exerts on another body,
- * either using a direct calculation or a center of mass estimate
- * with the barnes-hut algorithm. recursive, to ensure we track through
- * the tree if needed.
+ * group version of get_force: one walk for a whole group of nearby bodies (a small 
+ * subtree), whose interaction lists are then used for every body in it.
  * 
- * psuedocode taken from Thomas Trost's lecture slides [here](https://www.tp1.ruhr-uni-bochum.de/~grauer/lectures/compI_IIWS1819/pdfs/lec10.pdf)
+ * the opening test uses the distance from a node's center of mass to the closest point 
+ * of the group's bounding box, i.e. the closest any body in the group can be. a node
+ * accepted here would have been accepted by every single body's own walk, so the forces
+ * are at least as accurate as get_force at the same theta (just with more direct terms).
+ * nodes that overlap the group (its ancestors and itself) are always opened.
  * 
- * @param b the body we're calculating force on
- * @param theta threshold criteria for barnes-hut, ratio of node width to distance to center of mass.
- * 
- * @returns a force vector.
+ * the group's own bodies end up in the particle-particle list too; the kernels skip the
+ * r = 0 term, so nobody pulls on itself.
  * 
+ * @param nodes the tree's flat node array that our child indices point into
+ * @param p the particles, in tree order
+ * @param group the node whose bodies we're calculating accelerations for
+ * @param bmin lower corner of the bounding box of the group's bodies [m]
+ * @param bmax upper corner of the bounding box of the group's bodies [m]
+ * @param theta threshold criteria for barnes-hut, ratio of node width to distance to center of mass.
+ * @param pp particle-particle interaction list to append to
+ * @param pc particle-cell interaction list to append to
+ * @param pm list for accepted nodes with their moments, used instead of pc above monopole order
 */
-vec Node::get_force( Body* b, scalar theta) {
-    // this is where the magic of barnes hut happens.
-    vec force = {};
-    scalar F = 0;
-
-    if (mass == 0) { return force; }
-
-    vec rdiff = com - b->pos;
-    scalar r = rdiff.norm();
-
-    // if this node has one particle
-    if (!is_internal() && particle != nullptr && particle != b) {
-        // calcuate the force 
-        F = G * particle->mass * b->mass / pow(r, 3); // magnitude of force
-        b->acc += rdiff * F * (1/b->mass); // updating particle acceleration from force calculation.
-        // i should probably update velocity and position when we handle timesteps.
-        return rdiff * F; // force vector!
+void Node::get_force_group( const Node* nodes, const Particles &p, const Node &group, vec bmin, vec bmax, 
+                            scalar theta, ilist &pp, ilist &pc, mlist *pm ) const {
+    if (mass == 0) { return; }
+
+    bool overlap = first < group.first + group.count && group.first < first + count;
+
+    if (!overlap) {
+        // distance from our center of mass to the group's box, per axis (zero if inside)
+        scalar ex = std::fmax( std::fmax( bmin.x - com.x, com.x - bmax.x ), (scalar) 0 );
+        scalar ey = std::fmax( std::fmax( bmin.y - com.y, com.y - bmax.y ), (scalar) 0 );
+        scalar ez = std::fmax( std::fmax( bmin.z - com.z, com.z - bmax.z ), (scalar) 0 );
+        scalar rmin = std::sqrt( ex*ex + ey*ey + ez*ez );
+
+        if ( rmin > 0 && size / rmin < theta ) {
+            if (pm && rmin >= pm->near)
+                pm->push( this - nodes, (scalar) (G * mass), dx );
+            else
+                pc.push( com.x, com.y, com.z, (scalar) (G * mass) );
+            return;
+        }
     }
 
-    // barnes-hut approximation for this node
-    if ( dx / distance(com, b->pos) < theta ) {
-        F = G * mass * b->mass / pow(r, 3); // calcuates force using total node mass
-        return rdiff * F;
+    if (!is_internal()) {
+        for (int j = first; j < first + count; j++)
+            pp.push( p.x[j], p.y[j], p.z[j], (scalar) (G * p.m[j]) );
+        return;
     }
 
-    // otherwise, we look at the child nodes (recursion)
-    for (int i = 0; i < 8; i++) {
+    PROFILE_COUNT( profile_openings );
+    for (int c = 0; c < 8; c++) {
 
-        if ( children[i] != nullptr ) {
-            force += children[i]->get_force(b, theta);
+        if ( children[c] >= 0 ) {
+            nodes[children[c]].get_force_group( nodes, p, group, bmin, bmax, theta, pp, pc, pm );
         }
     }
 
-    return force;
-
-}
\ No newline at end of file
+}
@@ -0,0 +1,83 @@
+#include "pairs.h"
+
+#include <cmath>
+
+/**
+ * stumpff functions c(z) = (1 - cos sqrt z) / z and s(z) = (sqrt z - sin sqrt z) / sqrt z^3,
+ * continued to z < 0 with cosh and sinh, and as series near 0 where both cancel.
+*/
+static void stumpff( double z, double &c, double &s ) {
+    if (z > 1e-3) {
+        double q = std::sqrt( z );
+        c = (1 - std::cos( q )) / z;
+        s = (q - std::sin( q )) / (z * q);
+    } else if (z < -1e-3) {
+        double q = std::sqrt( -z );
+        c = (std::cosh( q ) - 1) / -z;
+        s = (std::sinh( q ) - q) / (-z * q);
+    } else {
+        c = 1.0/2 - z * (1.0/24 - z * (1.0/720 - z / 40320));
+        s = 1.0/6 - z * (1.0/120 - z * (1.0/5040 - z / 362880));
+    }
+}
+
+/**
+ * moves a two-body orbit along by dt, exactly (up to roundoff), however many orbits
+ * that is: universal variables, with kepler's equation solved by laguerre-conway
+ * iteration, which converges from any starting guess. bound orbits first drop whole
+ * periods from dt.
+ *
+ * @param gm G (ma + mb) [m^3/s^2]
+ * @param r relative position, replaced by the one after dt [m]
+ * @param v relative velocity, replaced by the one after dt [m/s]
+ * @param dt time to move along [s]
+*/
+void kepler_drift( double gm, double *r, double *v, double dt ) {
+    double r0 = std::sqrt( r[0]*r[0] + r[1]*r[1] + r[2]*r[2] );
+    double v2 = v[0]*v[0] + v[1]*v[1] + v[2]*v[2];
+    double rv = r[0]*v[0] + r[1]*v[1] + r[2]*v[2];
+    double alpha = 2 / r0 - v2 / gm; // 1 / semi-major axis
+    double sgm = std::sqrt( gm );
+
+    if (alpha > 0) {
+        double period = 2 * M_PI / (sgm * alpha * std::sqrt( alpha ));
+        dt = std::fmod( dt, period );
+    }
+    if (dt == 0)
+        return;
+
+    // kepler's equation f(x) = 0 in the universal anomaly x, f' = r(x)
+    double x = (alpha > 0) ? sgm * alpha * dt : sgm * dt / r0;
+    double c = 0.5, s = 1.0 / 6;
+    const double nl = 5; // laguerre-conway order
+    for (int it = 0; it < 50; it++) {
+        double z = alpha * x * x;
+        stumpff( z, c, s );
+        double f = rv / sgm * x*x * c + (1 - alpha * r0) * x*x*x * s + r0 * x - sgm * dt;
+        double fp = rv / sgm * x * (1 - z * s) + (1 - alpha * r0) * x*x * c + r0;
+        double fpp = rv / sgm * (1 - z * c) + (1 - alpha * r0) * x * (1 - z * s);
+        double root = std::sqrt( std::fabs( (nl - 1) * (nl - 1) * fp * fp - nl * (nl - 1) * f * fpp ) );
+        double dx = nl * f / (fp + (fp >= 0 ? root : -root));
+        x -= dx;
+        if (std::fabs( dx ) <= 1e-14 * std::fabs( x ))
+            break;
+    }
+
+    // lagrange coefficients
+    double z = alpha * x * x;
+    stumpff( z, c, s );
+    double f = 1 - x*x / r0 * c;
+    double g = dt - x*x*x / sgm * s;
+
+    double rn[3];
+    for (int k = 0; k < 3; k++)
+        rn[k] = f * r[k] + g * v[k];
+    double r1 = std::sqrt( rn[0]*rn[0] + rn[1]*rn[1] + rn[2]*rn[2] );
+
+    double fd = sgm / (r1 * r0) * (z * x * s - x);
+    double gd = 1 - x*x / r1 * c;
+    for (int k = 0; k < 3; k++) {
+        v[k] = fd * r[k] + gd * v[k];
+        r[k] = rn[k];
+    }
+}
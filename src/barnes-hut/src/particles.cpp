@@ -0,0 +1,63 @@
+#include "particles.h"
+
+/**
+ * base constructor, no bodies.
+*/
+Particles::Particles( ) {
+    this->n = 0;
+}
+
+/**
+ * resizes every array to hold n bodies. new entries are zeroed.
+ * 
+ * @param n number of bodies
+*/
+void Particles::resize( int n ) {
+    this->n = n;
+
+    x.resize( n ); y.resize( n ); z.resize( n );
+    vx.resize( n ); vy.resize( n ); vz.resize( n );
+    ax.resize( n ); ay.resize( n ); az.resize( n );
+    m.resize( n );
+    pot.resize( n );
+    id.resize( n );
+    rung.resize( n );
+    cost.resize( n );
+}
+
+/**
+ * reorders all bodies so that body order[i] ends up at index i.
+ * 
+ * the new arrays are gathered into scratch (in parallel) and then swapped in, so scratch
+ * holds the old order afterwards and can be reused for the next shuffle without allocating.
+ * 
+ * @param order new position -> old position
+ * @param scratch spare particle storage, resized as needed
+ * @param pool threads to shuffle with
+*/
+void Particles::permute( const std::vector<int> &order, Particles &scratch, ThreadPool *pool ) {
+    scratch.resize( n );
+
+    pool->parallel_for( n, 4096, [&]( int begin, int end, int ) {
+        for (int i = begin; i < end; i++) {
+            int j = order[i];
+            scratch.x[i] = x[j];   scratch.y[i] = y[j];   scratch.z[i] = z[j];
+            scratch.vx[i] = vx[j]; scratch.vy[i] = vy[j]; scratch.vz[i] = vz[j];
+            scratch.ax[i] = ax[j]; scratch.ay[i] = ay[j]; scratch.az[i] = az[j];
+            scratch.m[i] = m[j];
+            scratch.pot[i] = pot[j];
+            scratch.id[i] = id[j];
+            scratch.rung[i] = rung[j];
+            scratch.cost[i] = cost[j];
+        }
+    });
+
+    x.swap( scratch.x ); y.swap( scratch.y ); z.swap( scratch.z );
+    vx.swap( scratch.vx ); vy.swap( scratch.vy ); vz.swap( scratch.vz );
+    ax.swap( scratch.ax ); ay.swap( scratch.ay ); az.swap( scratch.az );
+    m.swap( scratch.m );
+    pot.swap( scratch.pot );
+    id.swap( scratch.id );
+    rung.swap( scratch.rung );
+    cost.swap( scratch.cost );
+}
@@ -0,0 +1,217 @@
+#include "pool.h"
+#include "profile.h"
+
+/**
+ * constructor, spins up nthreads - 1 helper threads that sleep until the first loop.
+ *
+ * @param nthreads total number of threads (the calling thread counts as one)
+*/
+ThreadPool::ThreadPool( int nthreads ) {
+    if (nthreads < 1) nthreads = 1;
+
+    this->nthreads = nthreads;
+    this->blocks = new block[nthreads];
+    this->job = nullptr;
+    this->chunk = 1;
+    this->generation = 0;
+    this->busy = 0;
+    this->stop = false;
+
+    for (int i = 1; i < nthreads; i++)
+        workers.emplace_back( &ThreadPool::worker, this, i );
+}
+
+/**
+ * destructor, wakes up the helpers one last time so they can exit.
+*/
+ThreadPool::~ThreadPool( ) {
+    {
+        std::lock_guard<std::mutex> guard( lock );
+        stop = true;
+    }
+    wake.notify_all();
+
+    for (size_t i = 0; i < workers.size(); i++)
+        workers[i].join();
+
+    delete[] blocks;
+}
+
+/**
+ * runs fn over [0, n) on every thread in the pool and returns once all of it is done.
+ *
+ * fn is called with half-open ranges [begin, end) of at most chunk iterations; the
+ * ranges never overlap, so fn may write to per-iteration outputs without locking. the
+ * third argument is the index of the calling thread (0 .. size()-1), for per-thread scratch.
+ *
+ * @param n number of iterations
+ * @param chunk iterations handed out per grab (smaller = better balance, more atomics)
+ * @param fn loop body, called as fn(begin, end, tid)
+*/
+void ThreadPool::parallel_for( int n, int chunk, const std::function<void(int, int, int)> &fn ) {
+    if (n <= 0) return;
+    if (chunk < 1) chunk = 1;
+
+    if (nthreads == 1) {
+        for (int i = 0; i < n; i += chunk)
+            fn( i, (i + chunk < n) ? i + chunk : n, 0 );
+        return;
+    }
+
+    // cutting the loop into one contiguous block per thread
+    for (int t = 0; t < nthreads; t++) {
+        blocks[t].next.store( (int) ((long) n * t / nthreads), std::memory_order_relaxed );
+        blocks[t].end = (int) ((long) n * (t + 1) / nthreads);
+    }
+
+    {
+        std::lock_guard<std::mutex> guard( lock );
+        this->job = &fn;
+        this->chunk = chunk;
+        this->busy = nthreads - 1;
+        generation++;
+    }
+    wake.notify_all();
+
+    run( 0 );
+
+    std::unique_lock<std::mutex> guard( lock );
+    done.wait( guard, [this] { return busy == 0; } );
+    this->job = nullptr;
+}
+
+/**
+ * main loop of a helper thread: sleep until a new loop shows up, help with it, repeat.
+ *
+ * @param tid index of this thread in the pool
+*/
+void ThreadPool::worker( int tid ) {
+    unsigned long seen = 0;
+
+    while (true) {
+        {
+            std::unique_lock<std::mutex> guard( lock );
+            wake.wait( guard, [this, seen] { return stop || generation != seen; } );
+            if (stop) return;
+            seen = generation;
+        }
+
+        run( tid );
+
+        std::lock_guard<std::mutex> guard( lock );
+        if (--busy == 0) done.notify_one();
+    }
+}
+
+/**
+ * works through this thread's own block first, then steals chunks from the others.
+ *
+ * @param tid index of this thread in the pool
+*/
+void ThreadPool::run( int tid ) {
+    for (int k = 0; k < nthreads; k++) {
+        block &blk = blocks[(tid + k) % nthreads];
+
+        while (true) {
+            int begin = blk.next.fetch_add( chunk, std::memory_order_relaxed );
+            if (begin >= blk.end) break;
+            int end = (begin + chunk < blk.end) ? begin + chunk : blk.end;
+            (*job)( begin, end, tid );
+        }
+    }
+}
+
+/**
+ * runs all tasks of a graph on the pool and returns once the last one is done. every
+ * thread takes ready tasks until there are none left; a task that finishes readies
+ * the ones waiting for it, and the thread that finished it mostly picks one of those
+ * up right away (the ready list is last in, first out), so a chain of tasks tends to
+ * stay on one thread, with its data still in that thread's cache.
+ *
+ * tasks may not call parallel_for or run_graph themselves.
+ *
+ * @param g tasks and their order, kept as they are so the graph can be run again
+*/
+void ThreadPool::run_graph( TaskGraph &g ) {
+    int ntask = g.size();
+    g.busy.assign( g.busy.size(), 0.0 );
+    g.span = 0;
+    if (ntask == 0) return;
+
+    g.pending.resize( ntask );
+    g.ready.clear();
+    for (int t = ntask - 1; t >= 0; t--) { // the first ones added get going first
+        g.pending[t] = g.tasks[t].waits;
+        if (g.pending[t] == 0)
+            g.ready.push_back( t );
+    }
+    g.left = ntask;
+
+    PROFILE_ONLY( auto start = std::chrono::steady_clock::now(); )
+    parallel_for( nthreads, 1, [&g]( int, int, int tid ) { g.drain( tid ); } );
+    PROFILE_ONLY( g.span = std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count(); )
+}
+
+/**
+ * adds a task.
+ *
+ * @param stage what kind of work it is, for the busy times (0 or more)
+ * @param fn the work, called as fn(tid) with the index of the thread it runs on
+ *
+ * @returns the task's index, for after.
+*/
+int TaskGraph::add( int stage, const std::function<void(int)> &fn ) {
+    if (stage >= (int) busy.size())
+        busy.resize( stage + 1, 0.0 );
+    tasks.push_back( task{ stage, fn, std::vector<int>(), 0 } );
+    return (int) tasks.size() - 1;
+}
+
+/**
+ * makes a task wait for another one.
+ *
+ * @param task the task that waits
+ * @param before the task that has to finish first, added earlier
+*/
+void TaskGraph::after( int task, int before ) {
+    tasks[before].next.push_back( task );
+    tasks[task].waits++;
+}
+
+/** drops all tasks, the busy times stay until the next run */
+void TaskGraph::clear( ) {
+    tasks.clear();
+}
+
+/**
+ * one thread's share of a run: takes ready tasks until all tasks are done, sleeping
+ * while everything left is waiting on tasks other threads are still busy with.
+ *
+ * @param tid index of this thread in the pool
+*/
+void TaskGraph::drain( int tid ) {
+    std::unique_lock<std::mutex> guard( lock );
+
+    while (true) {
+        wake.wait( guard, [this] { return left == 0 || !ready.empty(); } );
+        if (left == 0)
+            return;
+
+        int t = ready.back();
+        ready.pop_back();
+        guard.unlock();
+
+        PROFILE_ONLY( auto start = std::chrono::steady_clock::now(); )
+        tasks[t].fn( tid );
+        PROFILE_ONLY( double took = std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count(); )
+
+        guard.lock();
+        PROFILE_ONLY( busy[tasks[t].stage] += took; )
+        for (int next : tasks[t].next) {
+            if (--pending[next] == 0)
+                ready.push_back( next );
+        }
+        if (--left == 0 || ready.size() > 1)
+            wake.notify_all();
+    }
+}
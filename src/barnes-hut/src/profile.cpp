@@ -0,0 +1,7 @@
+#include "profile.h"
+
+const char *const phase_names[NPHASES] = { "build", "upward", "walk", "kick", "drift", "output" };
+
+#ifdef GLOBR_PROFILE
+thread_local long profile_openings = 0;
+#endif
@@ -0,0 +1,211 @@
+#include "snapshot.h"
+#include "util.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <sys/stat.h>
+
+/**
+ * sizes the body arrays for n bodies and stamps the header's magic and version.
+ *
+ * @param n number of bodies
+*/
+void snapshot::resize( int n ) {
+    memset( &head, 0, sizeof(head) );
+    memcpy( head.magic, SNAPSHOT_MAGIC, sizeof(head.magic) );
+    head.version = SNAPSHOT_VERSION;
+    head.n = n;
+    data.resize( (size_t) NFIELDS * n );
+}
+
+/**
+ * writes a binary snapshot: the header, then all arrays in one go.
+ *
+ * @param fname output file
+ * @param s snapshot to write
+ *
+ * @returns false if the file couldn't be opened or written.
+*/
+bool write_binary( const char *fname, const snapshot &s ) {
+    FILE *fout = fopen( fname, "wb" );
+    if (fout == NULL) return false;
+
+    bool ok = fwrite( &s.head, sizeof(s.head), 1, fout ) == 1;
+    ok = ok && fwrite( s.data.data(), sizeof(float), s.data.size(), fout ) == s.data.size();
+
+    return (fclose( fout ) == 0) && ok;
+}
+
+/**
+ * writes a snapshot as the old text table: a commented header, then one line per body
+ * with id, mass [msun] and position [m]. velocities don't make it into this one.
+ *
+ * @param fname output file, its name goes into the first header line
+ * @param s snapshot to write
+ *
+ * @returns false if the file couldn't be opened or written.
+*/
+bool write_text( const char *fname, const snapshot &s ) {
+    FILE *fout = fopen( fname, "w"); // new file to write to
+    if (fout == NULL) return false;
+
+    const char *base = strrchr( fname, '/' );
+    base = base ? base + 1 : fname;
+
+    // way too much work to get the time of our file's writing....
+    time_t current_time;
+    time(&current_time);
+    struct tm * timeinfo;
+    timeinfo = localtime(&current_time);
+    char tstring[100];
+    strftime( tstring, sizeof(char) * 100, "%X, %e %h %g", timeinfo);
+
+    const snapshot_header &h = s.head;
+
+    // a little header
+    fprintf( fout, "# >>> %s. file written at %s.\n", base, tstring);
+    fprintf( fout, "# >>> timestep                  : %-15d\n", h.step);
+    fprintf( fout, "# >>> particles                 : %-15d\n", h.n);
+    fprintf( fout, "# >>> theta                     : %-15.3f\n", h.theta );
+    fprintf( fout, "# >>> simulation time   [yr]    : %-15.3e\n", h.time/YR);
+    fprintf( fout, "# >>> simulation size   [pc]    : %-15.3e\n", h.size/PC);
+    if (h.energies) {
+        fprintf( fout, "# >>> kinetic energy    [J]     : %-15.3e\n", h.kenergy);
+        fprintf( fout, "# >>> potential energy  [J]     : %-15.3e\n", h.penergy);
+    } else {
+        fprintf( fout, "# >>> kinetic energy    [J]     : %-15s\n", "off");
+        fprintf( fout, "# >>> potential energy  [J]     : %-15s\n", "off");
+    }
+    fprintf( fout, "\n# >>> -------------------------------------------------------------------------------------------\n");
+    fprintf( fout, "%-8s  %18s  %18s  %18s  %18s\n\n", "pID", "mass [msun]", "x [m]", "y [m]", "z [m]");
+
+    const float *m = s.field( FIELD_M );
+    const float *x = s.field( FIELD_X );
+    const float *y = s.field( FIELD_Y );
+    const float *z = s.field( FIELD_Z );
+
+    for (int k = 0; k < h.n; k++)
+        fprintf(fout, "%-8d  %18.3f  %18.5e  %18.5e  %18.5e\n", k, m[k] / MSUN, x[k], y[k], z[k]);
+
+    return fclose( fout ) == 0;
+}
+
+/**
+ * reads a binary snapshot back in, checking the magic and version on the way.
+ *
+ * @param fname snapshot file
+ * @param s snapshot to fill
+ *
+ * @returns false if the file is missing, truncated or not a snapshot.
+*/
+bool read_binary( const char *fname, snapshot &s ) {
+    FILE *fin = fopen( fname, "rb" );
+    if (fin == NULL) return false;
+
+    snapshot_header h;
+    bool ok = fread( &h, sizeof(h), 1, fin ) == 1
+              && memcmp( h.magic, SNAPSHOT_MAGIC, sizeof(h.magic) ) == 0
+              && h.version == SNAPSHOT_VERSION && h.n >= 0;
+
+    if (ok) {
+        s.resize( h.n );
+        s.head = h;
+        ok = fread( s.data.data(), sizeof(float), s.data.size(), fin ) == s.data.size();
+    }
+
+    fclose( fin );
+    return ok;
+}
+
+/**
+ * constructor, makes the output directories and starts the writer thread.
+ *
+ * @param run name of the simulation run (and its data directory)
+ * @param format binary snapshots or text tables
+*/
+SnapshotWriter::SnapshotWriter( const char *run, snapshot_format format ) {
+    this->run = run;
+    this->format = format;
+    this->queued[0] = this->queued[1] = false;
+    this->filling = 0;
+    this->writing = 0;
+    this->stop = false;
+
+    std::string dname = std::string( DATPATH ) + "/" + run;
+    if (mkdir( DATPATH, 0777 ) != 0 && errno != EEXIST)
+        printf( "Couldn't make %s\n", DATPATH );
+    if (mkdir( dname.c_str(), 0777 ) != 0 && errno != EEXIST)
+        printf( "Couldn't make %s\n", dname.c_str() );
+
+    this->worker = std::thread( &SnapshotWriter::loop, this );
+}
+
+/** destructor, writes out everything still queued and stops the writer thread */
+SnapshotWriter::~SnapshotWriter( ) {
+    {
+        std::lock_guard<std::mutex> guard( lock );
+        stop = true;
+    }
+    ready.notify_one();
+    worker.join();
+}
+
+/**
+ * hands out the next free buffer, waiting for the writer if both are still queued.
+ *
+ * @returns the snapshot to fill, hand it back with submit().
+*/
+snapshot &SnapshotWriter::buffer( ) {
+    std::unique_lock<std::mutex> guard( lock );
+    freed.wait( guard, [this] { return !queued[filling]; } );
+    return bufs[filling];
+}
+
+/** queues the buffer from the last buffer() call for writing */
+void SnapshotWriter::submit( ) {
+    {
+        std::lock_guard<std::mutex> guard( lock );
+        queued[filling] = true;
+        filling ^= 1;
+    }
+    ready.notify_one();
+}
+
+/** waits until everything submitted so far is on disk */
+void SnapshotWriter::flush( ) {
+    std::unique_lock<std::mutex> guard( lock );
+    freed.wait( guard, [this] { return !queued[0] && !queued[1]; } );
+}
+
+/**
+ * the writer thread: takes the queued buffers in order and writes them, until it's
+ * told to stop and nothing is left.
+*/
+void SnapshotWriter::loop( ) {
+    char fname[512];
+
+    while (true) {
+        {
+            std::unique_lock<std::mutex> guard( lock );
+            ready.wait( guard, [this] { return stop || queued[writing]; } );
+            if (!queued[writing]) return;
+        }
+
+        const snapshot &s = bufs[writing];
+        snprintf( fname, sizeof(fname), "%s/%s/globr_%s_%07d.%s", DATPATH, run.c_str(), run.c_str(),
+                  s.head.step, format == FORMAT_TEXT ? "dat" : "snap" );
+
+        bool ok = (format == FORMAT_TEXT) ? write_text( fname, s ) : write_binary( fname, s );
+        if (!ok)
+            printf( "Couldn't write %s\n", fname );
+
+        {
+            std::lock_guard<std::mutex> guard( lock );
+            queued[writing] = false;
+            writing ^= 1;
+        }
+        freed.notify_all();
+    }
+}
@@ -1,24 +1,45 @@
 #include "tree.h"
 #include "body.h"
+#include "morton.h"
 #include "node.h"
 #include "util.h"
 
+#include <algorithm>
+#include <cstring>
 #include <iostream>
 #include <sstream>
 #include <stdio.h>
-#include <time.h>
-#include <sys/stat.h>
 
 /** basic constructor, initalizes to zero */
 Octree::Octree( ) {
-    this->root = nullptr;
     this->tsize = 0;
     this->corner = {0, 0, 0};
     this->n = 0;
+    this->ntree = 0;
 
     this->kenergy = 0;
     this->penergy = 0;
+    this->energies = false;
 
+    this->pool = new ThreadPool( 1 );
+    this->mode = BUILD_MORTON;
+    this->walk = WALK_GROUP;
+    this->group_size = 64;
+    this->leaf_size = 8;
+    this->moment_order = ORDER_MONOPOLE;
+    this->solver = SOLVER_TREE;
+    this->max_rung = 0;
+    this->eta = 0.05;
+    this->max_migrants = 0.05;
+    this->escape_radius = 0;
+    this->pair_radius = 0;
+    this->pair_gamma = 1e-4;
+    this->pairs_formed = 0;
+    this->pairs_dissolved = 0;
+    this->have_acc = false;
+    this->lists.resize( 2 );
+    this->mlists.resize( 1 );
+    set_kernel( "auto" );
 } 
 
 /** constructor, root node and empty tree.
@@ -32,19 +53,228 @@ Octree::Octree( ) {
 Octree::Octree( scalar cx, scalar cy, scalar cz, scalar dx ) {
     this->corner = {cx, cy, cz};
 
-    this->root = new Node( corner, dx );
+    this->nodes.push_back( Node( corner, dx ) );
     this->tsize = dx;
     this->n = 0;
+    this->ntree = 0;
 
     this->kenergy = 0;
     this->penergy = 0;
+    this->energies = false;
+
+    this->pool = new ThreadPool( 1 );
+    this->mode = BUILD_MORTON;
+    this->walk = WALK_GROUP;
+    this->group_size = 64;
+    this->leaf_size = 8;
+    this->moment_order = ORDER_MONOPOLE;
+    this->solver = SOLVER_TREE;
+    this->max_rung = 0;
+    this->eta = 0.05;
+    this->max_migrants = 0.05;
+    this->escape_radius = 0;
+    this->pair_radius = 0;
+    this->pair_gamma = 1e-4;
+    this->pairs_formed = 0;
+    this->pairs_dissolved = 0;
+    this->have_acc = false;
+    this->lists.resize( 2 );
+    this->mlists.resize( 1 );
+    set_kernel( "auto" );
 } 
     
 /**
  * destructor.
 */
 Octree::~Octree( ) {
-    delete[] this->nbody;
+    delete this->pool;
+}
+
+/**
+ * sets how many threads are used for the force pass. 
+ * 
+ * @param nthreads number of threads; 0 or less picks one per hardware thread.
+*/
+void Octree::set_threads( int nthreads ) {
+    if (nthreads <= 0)
+        nthreads = std::thread::hardware_concurrency();
+    if (nthreads == pool->size())
+        return;
+
+    delete this->pool;
+    this->pool = new ThreadPool( nthreads );
+    this->lists.resize( 2 * nthreads );
+    this->mlists.resize( nthreads );
+}
+
+/**
+ * picks how the tree gets built from now on.
+ * 
+ * @param m BUILD_INSERT (one body at a time) or BUILD_MORTON (bulk, from sorted keys)
+*/
+void Octree::set_build( build_mode m ) {
+    this->mode = m;
+}
+
+/**
+ * picks how the force pass walks the tree.
+ * 
+ * @param w WALK_BODY (one walk per body) or WALK_GROUP (one walk per group of bodies)
+ * @param ngroup max bodies that share one walk in WALK_GROUP mode
+*/
+void Octree::set_walk( walk_mode w, int ngroup ) {
+    this->walk = w;
+    this->group_size = (ngroup < 1) ? 1 : ngroup;
+}
+
+/**
+ * sets the maximum number of bodies in a leaf bucket. bigger buckets mean a shallower
+ * tree and more (cheap, vectorised) direct interactions.
+ * 
+ * @param nleaf bodies per leaf, at least 1
+*/
+void Octree::set_leaf_size( int nleaf ) {
+    this->leaf_size = (nleaf < 1) ? 1 : nleaf;
+}
+
+/**
+ * sets how many terms of each node's multipole expansion the far field uses. higher 
+ * orders cost a bit more per accepted node but are accurate at a much larger theta.
+ * 
+ * @param o ORDER_MONOPOLE, ORDER_QUADRUPOLE or ORDER_OCTUPOLE (1 is the same as 0, the dipole vanishes)
+*/
+void Octree::set_order( int o ) {
+    if (o < ORDER_QUADRUPOLE)
+        o = ORDER_MONOPOLE;
+    if (o > ORDER_OCTUPOLE)
+        o = ORDER_OCTUPOLE;
+    this->moment_order = o;
+    this->have_acc = false; // different forces from here on
+}
+
+/**
+ * picks what computes the forces: the barnes-hut walk (see set_walk, set_order), the
+ * fast multipole solver on the same tree (see fmm.h) or direct sums over every pair
+ * (see direct.h), which only keep the tree for the bookkeeping around them.
+ * 
+ * @param s SOLVER_TREE, SOLVER_FMM or SOLVER_DIRECT
+ * @param p expansion order for SOLVER_FMM
+*/
+void Octree::set_solver( solver_mode s, int p ) {
+    this->solver = s;
+    fmm.set_order( p );
+    this->have_acc = false;
+}
+
+/**
+ * switches on block (hierarchical) timesteps, see step_block.
+ * 
+ * @param rungs deepest level; the shortest step is dt / 2^rungs. 0 goes back to one global step.
+ * @param eta accuracy, the fraction by which a body's acceleration may change over one of its steps
+*/
+void Octree::set_timesteps( int rungs, scalar eta ) {
+    if (rungs < 0) rungs = 0;
+    if (rungs > 20) rungs = 20;
+    this->max_rung = rungs;
+    this->eta = eta;
+}
+
+/**
+ * sets when the tree gets rebuilt instead of refit after a drift, see update_tree.
+ * 
+ * @param migrants fraction of the bodies that may be outside their leaf before a full rebuild. 0 rebuilds every step.
+*/
+void Octree::set_refit( scalar migrants ) {
+    if (migrants < 0) migrants = 0;
+    this->max_migrants = migrants;
+}
+
+/**
+ * lets escapers leave the tree, see eject.
+ * 
+ * @param radius distance from the cluster's center of mass beyond which unbound stars leave [m]. 0 keeps everybody in.
+*/
+void Octree::set_escape( scalar radius ) {
+    if (radius < 0) radius = 0;
+    this->escape_radius = radius;
+}
+
+/**
+ * softens gravity at short distances, in the forces and the potentials alike (see
+ * softening in kernels.h), for every solver: the multipoles and the fmm's expansions
+ * are of the softened potential too (see multipole.h and fmm.h).
+ * 
+ * @param mode SOFTEN_NONE, SOFTEN_PLUMMER or SOFTEN_SPLINE
+ * @param eps softening length [m], plummer-equivalent for the spline
+*/
+void Octree::set_softening( soften_mode mode, scalar eps ) {
+    if (eps <= 0) mode = SOFTEN_NONE;
+    this->soft.mode = mode;
+    this->soft.eps = (mode == SOFTEN_NONE) ? 0 : eps;
+    this->have_acc = false;
+}
+
+/**
+ * lets tight binaries move on their own kepler orbits, see update_pairs. only for one
+ * global step (set_timesteps 0).
+ * 
+ * @param radius bound pairs with a semi-major axis below this become a kepler pair, and stop being one past twice that [m]. 0 for none.
+ * @param gamma ... as long as the tidal pull of everybody else is below this fraction of the pair's own (half that to become one)
+*/
+void Octree::set_pairs( scalar radius, scalar gamma ) {
+    if (radius < 0) radius = 0;
+    this->pair_radius = radius;
+    this->pair_gamma = gamma;
+}
+
+/**
+ * picks the force kernel used for the interaction lists, see pick_kernel.
+ * 
+ * @param name "auto", "avx512", "avx2" or "scalar"
+ * 
+ * @returns false (and keeps the current kernel) if the name is unknown.
+*/
+bool Octree::set_kernel( const char* name ) {
+    const char* picked = nullptr;
+    accel_kernel k = pick_kernel( name, &picked );
+    if (k == nullptr)
+        return false;
+
+    this->kernel = k;
+    this->kernel_name = picked;
+    this->mkernel = pick_multipole_kernel( picked );
+    this->tkernel = pick_tile_kernel( picked );
+    return true;
+}
+
+/**
+ * copies one body out of the particle arrays, for code that still wants a Body.
+ * 
+ * @param i index in the (tree ordered) particle arrays
+ * 
+ * @returns the body.
+*/
+Body Octree::get_body( int i ) const {
+    Body b( p.x[i], p.y[i], p.z[i], p.vx[i], p.vy[i], p.vz[i], p.m[i] );
+    b.acc = p.acc( i );
+    b.id = p.id[i];
+    return b;
+}
+
+/**
+ * depth of the tree, for the logs. children always come after their parent in the
+ * node arena, so one pass over it does.
+ * 
+ * @returns the level of the deepest node, 0 if there's only the root.
+*/
+int Octree::depth( ) const {
+    std::vector<int> level( nodes.size(), 0 );
+    int deepest = 0;
+    for (size_t i = 1; i < nodes.size(); i++) {
+        level[i] = level[nodes[i].parent] + 1;
+        deepest = std::max( deepest, level[i] );
+    }
+    return deepest;
 }
 
 /**
@@ -63,188 +293,1770 @@ Octree::~Octree( ) {
 void Octree::build_tree(int n, scalar *xi, scalar *yi, scalar *zi, scalar *vxi, scalar *vyi, scalar *vzi, scalar *mass) {
     
     this->n = n; // updating the number of bodies in the simulation!
-    this->nbody = new Body*[n];
+    this->ntree = n;
+    p.resize( n );
+
+    for (int i = 0; i < n; i++) {
+        p.x[i] = xi[i];   p.y[i] = yi[i];   p.z[i] = zi[i];
+        p.vx[i] = vxi[i]; p.vy[i] = vyi[i]; p.vz[i] = vzi[i];
+        p.ax[i] = 0;      p.ay[i] = 0;      p.az[i] = 0;
+        p.m[i] = mass[i] * MSUN;
+        p.id[i] = i;
+        p.rung[i] = 0;
+    }
+    this->have_acc = false;
+
+    build_nodes( ); // also gets node masses and centers of mass ready for the first force pass
+}
+
+/**
+ * replaces all bodies with new ones and builds the tree over them, for callers that
+ * keep their bodies in arrays of their own (see globr.h). the arrays are in the caller's
+ * order, which is what get_bodies and get_accelerations hand back, whatever order the
+ * tree keeps them in.
+ *
+ * @param n number of bodies
+ * @param pos positions, x y z for every body [m]
+ * @param vel velocities, x y z for every body [m/s]; NULL for all at rest
+ * @param mass masses [solar mass]
+*/
+void Octree::set_bodies( int n, const double *pos, const double *vel, const double *mass ) {
+    this->n = n;
+    this->ntree = n;
+    p.resize( n );
 
     for (int i = 0; i < n; i++) {
-        Body *b = new Body( xi[i], yi[i], zi[i], vxi[i], vyi[i], vzi[i], mass[i] * MSUN );
-        nbody[i] = b; // adding this to our list of pointers
-        root->insert( b ); // recursion in this function will take care of the rest.
+        p.x[i] = pos[3*i];  p.y[i] = pos[3*i + 1];  p.z[i] = pos[3*i + 2];
+        p.vx[i] = vel ? vel[3*i] : 0;  p.vy[i] = vel ? vel[3*i + 1] : 0;  p.vz[i] = vel ? vel[3*i + 2] : 0;
+        p.ax[i] = 0;        p.ay[i] = 0;            p.az[i] = 0;
+        p.m[i] = mass[i] * MSUN;
+        p.id[i] = i;
+        p.rung[i] = 0;
     }
+    this->pairs.clear();
+    this->have_acc = false;
+
+    build_nodes( );
 }
 
 /**
- * reconstructs the tree and rescales total simulation domain (size) if needed. 
- * rescaling occurs if a body's distance from the origin is greater than 30% of the
- * total domain.
+ * brings the masses, centers of mass and moments of all nodes up to date with the
+ * current body positions, keeping the tree as it is. bodies that drifted out of their
+ * cell stay where they are and the nodes grow to cover them (see Node::update_mass),
+ * so the forces stay right, but walks get slower as the tree loosens up; update_tree
+ * decides when it's time for a rebuild.
  * 
- * this currently only supports upscaling, downscaling has not been debugged and 
- * implemented.
+ * the subtrees of the cut (see find_cut) are fit in parallel, then the few nodes above
+ * them. every node sums up its children in the same order as in one recursive pass, so
+ * the result is the same, for any number of threads.
 */
-void Octree::rebuild_tree( ) {
-    delete root;
+void Octree::refit( ) {
+    PROFILE_SCOPE( prof, PHASE_UPWARD );
+    if (cut.slot.size() != nodes.size())
+        find_cut( );
+    if (moment_order >= ORDER_QUADRUPOLE)
+        moments.resize( nodes.size() );
+
+    pool->parallel_for( (int) cut.root.size(), 1, [&]( int begin, int end, int ) {
+        for (int s = begin; s < end; s++)
+            fit_subtree( s );
+    });
+    stats.migrants = fit_top( );
+}
 
-// >>> scaling up our simulation size if needed.
-    scalar farthest = 0; 
-    vec origin = {0, 0, 0};
-    int fidx = -1;
+/**
+ * the upward pass of one subtree of the cut, see refit.
+ * 
+ * @param s index of the subtree
+*/
+void Octree::fit_subtree( int s ) {
+    multipole *mp = (moment_order >= ORDER_QUADRUPOLE) ? moments.data() : nullptr;
+    cut.migrants[s] = nodes[cut.root[s]].update_mass( nodes.data(), p, mp, moment_order, &cut.lo[s], &cut.hi[s] );
+}
 
-    for (int i = 0; i < n; i++) {
-        if (distance(nbody[i]->pos, origin) > farthest) {
-            fidx = i;
+/**
+ * the upward pass of the nodes above the cut, once all of its subtrees are fit.
+ * 
+ * @returns the number of bodies outside their leaf's cell, in the whole tree.
+*/
+int Octree::fit_top( ) {
+    multipole *mp = (moment_order >= ORDER_QUADRUPOLE) ? moments.data() : nullptr;
+    return nodes[0].update_mass( nodes.data(), p, mp, moment_order, nullptr, nullptr, &cut );
+}
+
+/**
+ * cuts the tree into the subtrees that the upward pass (refit) and the tasks of a
+ * step (step_graph) work on: the topmost nodes with at most ntree / 256 bodies (but no
+ * fewer than a walk group, so every group is inside one), or leaf buckets bigger than
+ * that, in body order. a few hundred pieces of about the same size, whatever the
+ * number of threads.
+*/
+void Octree::find_cut( ) {
+    int most = std::max( ntree / 256, group_size );
+
+    cut.slot.assign( nodes.size(), -1 );
+    cut.root.clear();
+    for (int i = 0; i < (int) nodes.size(); i++) {
+        const Node &nd = nodes[i];
+        if (nd.count == 0)
+            continue;
+        bool small = nd.count <= most || !nd.is_internal();
+        bool parent_small = nd.parent >= 0 && nodes[nd.parent].count <= most;
+        if (small && !parent_small)
+            cut.root.push_back( i );
+    }
+    std::sort( cut.root.begin(), cut.root.end(), [&]( int a, int b ) { return nodes[a].first < nodes[b].first; } );
+
+    for (size_t s = 0; s < cut.root.size(); s++)
+        cut.slot[cut.root[s]] = (int) s;
+    cut.migrants.assign( cut.root.size(), 0 );
+    cut.lo.resize( cut.root.size() );
+    cut.hi.resize( cut.root.size() );
+}
+
+/**
+ * fills the (cleared) node arena from the current body positions with whichever build
+ * mode is selected, then runs the upward mass pass. the domain is fit to the bodies
+ * first, see fit_domain.
+*/
+void Octree::build_nodes( ) {
+    {
+        PROFILE_SCOPE( prof, PHASE_BUILD );
+        fit_domain( );
+
+        this->nodes.clear();
+        this->nodes.push_back( Node( this->corner, this->tsize ) );
+
+        if (mode == BUILD_MORTON) {
+            build_morton( );
+        } else {
+            build_insert( );
         }
+        find_cut( );
     }
 
-    scalar max_coord = fabs(nbody[fidx]->pos.x);
-    if (fabs(nbody[fidx]->pos.y) > max_coord) max_coord = fabs(nbody[fidx]->pos.y);
-    if (fabs(nbody[fidx]->pos.z) > max_coord) max_coord = fabs(nbody[fidx]->pos.z);
-    
-    // debugging remnant, dynamic resizing
-    // std::cout << this->tsize << ", "<< max_coord << ", " << max_coord/(tsize/2) << "\n";
+    refit( );
+
+    PROFILE_SCOPE( prof, PHASE_BUILD );
+    find_groups( );
+}
 
-// >>> updating and rebuilding our tree!
+/**
+ * picks the groups for the group walk: the topmost nodes with at most group_size bodies
+ * (or leaves, if a bucket is bigger), in body order, and which of them are in which
+ * subtree of the cut (see find_cut).
+*/
+void Octree::find_groups( ) {
+    groups.clear();
+    for (int i = 0; i < (int) nodes.size(); i++) {
+        const Node &nd = nodes[i];
+        if (nd.count == 0)
+            continue;
+        bool small = nd.count <= group_size || !nd.is_internal();
+        bool parent_small = nd.parent >= 0 && nodes[nd.parent].count <= group_size;
+        if (small && !parent_small)
+            groups.push_back( i );
+    }
+    std::sort( groups.begin(), groups.end(), [&]( int a, int b ) { return nodes[a].first < nodes[b].first; } );
 
-    // resizing if needed
-    if (max_coord > (tsize/2) * .3 ) {          // if our max coordinate is more than 30% of our simulation size
-        this->tsize = max_coord * 20;           // makes the system 10^3 times larger
-        this->corner =  { -this->tsize/2, -this->tsize/2, this->tsize/2};
+    cut_groups.assign( cut.root.size() + 1, 0 );
+    size_t g = 0;
+    for (size_t s = 0; s < cut.root.size(); s++) {
+        const Node &c = nodes[cut.root[s]];
+        cut_groups[s] = (int) g;
+        for (; g < groups.size() && nodes[groups[g]].first < c.first + c.count; g++) {
+            const Node &grp = nodes[groups[g]];
+            if (grp.first + grp.count > c.first + c.count) { // bigger than the cut's pieces
+                cut_groups.clear();
+                return;
+            }
+        }
     }
-    // todo: fix dynamic rescaling when making simulation domain smaller, segfaulting
-    // else if ( max_coord < (tsize/2) * .10) {    // if our max coordinate is less than 15% of our simulation size
-    //     this->tsize /= 10;            // makes the system 10^3 times smaller
-    //     this->corner =  { -this->tsize/2, -this->tsize/2, this->tsize/2};
-    // }
+    cut_groups.back() = (int) g;
+}
+
+/**
+ * bulk tree build from morton keys.
+ * 
+ * 1. every body gets a 63-bit morton key inside the root cell (in parallel),
+ * 2. the keys are radix sorted (in parallel, see sort_keys),
+ * 3. the bodies are shuffled into key order, so bodies that are close in space are 
+ *    close in memory and neighbouring force walks touch the same data,
+ * 4. the tree is carved out of the sorted array: every node owns one contiguous run 
+ *    of keys, and its children are the sub-runs that share the next 3 key bits. with
+ *    more than one thread only the top is carved here; the subtrees under it (about 8
+ *    to 64 per thread) are carved in parallel, each into its own arena, and stitched
+ *    back in (see stitch), so the tree comes out node for node the same as on one.
+ * 
+ * no node ever has to be searched for, so there's none of the branchy walk from the 
+ * root that insert does for every body.
+*/
+void Octree::build_morton( ) {
+    if (ntree == 0) return;
 
-    // creates a new root
-    this->root = new Node( this->corner, this->tsize );
+    keys.resize( ntree );
+    order.resize( ntree );
 
-    // rebuilds the tree itself with the existing list of bodies.
-    for (int i = 0; i < n; i++) {
-        root->insert( this->nbody[i] ); // recursion in this function will take care of the rest.
+    vec c = this->corner;
+    scalar dx = this->tsize;
+
+    pool->parallel_for( ntree, 1024, [&]( int begin, int end, int ) {
+        for (int i = begin; i < end; i++) {
+            keys[i] = morton_key( p.pos( i ), c, dx );
+            order[i] = i;
+        }
+    });
+
+    sort_keys( keys, order, kbuf, obuf, pool );
+
+    order.resize( n );
+    for (int i = ntree; i < n; i++) // escapers stay where they are
+        order[i] = i;
+    p.permute( order, pbuf, pool ); // z-order shuffle
+
+    if (pool->size() == 1) {
+        carve( nodes, 0, 0, 0, ntree, 0 );
+        return;
+    }
+
+    // the top of the tree on this thread, the pieces below it on all of them
+    pieces.clear();
+    carve( nodes, 0, 0, 0, ntree, std::max( ntree / (8 * pool->size()), 8 * leaf_size ) );
+
+    int npiece = (int) pieces.size();
+    if ((int) arenas.size() < npiece)
+        arenas.resize( npiece );
+    pool->parallel_for( npiece, 1, [&]( int begin, int end, int ) {
+        for (int k = begin; k < end; k++) {
+            std::vector<Node> &arena = arenas[k];
+            const Node &root = nodes[pieces[k].root];
+            arena.clear();
+            arena.push_back( Node( root.corner, root.dx ) );
+            carve( arena, 0, pieces[k].level, root.first, root.first + root.count, 0 );
+        }
+    });
+
+    stitch( );
+}
+
+/**
+ * puts the pieces of a parallel carve (see build_morton) back into the tree, in the
+ * order one serial carve would have made the nodes in: depth first, so every piece's
+ * nodes go right behind its root. the nodes of the top of the tree only move back to
+ * make room, the pieces are copied in parallel; every node ends up exactly as in a
+ * serial build.
+*/
+void Octree::stitch( ) {
+    int ntop = (int) nodes.size();
+    int npiece = (int) pieces.size();
+
+    // new index of every node of the top, and where every piece's root ends up
+    remap.resize( ntop );
+    std::vector<int> base( npiece );
+    int next = 0, k = 0;
+    for (int t = 0; t < ntop; t++) {
+        remap[t] = next++;
+        if (k < npiece && pieces[k].root == t) { // pieces are found in the same depth first order
+            base[k] = remap[t];
+            next += (int) arenas[k].size() - 1;
+            k++;
+        }
+    }
+
+    nbuf.resize( next, nodes[0] );
+    for (int t = 0; t < ntop; t++) {
+        Node nd = nodes[t];
+        if (nd.parent >= 0)
+            nd.parent = remap[nd.parent];
+        for (int q = 0; q < 8; q++)
+            if (nd.children[q] >= 0)
+                nd.children[q] = remap[nd.children[q]];
+        nbuf[remap[t]] = nd;
     }
+
+    pool->parallel_for( npiece, 1, [&]( int begin, int end, int ) {
+        for (int k = begin; k < end; k++) {
+            const std::vector<Node> &arena = arenas[k];
+            int b = base[k];
+            for (int q = 0; q < 8; q++)
+                nbuf[b].children[q] = (arena[0].children[q] >= 0) ? b + arena[0].children[q] : -1;
+            nbuf[b].nchildren = arena[0].nchildren;
+
+            for (int j = 1; j < (int) arena.size(); j++) {
+                Node nd = arena[j];
+                nd.parent += b;
+                for (int q = 0; q < 8; q++)
+                    if (nd.children[q] >= 0)
+                        nd.children[q] += b;
+                nbuf[b + j] = nd;
+            }
+        }
+    });
+
+    nodes.swap( nbuf );
 }
 
 /**
- * handles high-level force computations for all bodies in the tree and updates
- * positions, velocities, and accelerations through leapfrog integration. 
+ * turns a run of sorted keys into the subtree under node idx. runs of up to leaf_size
+ * bodies become a leaf bucket, and so does anything left at the deepest level (bodies 
+ * that share a whole key, i.e. the same 2^-21 cell).
  * 
- * also calculates system energies (buggy) for basic diagnostics.
+ * with split set, runs of at most that many bodies that still need a subtree are left
+ * as they are and noted down in pieces, for build_morton to carve in parallel.
  * 
- * @param theta threshold criteria for barnes-hut, ratio of node width to distance to center of mass.
- * @param dt timestep [s]
+ * @param arena node array the subtree goes into
+ * @param idx node that owns the run
+ * @param level depth of the node, 0 for the root
+ * @param begin first body of the run
+ * @param end one past the last body of the run
+ * @param split largest run that's left for later, 0 to carve everything
 */
-void Octree::compute_forces( scalar theta, scalar dt ) {
+void Octree::carve( std::vector<Node> &arena, int idx, int level, int begin, int end, int split ) {
 
-    // zeroing out our accelerations so they *don't* sum
-    for (int i = 0; i < n; i++)
-        nbody[i]->acc = {0,0,0};
+    arena[idx].first = begin;
+    arena[idx].count = end - begin;
 
-    // force calculation, barnes-hut inside here!
-    for (int i = 0; i < n; i++) 
-        root->get_force( nbody[i], theta);
+    if (end - begin <= leaf_size || level == MORTON_BITS)
+        return;
 
-// >>> leapfrog integration here...
+    if (end - begin <= split) {
+        pieces.push_back( { idx, level } );
+        return;
+    }
 
-    // kick
-    for (int i = 0; i < n; i++)
-        nbody[i]->vel += nbody[i]->acc * 0.5 * dt;
-    // drift
-    for (int i = 0; i < n; i++)
-        nbody[i]->pos += nbody[i]->vel * dt;
+    int shift = 3 * (MORTON_BITS - 1 - level);
+    int i = begin;
 
-// >>> rebuilding our tree with updated postions
-    rebuild_tree();
+    while (i < end) {
+        int d = (int) ((keys[i] >> shift) & 7);
+        int j = i + 1;
+        while (j < end && (int) ((keys[j] >> shift) & 7) == d) j++;
 
-    // kick, again
-    kenergy = 0.0; // zeroing our previous kinetic
-    for (int i = 0; i < n; i++) {
-        nbody[i]->vel += nbody[i]->acc * 0.5 * dt;
-        kenergy += 0.5 * nbody[i]->mass * nbody[i]->vel.norm(); // sneaking in a quick kinetic energy calculation
+        int child = make_child( arena, idx, morton_octant( d ) );
+        carve( arena, child, level + 1, i, j, split );
+        i = j;
     }
+}
 
-    // todo: fix softening term here, should be on the scale of 0.01 pc for globular clusters.
-    penergy = 0.0; // zeroing our previous potential
-    for (int i = 0; i < n; i++) {
-        for (int j = i + 1; j < n; j++) {
-            if ( distance(nbody[i]->pos, nbody[j]->pos) > 1 * AU) // softening term, not sure if this is enough
-                penergy += G * nbody[i]->mass * nbody[j]->mass / distance(nbody[i]->pos, nbody[j]->pos);
+/**
+ * one-at-a-time tree build. every body is inserted from the root; while that happens a
+ * leaf keeps its bucket as a linked list through next[]. afterwards the tree is walked 
+ * in morton order to hand every node its contiguous range, and the bodies are shuffled 
+ * to match, so the result looks exactly like a morton build to the rest of the code.
+*/
+void Octree::build_insert( ) {
+    next.resize( ntree );
+
+    for (int i = 0; i < ntree; i++)
+        insert( i );
+
+    order.resize( n );
+    place( 0, 0 );
+    for (int i = ntree; i < n; i++) // escapers stay where they are
+        order[i] = i;
+    p.permute( order, pbuf, pool );
+}
+
+/**
+ * inserts a particle (body) into the tree, walking down from the root. a full leaf is
+ * split by handing its bucket down to new children, until the body finds a leaf with
+ * room (or the tree is MORTON_BITS deep, where buckets just keep growing).
+ * 
+ * psuedocode taken from Thomas Trost's lecture slides [here](https://www.tp1.ruhr-uni-bochum.de/~grauer/lectures/compI_IIWS1819/pdfs/lec10.pdf)
+ * 
+ * note: new nodes are appended to this->nodes, which can move the whole array, so we 
+ * only ever hold on to node indices here, never references.
+ * 
+ * @param b index of the body to be added to the tree.
+*/
+void Octree::insert( int b ) {
+    int idx = 0;
+    int level = 0;
+
+    while (true) {
+
+        if ( !nodes[idx].is_internal() ) {
+
+            if ( nodes[idx].count < leaf_size || level == MORTON_BITS ) {
+                // leaf with room, the body lives here now
+                next[b] = nodes[idx].first;
+                nodes[idx].first = b;
+                nodes[idx].count++;
+                return;
+            }
+
+            // full leaf: moving its bucket one level down into new subdivisions
+            int j = nodes[idx].first;
+            nodes[idx].first = -1;
+
+            while (j >= 0) {
+                int jnext = next[j];
+                int c = make_child( nodes, idx, get_quadrant( nodes[idx].dx, nodes[idx].corner, p.pos( j ) ) );
+                next[j] = nodes[c].first;
+                nodes[c].first = j;
+                nodes[c].count++;
+                j = jnext;
+            }
+        }
+
+        nodes[idx].count++;
+        idx = make_child( nodes, idx, get_quadrant( nodes[idx].dx, nodes[idx].corner, p.pos( b ) ) );
+        level++;
+    }
+}
+
+/**
+ * hands out particle ranges after an insert build, visiting children in morton order.
+ * 
+ * @param idx node to place
+ * @param pos first free slot in the new body order
+ * 
+ * @returns the first free slot after this node's bodies.
+*/
+int Octree::place( int idx, int pos ) {
+    int start = pos;
+
+    if ( !nodes[idx].is_internal() ) {
+        for (int j = nodes[idx].first; j >= 0; j = next[j])
+            order[pos++] = j;
+    } else {
+        for (int d = 0; d < 8; d++) {
+            int c = nodes[idx].children[morton_octant( d )];
+            if (c >= 0)
+                pos = place( c, pos );
         }
     }
 
+    nodes[idx].first = start;
+    nodes[idx].count = pos - start;
+    return pos;
 }
 
 /**
- * Prints basic information about every particle in a system. 
- * Only good for VERY small systems, don't use unless debugging.
+ * returns the child of a node in octant q, appending a new empty node to the arena 
+ * if there isn't one there yet.
  * 
- * @param step integer timestep of the simulation
- */ 
-void Octree::print_bodies( int step) {
+ * @param arena node array of the parent (the tree's nodes, or a piece's, see build_morton)
+ * @param parent index of the parent node
+ * @param q octant of the child, see get_quadrant
+ * 
+ * @returns the index of the child node.
+*/
+int Octree::make_child( std::vector<Node> &arena, int parent, int q ) {
+    if ( arena[parent].children[q] >= 0 )
+        return arena[parent].children[q];
 
-    std::cout << "timestep ::\t" << step << "\n";
+    vec cnew = get_new_corner( q, arena[parent].corner, arena[parent].dx );
+    scalar dxnew = arena[parent].dx / 2;
 
-    for (int i = 0; i < n; i++ ) {
-        std::cout << i << "\t" << nbody[i]->pos.x << "\t" << nbody[i]->pos.y << "\t" << nbody[i]->pos.z << "\n";
+    int c = (int) arena.size();
+    arena.push_back( Node( cnew, dxnew, parent ) ); // no allocation once the arena has grown to its working size
+    arena[parent].children[q] = c;
+    arena[parent].nchildren++;
+
+    return c;
+}
+
+/**
+ * fits the simulation domain to the bodies in the tree: a cube around their bounding
+ * box with a little room to spare, so the bodies can drift a while before one of them
+ * is out (see update_tree). the domain follows the cluster wherever it goes and shrinks
+ * as well as grows, so the tree is never much bigger than what's in it.
+*/
+void Octree::fit_domain( ) {
+    if (ntree == 0) return;
+
+    int nt = pool->size();
+    std::vector<vec> lo( nt, p.pos( 0 ) ), hi( nt, p.pos( 0 ) );
+
+    pool->parallel_for( ntree, 4096, [&]( int begin, int end, int tid ) {
+        vec l = lo[tid], h = hi[tid];
+        for (int i = begin; i < end; i++) {
+            if (p.x[i] < l.x) l.x = p.x[i];
+            if (p.y[i] < l.y) l.y = p.y[i];
+            if (p.z[i] < l.z) l.z = p.z[i];
+            if (p.x[i] > h.x) h.x = p.x[i];
+            if (p.y[i] > h.y) h.y = p.y[i];
+            if (p.z[i] > h.z) h.z = p.z[i];
+        }
+        lo[tid] = l;
+        hi[tid] = h;
+    });
+
+    vec l = lo[0], h = hi[0];
+    for (int t = 1; t < nt; t++) {
+        l = { std::fmin( l.x, lo[t].x ), std::fmin( l.y, lo[t].y ), std::fmin( l.z, lo[t].z ) };
+        h = { std::fmax( h.x, hi[t].x ), std::fmax( h.y, hi[t].y ), std::fmax( h.z, hi[t].z ) };
     }
 
+    scalar extent = std::fmax( h.x - l.x, std::fmax( h.y - l.y, h.z - l.z ) );
+    if (extent > 0)
+        this->tsize = extent * 1.25; // 12.5% to spare on every side
+    // else: everybody in one spot, keep the old size
+
+    vec mid = (l + h) * (scalar) 0.5;
+    this->corner = { mid.x - tsize/2, mid.y - tsize/2, mid.z - tsize/2 };
 }
 
 /**
- * handles data output for the entire simulation and makes sure our .dat files 
- * are formatted to be pretty and machine readable.
+ * takes escapers out of the tree: stars further than escape_radius from the cluster's
+ * center that are moving away from it faster than its escape speed (the whole tree's
+ * mass as a point mass). one far away star would otherwise stretch the domain and push the whole
+ * cluster down into the deepest levels of the tree.
  * 
- * all files have the naming convention globr_{run}_0000000.dat.
+ * escapers are moved behind the tree bodies in the particle arrays and aren't built into
+ * the tree again. they keep moving in the field of the cluster as a point mass (see
+ * escaper_forces) and still show up in every output, but they don't pull on the cluster
+ * or on each other any more.
  * 
- * @param step integer timestep
- * @param step_time physical time of timestep [s]
- * @param theta threshold criterion
- * @param run name of simulation run, for file naming
+ * starts from the mass and center of mass of the tree's root, which have to be those of
+ * the current positions (see update_tree). the tree has to be rebuilt afterwards if
+ * anybody left.
+ * 
+ * @returns true if any star was taken out.
 */
-void Octree::save_step( int step, scalar step_time, scalar theta, const char *run) {
+bool Octree::eject( ) {
+    double mass = nodes[0].mass;
+    vec com = nodes[0].com;
+    double r2esc = (double) escape_radius * escape_radius;
 
-    // we should check that our directory we want to make exists, if not we create it...
-    char dname[50];
-    char fname[100];
-    sprintf(dname, "%s/%s", DATPATH, run);
-    sprintf(fname, "%s/%s/globr_%s_%07d.dat", DATPATH, run, run, step);
+    // mostly nobody is even that far out
+    double r2 = 0;
+    for (int i = 0; i < ntree; i++) {
+        double dx = p.x[i] - com.x, dy = p.y[i] - com.y, dz = p.z[i] - com.z;
+        r2 = std::fmax( r2, dx*dx + dy*dy + dz*dz );
+    }
+    if (r2 <= r2esc || mass <= 0)
+        return false;
 
-    int status = mkdir(DATPATH, 0777);
-    
-    if (status <= 0 && errno != ENOENT) {
-        status = mkdir(dname, 0777);
-
-        if (status <= 0 && errno != ENOENT) {
-            FILE *fout = fopen( fname, "w"); // new file to write to
-
-            if ( fout != NULL ) { // checking that our file was made correctly
-
-                // way too much work to get the time of our file's writing....
-                time_t current_time;
-                time(&current_time);
-                struct tm * timeinfo;
-                timeinfo = localtime(&current_time);
-                char tstring[100];
-                strftime( tstring, sizeof(char) * 100, "%X, %e %h %g", timeinfo);
-
-                // a little header
-                fprintf( fout, "# >>> globr_%s_%07d.dat. file written at %s.\n", run, step, tstring);
-                // i should add something here that tells us initial conditions, perhaps.
-                fprintf( fout, "# >>> timestep                  : %-15d\n", step);
-                fprintf( fout, "# >>> particles                 : %-15d\n", n);
-                fprintf( fout, "# >>> theta                     : %-15.3f\n", theta );
-                fprintf( fout, "# >>> simulation time   [yr]    : %-15.3e\n", step_time/YR);
-                fprintf( fout, "# >>> simulation size   [pc]    : %-15.3e\n", tsize/PC);
-                fprintf( fout, "# >>> kinetic energy    [J]     : %-15.3e\n", kenergy);
-                fprintf( fout, "# >>> potential energy  [J]     : %-15.3e\n", penergy);
-                fprintf( fout, "\n# >>> -------------------------------------------------------------------------------------------\n");
-                fprintf( fout, "%-8s  %18s  %18s  %18s  %18s\n\n", "pID", "mass [msun]", "x [m]", "y [m]", "z [m]");
-                // now onto the actual data!
-                for (int i = 0; i < n; i++) {
-                    fprintf(fout, "%-8d  %18.3f  %18.5e  %18.5e  %18.5e\n", i, nbody[i]->mass / MSUN, nbody[i]->pos.x, nbody[i]->pos.y, nbody[i]->pos.z);
-                }
+    // center of the cluster and its velocity, from shrinking spheres around the center
+    // of mass, so a few stars far out can't drag it off the cluster
+    double cx = com.x, cy = com.y, cz = com.z;
+    double vx = 0, vy = 0, vz = 0;
+    do {
+        r2 = std::fmax( 0.25 * r2, r2esc );
+
+        double m = 0, mx = 0, my = 0, mz = 0, mvx = 0, mvy = 0, mvz = 0;
+        for (int i = 0; i < ntree; i++) {
+            double dx = p.x[i] - cx, dy = p.y[i] - cy, dz = p.z[i] - cz;
+            if (dx*dx + dy*dy + dz*dz > r2)
+                continue;
+            m += p.m[i];
+            mx += p.m[i] * (double) p.x[i]; my += p.m[i] * (double) p.y[i]; mz += p.m[i] * (double) p.z[i];
+            mvx += p.m[i] * (double) p.vx[i]; mvy += p.m[i] * (double) p.vy[i]; mvz += p.m[i] * (double) p.vz[i];
+        }
+        if (m == 0)
+            break;
+        cx = mx / m; cy = my / m; cz = mz / m;
+        vx = mvx / m; vy = mvy / m; vz = mvz / m;
+    } while (r2 > r2esc);
+
+    // escapers go behind everybody staying, in front of the older escapers
+    std::vector<int> stay, leave;
+    for (int i = 0; i < ntree; i++) {
+        double dx = p.x[i] - cx, dy = p.y[i] - cy, dz = p.z[i] - cz;
+        double ux = p.vx[i] - vx, uy = p.vy[i] - vy, uz = p.vz[i] - vz;
+        double r = std::sqrt( dx*dx + dy*dy + dz*dz );
+
+        bool out = r > escape_radius && dx*ux + dy*uy + dz*uz > 0 && 0.5 * (ux*ux + uy*uy + uz*uz) > G * mass / r;
+        (out ? leave : stay).push_back( i );
+    }
+
+    if (leave.empty() || stay.empty())
+        return false;
+
+    order.resize( n );
+    std::copy( stay.begin(), stay.end(), order.begin() );
+    std::copy( leave.begin(), leave.end(), order.begin() + stay.size() );
+    for (int i = ntree; i < n; i++)
+        order[i] = i;
+    p.permute( order, pbuf, pool );
+
+    this->ntree = (int) stay.size();
+    stats.ejected += (int) leave.size();
+    return true;
+}
+
+/**
+ * accelerations and/or potentials of the escapers: the whole cluster (the tree's root)
+ * as a point mass.
+ * 
+ * @param forces fill in p.ax, p.ay, p.az
+ * @param potential fill in p.pot
+ * @param mask optional, one flag per body, nonzero for the bodies to do
+*/
+void Octree::escaper_forces( bool forces, bool potential, const char *mask ) {
+    const Node &root = nodes[0];
+
+    for (int i = ntree; i < n; i++) {
+        if (mask && !mask[i])
+            continue;
+
+        double dx = root.com.x - p.x[i], dy = root.com.y - p.y[i], dz = root.com.z - p.z[i];
+        double r = std::sqrt( dx*dx + dy*dy + dz*dz );
+        double gm = G * root.mass;
+
+        if (forces) {
+            double f = gm / (r * r * r);
+            p.ax[i] = f * dx;
+            p.ay[i] = f * dy;
+            p.az[i] = f * dz;
+        }
+        if (potential)
+            p.pot[i] = -gm / r;
+    }
+}
+
+/**
+ * keeps the list of kepler pairs up to date, at the start of every (global) step:
+ * 
+ * - a pair is broken up once its members are more than 2 pair_radius apart, or when
+ *   the tidal pull of everybody else gets above pair_gamma of the pull between them
+ *   (see perturbation); on a kepler orbit it would only feel the cluster as one body.
+ * - two bodies in the same leaf bucket become a pair if they're bound, their orbit's
+ *   semi-major axis is below pair_radius, and they're undisturbed enough (below half
+ *   of pair_gamma, so a pair doesn't flicker in and out).
+ * 
+ * bodies close to each other but in neighbouring leaves are missed until they share
+ * one. neither change moves a leaf's mass or center of mass, but the tree is refit if
+ * anything changed, and the carried over accelerations are dropped (the pair's own pull
+ * on its bodies comes or goes), so the step starts with a fresh force pass.
+*/
+void Octree::update_pairs( ) {
+    where.resize( n );
+    for (int i = 0; i < n; i++)
+        where[p.id[i]] = i;
+    paired.assign( n, 0 );
+
+    bool changed = false;
+    size_t kept = 0;
+    for (size_t k = 0; k < pairs.size(); k++) {
+        const kepler_pair &kp = pairs[k];
+        int ia = where[kp.a], ib = where[kp.b];
+        double r = std::sqrt( kp.r[0]*kp.r[0] + kp.r[1]*kp.r[1] + kp.r[2]*kp.r[2] );
+
+        if (r < 2 * (double) pair_radius && perturbation( p.pos( ia ), ia, ib, r, kp.ma + kp.mb ) < pair_gamma) {
+            paired[kp.a] = paired[kp.b] = 1;
+            pairs[kept++] = kp;
+        } else {
+            unpack( kp, ia, ib );
+            pairs_dissolved++;
+            changed = true;
+        }
+    }
+    pairs.resize( kept );
+
+    for (const Node &leaf : nodes) {
+        if (leaf.is_internal() || leaf.count < 2)
+            continue;
+
+        for (int i = leaf.first; i < leaf.first + leaf.count; i++) {
+            if (paired[p.id[i]] || p.m[i] == 0)
+                continue;
+
+            for (int j = i + 1; j < leaf.first + leaf.count; j++) {
+                if (paired[p.id[j]] || p.m[j] == 0)
+                    continue;
 
-                fclose( fout );
+                double dx = p.x[j] - p.x[i], dy = p.y[j] - p.y[i], dz = p.z[j] - p.z[i];
+                double r = std::sqrt( dx*dx + dy*dy + dz*dz );
+                if (r >= pair_radius || r == 0)
+                    continue;
+
+                double ux = p.vx[j] - p.vx[i], uy = p.vy[j] - p.vy[i], uz = p.vz[j] - p.vz[i];
+                double m = (double) p.m[i] + p.m[j];
+                double alpha = 2 / r - (ux*ux + uy*uy + uz*uz) / (G * m); // 1 / semi-major axis
+                if (alpha * pair_radius <= 1)
+                    continue;
+
+                vec c = p.pos( i ) + (p.pos( j ) - p.pos( i )) * (scalar) (p.m[j] / m);
+                if (perturbation( c, i, j, r, m ) >= 0.5 * pair_gamma)
+                    continue;
+
+                pack( i, j );
+                paired[p.id[i]] = paired[p.id[j]] = 1;
+                pairs_formed++;
+                changed = true;
+                break;
             }
         }
     }
 
-}
\ No newline at end of file
+    if (changed) {
+        refit( );
+        have_acc = false;
+    }
+}
+
+/**
+ * turns bodies i and j into a kepler pair: the relative orbit goes into the pair list,
+ * i becomes the center of mass with both masses, j a massless copy of it.
+ * 
+ * @param i first member, index in the particle arrays
+ * @param j second member
+*/
+void Octree::pack( int i, int j ) {
+    kepler_pair k;
+    k.a = p.id[i];
+    k.b = p.id[j];
+    k.ma = p.m[i];
+    k.mb = p.m[j];
+    k.r[0] = (double) p.x[j] - p.x[i];   k.r[1] = (double) p.y[j] - p.y[i];   k.r[2] = (double) p.z[j] - p.z[i];
+    k.v[0] = (double) p.vx[j] - p.vx[i]; k.v[1] = (double) p.vy[j] - p.vy[i]; k.v[2] = (double) p.vz[j] - p.vz[i];
+    pairs.push_back( k );
+
+    double m = k.ma + k.mb, fa = k.ma / m, fb = k.mb / m;
+    p.x[i] = fa * p.x[i] + fb * p.x[j];    p.y[i] = fa * p.y[i] + fb * p.y[j];    p.z[i] = fa * p.z[i] + fb * p.z[j];
+    p.vx[i] = fa * p.vx[i] + fb * p.vx[j]; p.vy[i] = fa * p.vy[i] + fb * p.vy[j]; p.vz[i] = fa * p.vz[i] + fb * p.vz[j];
+    p.m[i] = m;
+
+    p.x[j] = p.x[i];   p.y[j] = p.y[i];   p.z[j] = p.z[i];
+    p.vx[j] = p.vx[i]; p.vy[j] = p.vy[i]; p.vz[j] = p.vz[i];
+    p.m[j] = 0;
+}
+
+/**
+ * puts the members of a kepler pair back into the particle arrays as two bodies.
+ * 
+ * @param k the pair
+ * @param ia index of its first member (the center of mass)
+ * @param ib index of its second member
+*/
+void Octree::unpack( const kepler_pair &k, int ia, int ib ) {
+    double m = k.ma + k.mb, fa = k.ma / m, fb = k.mb / m;
+    double x[3] = { p.x[ia], p.y[ia], p.z[ia] }, v[3] = { p.vx[ia], p.vy[ia], p.vz[ia] };
+
+    p.x[ia] = x[0] - fb * k.r[0];  p.y[ia] = x[1] - fb * k.r[1];  p.z[ia] = x[2] - fb * k.r[2];
+    p.vx[ia] = v[0] - fb * k.v[0]; p.vy[ia] = v[1] - fb * k.v[1]; p.vz[ia] = v[2] - fb * k.v[2];
+    p.x[ib] = x[0] + fa * k.r[0];  p.y[ib] = x[1] + fa * k.r[1];  p.z[ib] = x[2] + fa * k.r[2];
+    p.vx[ib] = v[0] + fa * k.v[0]; p.vy[ib] = v[1] + fa * k.v[1]; p.vz[ib] = v[2] + fa * k.v[2];
+    p.m[ia] = k.ma;
+    p.m[ib] = k.mb;
+}
+
+/**
+ * how much everybody else disturbs a pair: the tidal pull over the pair's separation,
+ * 2 m r^3 / (M d^3) for a perturber of mass m at distance d, summed with a quick walk
+ * of the tree (nodes more than twice their size away count as one). the members
+ * themselves don't count.
+ * 
+ * @param c center of the pair [m]
+ * @param ia index of one member
+ * @param ib index of the other
+ * @param r separation of the members [m]
+ * @param m mass of the pair [kg]
+ * 
+ * @returns the tidal pull as a fraction of the pull between the members.
+*/
+double Octree::perturbation( vec c, int ia, int ib, double r, double m ) const {
+    double gamma = 0;
+    double scale = 2 * r * r * r / m;
+
+    int stack[8 * (MORTON_BITS + 2)];
+    int top = 0;
+    stack[top++] = 0;
+
+    while (top > 0) {
+        const Node &nd = nodes[stack[--top]];
+        if (nd.mass == 0)
+            continue;
+
+        double dx = nd.com.x - c.x, dy = nd.com.y - c.y, dz = nd.com.z - c.z;
+        double d2 = dx*dx + dy*dy + dz*dz;
+
+        if (!nd.owns( ia ) && !nd.owns( ib ) && (double) nd.size * nd.size < 0.25 * d2) {
+            gamma += scale * nd.mass / (d2 * std::sqrt( d2 ));
+        } else if (nd.is_internal()) {
+            for (int q = 0; q < 8; q++)
+                if (nd.children[q] >= 0) stack[top++] = nd.children[q];
+        } else {
+            for (int j = nd.first; j < nd.first + nd.count; j++) {
+                if (j == ia || j == ib || p.m[j] == 0)
+                    continue;
+                dx = p.x[j] - c.x; dy = p.y[j] - c.y; dz = p.z[j] - c.z;
+                d2 = dx*dx + dy*dy + dz*dz;
+                if (d2 == 0)
+                    return HUGE_VAL;
+                gamma += scale * p.m[j] / (d2 * std::sqrt( d2 ));
+            }
+        }
+    }
+
+    return gamma;
+}
+
+/**
+ * moves every kepler pair along its orbit by dt, after the drift moved its center of
+ * mass, and puts the massless second member back on top of the first.
+ * 
+ * @param dt timestep [s]
+*/
+void Octree::drift_pairs( double dt ) {
+    pool->parallel_for( (int) pairs.size(), 64, [&]( int begin, int end, int ) {
+        drift_pair_range( begin, end, dt );
+    });
+}
+
+/**
+ * drift_pairs for the pairs [begin, end), on the calling thread.
+ * 
+ * @param begin first pair
+ * @param end one past the last pair
+ * @param dt timestep [s]
+*/
+void Octree::drift_pair_range( int begin, int end, double dt ) {
+    for (int k = begin; k < end; k++) {
+        kepler_pair &kp = pairs[k];
+        kepler_drift( G * (kp.ma + kp.mb), kp.r, kp.v, dt );
+
+        int ia = where[kp.a], ib = where[kp.b];
+        p.x[ib] = p.x[ia];   p.y[ib] = p.y[ia];   p.z[ib] = p.z[ia];
+        p.vx[ib] = p.vx[ia]; p.vy[ib] = p.vy[ia]; p.vz[ib] = p.vz[ia];
+    }
+}
+
+/**
+ * reconstructs the tree from scratch, in a domain fit to the bodies (see fit_domain).
+ * 
+ * the node arena is cleared and refilled in place; its capacity is kept, so after the 
+ * first few steps a rebuild doesn't allocate at all.
+*/
+void Octree::rebuild_tree( ) {
+    // creates a new root, reusing the old arena, and rebuilds the tree with the existing list of bodies.
+    build_nodes( );
+    stats.rebuilds++;
+}
+
+/**
+ * gets the tree ready for the next force pass after the bodies drifted. stars only move
+ * a small part of a cell per step, so mostly the tree is just refit in place (see refit),
+ * which is much cheaper than a rebuild. the tree is rebuilt from scratch when
+ * 
+ * - a body left the domain,
+ * - stars escaped and were taken out of the tree (see eject),
+ * - more than max_migrants of the bodies are outside their leaf's cell, so the
+ *   loosened up nodes start to cost more in the walk than a rebuild does,
+ * - refitting is off (max_migrants 0).
+ * 
+ * a refit keeps every leaf's bodies and the tree's depth as they were, so the bodies
+ * that left their leaf are the one thing that gets worse. stats counts which way it went.
+ * 
+ * @param refitted the nodes are already refit to the current positions (see step_graph)
+*/
+void Octree::update_tree( bool refitted ) {
+    if (max_migrants > 0 && !refitted) {
+        refit( );
+    } else if (max_migrants == 0 && escape_radius > 0) {
+        // no refit, but eject starts from the root's mass and center of mass, which have
+        // to be those of the drifted bodies, not of the last build
+        double m = 0, mx = 0, my = 0, mz = 0;
+        for (int i = 0; i < ntree; i++) {
+            m += p.m[i];
+            mx += p.m[i] * (double) p.x[i]; my += p.m[i] * (double) p.y[i]; mz += p.m[i] * (double) p.z[i];
+        }
+        nodes[0].mass = m;
+        if (m > 0)
+            nodes[0].com = { (scalar) (mx / m), (scalar) (my / m), (scalar) (mz / m) };
+    }
+
+    if (escape_radius > 0 && eject( )) {
+        stats.escaped++;
+    } else if (max_migrants > 0) {
+        bool outside = nodes[0].size > nodes[0].dx; // the root only grows if somebody left the domain
+        if (!outside && stats.migrants <= max_migrants * ntree) {
+            stats.refits++;
+            return;
+        }
+        if (outside)
+            stats.grown++;
+        else
+            stats.migrated++;
+    }
+
+    build_nodes( );
+    stats.rebuilds++;
+}
+
+/**
+ * walks the tree for every body (or group of bodies, see WALK_GROUP) and fills in the 
+ * accelerations and/or the potentials of all bodies.
+ * 
+ * the tree walk is spread over the thread pool. every body's result is computed by 
+ * exactly one thread with the same serial walk, so the results are bit-identical for 
+ * any thread count. the walk only gathers interaction lists; the sums over them are 
+ * done by the (simd) kernel picked in set_kernel.
+ * 
+ * with WALK_GROUP there is one walk per group (a small subtree of up to group_size 
+ * bodies) instead of one per body, and the group's lists are reused for all of its 
+ * bodies (see Node::get_force_group).
+ * 
+ * with SOLVER_FMM all of this is handed to the fmm solver instead (see fmm.h), and with
+ * SOLVER_DIRECT to the direct sums (see direct.h).
+ * 
+ * above monopole order the accepted nodes go into a third list instead, together with 
+ * their quadrupole (and octupole) moments, and get their own kernel (see multipole.h).
+ * 
+ * with a mask only the bodies flagged in it get new results, everybody else keeps
+ * theirs; groups without any of them aren't walked at all (block timesteps, see step_block).
+ * 
+ * escapers aren't in the tree and only feel the cluster as a whole, see escaper_forces.
+ * 
+ * the number of interactions summed goes into walked (the tree walk only).
+ * 
+ * @param theta threshold criteria for barnes-hut, ratio of node width to distance to center of mass.
+ * @param forces fill in p.ax, p.ay, p.az
+ * @param potential fill in p.pot
+ * @param mask optional, one flag per body (tree order), nonzero for the bodies to do
+*/
+void Octree::walk_tree( scalar theta, bool forces, bool potential, const char *mask ) {
+
+    PROFILE_SCOPE( prof, PHASE_WALK );
+    PROFILE_ONLY( prof.walks++; )
+
+    escaper_forces( forces, potential, mask );
+    walked = walk_stats();
+
+    if (solver == SOLVER_FMM) {
+        fmm.compute( nodes, p, pool, theta, kernel, soft, forces, potential, mask );
+        return;
+    }
+    if (solver == SOLVER_DIRECT) {
+        direct.compute( p, ntree, pool, kernel, tkernel, soft, forces, potential, mask );
+        return;
+    }
+
+    start_walk( );
+
+    // barnes-hut inside here! each thread only writes the results of its own bodies.
+    if (walk == WALK_GROUP) {
+        pool->parallel_for( (int) groups.size(), 2, [&]( int begin, int end, int tid ) {
+            walk_range( begin, end, tid, theta, forces, potential, mask );
+        });
+    } else {
+        pool->parallel_for( ntree, 16, [&]( int begin, int end, int tid ) {
+            walk_range( begin, end, tid, theta, forces, potential, mask );
+        });
+    }
+
+    finish_walk( );
+}
+
+/** gets the per-thread lists and tallies ready for a tree walk, see walk_range */
+void Octree::start_walk( ) {
+    tallies.assign( pool->size(), walk_stats() );
+    for (size_t t = 0; t < mlists.size(); t++) {
+        mlists[t].base = moments.data();
+        mlists[t].order = moment_order;
+        mlists[t].near = soft.h();
+    }
+}
+
+/** adds up the per-thread tallies of a tree walk into walked */
+void Octree::finish_walk( ) {
+    for (const walk_stats &w : tallies)
+        walked.add( w );
+    PROFILE_ONLY( prof.opened += walked.opened; prof.pp += walked.pp; prof.pc += walked.pc; )
+}
+
+/**
+ * the tree walk of walk_tree for part of the bodies, on the calling thread: the groups
+ * [begin, end) with WALK_GROUP, the bodies [begin, end) with WALK_BODY. start_walk
+ * has to come first, finish_walk once all parts are done.
+ * 
+ * @param begin first group or body
+ * @param end one past the last group or body
+ * @param tid index of the calling thread in the pool, for its lists and tallies
+ * @param theta threshold criteria for barnes-hut, ratio of node width to distance to center of mass.
+ * @param forces fill in p.ax, p.ay, p.az
+ * @param potential fill in p.pot
+ * @param mask optional, one flag per body (tree order), nonzero for the bodies to do
+*/
+void Octree::walk_range( int begin, int end, int tid, scalar theta, bool forces, bool potential, const char *mask ) {
+    ilist &pp = lists[2*tid];
+    ilist &pc = lists[2*tid + 1];
+    mlist &pm = mlists[tid];
+    bool multi = moment_order >= ORDER_QUADRUPOLE;
+    walk_stats w;
+    PROFILE_ONLY( profile_openings = 0; )
+
+    // what every body does with its finished lists
+    auto apply = [&]( int i ) {
+        if (forces) {
+            vec acc = kernel( p.x[i], p.y[i], p.z[i], pp, soft ) + kernel( p.x[i], p.y[i], p.z[i], pc, soft );
+            if (multi)
+                acc = acc + mkernel( p.x[i], p.y[i], p.z[i], pm, soft );
+            p.ax[i] = acc.x;
+            p.ay[i] = acc.y;
+            p.az[i] = acc.z;
+        }
+        if (potential) {
+            double phi = -( potential_sum( p.x[i], p.y[i], p.z[i], pp, soft ) + potential_sum( p.x[i], p.y[i], p.z[i], pc, soft ) );
+            if (multi)
+                phi += potential_multipole( p.x[i], p.y[i], p.z[i], pm, soft );
+            p.pot[i] = phi;
+        }
+        p.cost[i] = (float) (pp.count + pc.count + pm.count);
+        w.bodies++;
+        w.pp += pp.count;
+        w.pc += pc.count + pm.count;
+    };
+
+    if (walk == WALK_GROUP) {
+        for (int g = begin; g < end; g++) {
+            const Node &group = nodes[groups[g]];
+            int lo = group.first, hi = group.first + group.count;
+
+            // box around the bodies of the group that need results
+            int first = lo;
+            if (mask)
+                while (first < hi && !mask[first]) first++;
+            if (first == hi)
+                continue;
+
+            vec bmin = p.pos( first ), bmax = p.pos( first );
+            for (int i = first + 1; i < hi; i++) {
+                if (mask && !mask[i]) continue;
+                bmin = { std::fmin( bmin.x, p.x[i] ), std::fmin( bmin.y, p.y[i] ), std::fmin( bmin.z, p.z[i] ) };
+                bmax = { std::fmax( bmax.x, p.x[i] ), std::fmax( bmax.y, p.y[i] ), std::fmax( bmax.z, p.z[i] ) };
+            }
+
+            // lists measured from the middle of the group, see ilist
+            vec mid = (bmin + bmax) * (scalar) 0.5;
+            pp.clear( mid );
+            pc.clear( mid );
+            pm.clear( mid );
+            nodes[0].get_force_group( nodes.data(), p, group, bmin, bmax, theta, pp, pc, multi ? &pm : nullptr );
+
+            for (int i = first; i < hi; i++) {
+                if (mask && !mask[i])
+                    continue;
+                apply( i );
+            }
+        }
+    } else {
+        for (int i = begin; i < end; i++) {
+            if (mask && !mask[i])
+                continue;
+            pp.clear( p.pos( i ) );
+            pc.clear( p.pos( i ) );
+            pm.clear( p.pos( i ) );
+            nodes[0].get_force( nodes.data(), p, i, theta, pp, pc, multi ? &pm : nullptr );
+            apply( i );
+        }
+    }
+
+    PROFILE_ONLY( w.opened = profile_openings; )
+    tallies[tid].add( w );
+}
+
+/**
+ * advances all bodies by dt with kick-drift-kick leapfrog: half kick with the
+ * accelerations at the start of the step, drift, tree update, one force pass at the new
+ * positions and the closing half kick with those. the end-of-step accelerations carry
+ * over as the next step's opening kick, so there's exactly one force pass per step (two
+ * on the first, or after anything else moved the bodies, see have_acc).
+ * 
+ * the opening kick and the drift are one pass over the bodies (kick_drift), and so are
+ * the closing kick and the energy sums if energy is set: the potentials then come from
+ * the same walk as the forces, instead of a walk of their own in compute_energy.
+ * 
+ * with the tree walk as the solver, the step runs as a graph of tasks over the tree's
+ * subtrees, so its stages overlap, see step_graph. the snapshot is filled in as part
+ * of it (every subtree as soon as it's done), otherwise it's a pass of its own at the
+ * end.
+ * 
+ * with block timesteps on (set_timesteps) the step is cut up further, see step_block.
+ * 
+ * kepler pairs (set_pairs) are updated first and drift on their own orbits, see update_pairs.
+ * 
+ * @param theta threshold criteria for barnes-hut, ratio of node width to distance to center of mass.
+ * @param dt timestep [s]
+ * @param energy also sum up kenergy and penergy at the end of the step
+ * @param out optional, filled with the bodies at the end of the step, header aside
+ *            (see save_step)
+*/
+void Octree::compute_forces( scalar theta, scalar dt, bool energy, snapshot *out ) {
+
+    if (max_rung > 0) {
+        step_block( theta, dt );
+        if (energy)
+            compute_energy( theta );
+    } else {
+        if (pair_radius > 0)
+            update_pairs( );
+
+        if (!have_acc)
+            walk_tree( theta, true, false );
+
+        if (solver == SOLVER_TREE) {
+            step_graph( theta, dt, energy, out );
+            return;
+        }
+
+// >>> leapfrog integration here...
+        scalar hdt = 0.5 * dt;
+
+        kick_drift( hdt, dt );
+
+// >>> refitting or rebuilding our tree with updated postions
+        update_tree();
+
+        walk_tree( theta, true, energy );
+        have_acc = true;
+
+        kick( hdt, energy ); // again
+    }
+
+    if (out) {
+        PROFILE_SCOPE( prof, PHASE_OUTPUT );
+        out->resize( n );
+        copy_snapshot( *out, 0, n );
+    }
+}
+
+/**
+ * the global step of compute_forces as two graphs of tasks (see TaskGraph), so that its
+ * stages overlap instead of each one waiting for the whole of the last. the cut (see
+ * find_cut) splits the bodies into a few hundred subtrees, and every subtree gets its
+ * own chain of tasks:
+ * 
+ *   opening kick and drift -> upward pass            (then the nodes above the cut)
+ *   walk -> closing kick and energy sums -> copy into the snapshot
+ * 
+ * a subtree is refit as soon as its own bodies have drifted, and kicked and copied out
+ * as soon as its own walk is done. the walks can't start any earlier than the end of
+ * the upward pass: every one of them starts at the root. in between, update_tree
+ * decides whether the refit tree will do, and rebuilds it if not. the escapers are one
+ * more chain of their own; kepler pairs drift in one task after all of the drifts.
+ * 
+ * every body goes through the same arithmetic as in the plain step, and the energies
+ * are summed per subtree and then in order, so the results don't depend on the number
+ * of threads or the order the tasks happen to run in.
+ * 
+ * @param theta threshold criteria for barnes-hut, ratio of node width to distance to center of mass.
+ * @param dt timestep [s]
+ * @param energy also sum up kenergy and penergy at the end of the step
+ * @param out optional, filled with the bodies at the end of the step, header aside
+*/
+void Octree::step_graph( scalar theta, scalar dt, bool energy, snapshot *out ) {
+    scalar hdt = 0.5 * dt;
+    bool fit = max_migrants > 0; // no refit, no point fitting the old tree
+    if (fit && moment_order >= ORDER_QUADRUPOLE)
+        moments.resize( nodes.size() );
+
+    // opening kicks, drifts and the upward pass
+    int ncut = (int) cut.root.size();
+    graph.clear();
+    std::vector<int> drifted( ncut + 1 );
+    for (int s = 0; s <= ncut; s++) {
+        int begin = (s < ncut) ? nodes[cut.root[s]].first : ntree;
+        int end = (s < ncut) ? begin + nodes[cut.root[s]].count : n;
+        drifted[s] = graph.add( PHASE_DRIFT, [this, begin, end, hdt, dt]( int ) { kick_drift_range( begin, end, hdt, dt ); } );
+    }
+
+    int paired = -1;
+    if (!pairs.empty()) {
+        paired = graph.add( PHASE_DRIFT, [this, dt]( int ) { drift_pair_range( 0, (int) pairs.size(), dt ); } );
+        for (int d : drifted)
+            graph.after( paired, d );
+    }
+
+    if (fit) {
+        int top = graph.add( PHASE_UPWARD, [this]( int ) { stats.migrants = fit_top( ); } );
+        for (int s = 0; s < ncut; s++) {
+            int up = graph.add( PHASE_UPWARD, [this, s]( int ) { fit_subtree( s ); } );
+            graph.after( up, (paired >= 0) ? paired : drifted[s] );
+            graph.after( top, up );
+        }
+    }
+
+    run_graph( );
+    update_tree( fit );
+
+    // forces, closing kicks and the copies into the snapshot, on the tree as it is now
+    ncut = (int) cut.root.size();
+    bool split = walk == WALK_BODY || (int) cut_groups.size() == ncut + 1;
+    if (split) {
+        PROFILE_ONLY( prof.walks++; )
+        walked = walk_stats();
+        start_walk( );
+    } else {
+        walk_tree( theta, true, energy ); // groups bigger than the cut, the walk can't go by subtree
+    }
+    if (out)
+        out->resize( n );
+
+    sums.assign( 2 * (ncut + 1), 0.0 );
+    graph.clear();
+    for (int s = 0; s <= ncut; s++) {
+        int begin = (s < ncut) ? nodes[cut.root[s]].first : ntree;
+        int end = (s < ncut) ? begin + nodes[cut.root[s]].count : n;
+
+        int walked_task = -1;
+        if (split) {
+            walked_task = graph.add( PHASE_WALK, [this, s, ncut, begin, end, theta, energy]( int tid ) {
+                if (s == ncut)
+                    escaper_forces( true, energy, nullptr );
+                else if (walk == WALK_GROUP)
+                    walk_range( cut_groups[s], cut_groups[s + 1], tid, theta, true, energy, nullptr );
+                else
+                    walk_range( begin, end, tid, theta, true, energy, nullptr );
+            });
+        }
+
+        int kicked = graph.add( PHASE_KICK, [this, s, begin, end, hdt, energy]( int ) {
+            kick_range( begin, end, hdt, energy ? &sums[2 * s] : nullptr );
+        });
+        if (walked_task >= 0)
+            graph.after( kicked, walked_task );
+
+        if (out) {
+            int copied = graph.add( PHASE_OUTPUT, [this, out, begin, end]( int ) { copy_snapshot( *out, begin, end ); } );
+            graph.after( copied, kicked );
+        }
+    }
+
+    run_graph( );
+    if (split)
+        finish_walk( );
+    have_acc = true;
+    if (energy)
+        sum_energies( );
+}
+
+/** runs graph on the pool, and books the time its tasks took under their phases */
+void Octree::run_graph( ) {
+    pool->run_graph( graph );
+    PROFILE_ONLY(
+        int nt = pool->size();
+        for (int k = 0; k < NPHASES && k < (int) graph.busy.size(); k++) {
+            prof.busy[k] += graph.busy[k];
+            prof.time[k] += graph.busy[k] / nt;
+        }
+        prof.span += graph.span;
+        prof.threads = nt;
+    )
+}
+
+/**
+ * changes every body's velocity by its acceleration times dt.
+ * 
+ * with energy set the same pass sums up the kinetic energy (after the kick) and the
+ * potential energy (from p.pot, which has to be fresh) into kenergy and penergy, kepler
+ * pairs included. the bodies are summed in fixed tiles that are added up in order, so
+ * the sums don't depend on the number of threads.
+ * 
+ * @param dt length of the kick [s]
+ * @param energy also sum up the energies
+*/
+void Octree::kick( scalar dt, bool energy ) {
+    PROFILE_SCOPE( prof, PHASE_KICK );
+    const int tile = 4096;
+    const int ntile = (n + tile - 1) / tile;
+    sums.assign( energy ? 2 * ntile : 0, 0.0 );
+
+    pool->parallel_for( ntile, 1, [&]( int tbegin, int tend, int ) {
+        for (int t = tbegin; t < tend; t++)
+            kick_range( t * tile, std::min( n, (t + 1) * tile ), dt, energy ? &sums[2 * t] : nullptr );
+    });
+
+    if (energy)
+        sum_energies( );
+}
+
+/**
+ * kick for the bodies [begin, end), on the calling thread.
+ * 
+ * @param begin first body
+ * @param end one past the last body
+ * @param dt length of the kick [s]
+ * @param energy optional, the kinetic and potential energy of the bodies (after the
+ *               kick) get added to energy[0] and energy[1]
+*/
+void Octree::kick_range( int begin, int end, scalar dt, double *energy ) {
+    double ke = 0, pe = 0;
+    for (int i = begin; i < end; i++) {
+        p.vx[i] += p.ax[i] * dt;
+        p.vy[i] += p.ay[i] * dt;
+        p.vz[i] += p.az[i] * dt;
+        if (energy) {
+            double v2 = (double) p.vx[i] * p.vx[i] + (double) p.vy[i] * p.vy[i] + (double) p.vz[i] * p.vz[i];
+            ke += 0.5 * p.m[i] * v2;
+            pe += (i < ntree ? 0.5 : 1.0) * p.m[i] * (double) p.pot[i]; // every pair in the tree shows up twice
+        }
+    }
+    if (energy) {
+        energy[0] += ke;
+        energy[1] += pe;
+    }
+}
+
+/**
+ * adds up the partial energy sums in sums (kinetic and potential, one pair per piece,
+ * see kick_range), in order, plus the orbits inside the kepler pairs.
+*/
+void Octree::sum_energies( ) {
+    kenergy = 0.0;
+    penergy = 0.0;
+    for (size_t t = 0; t + 1 < sums.size(); t += 2) {
+        kenergy += sums[t];
+        penergy += sums[t + 1];
+    }
+    for (const kepler_pair &k : pairs) { // the orbits inside kepler pairs, split up as the bodies are
+        double r = std::sqrt( k.r[0]*k.r[0] + k.r[1]*k.r[1] + k.r[2]*k.r[2] );
+        double v2 = k.v[0]*k.v[0] + k.v[1]*k.v[1] + k.v[2]*k.v[2];
+        kenergy += 0.5 * k.ma * k.mb / (k.ma + k.mb) * v2;
+        penergy -= G * k.ma * k.mb / r;
+    }
+
+    energies = true;
+}
+
+/**
+ * the opening half of a leapfrog step in one pass over the bodies: kick by kdt, then
+ * drift by ddt with the new velocity (and the kepler pairs along their orbits, see
+ * drift_pairs). same as kick( kdt ) and drift( ddt ), with the particle arrays streamed
+ * through once instead of twice.
+ * 
+ * @param kdt length of the kick [s]
+ * @param ddt length of the drift [s]
+*/
+void Octree::kick_drift( scalar kdt, scalar ddt ) {
+    PROFILE_SCOPE( prof, PHASE_DRIFT );
+    pool->parallel_for( n, 4096, [&]( int begin, int end, int ) {
+        kick_drift_range( begin, end, kdt, ddt );
+    });
+
+    drift_pairs( ddt );
+}
+
+/**
+ * kick_drift for the bodies [begin, end), on the calling thread, without the pairs.
+ * 
+ * @param begin first body
+ * @param end one past the last body
+ * @param kdt length of the kick [s]
+ * @param ddt length of the drift [s]
+*/
+void Octree::kick_drift_range( int begin, int end, scalar kdt, scalar ddt ) {
+    for (int i = begin; i < end; i++) {
+        p.vx[i] += p.ax[i] * kdt;
+        p.vy[i] += p.ay[i] * kdt;
+        p.vz[i] += p.az[i] * kdt;
+        p.x[i] += p.vx[i] * ddt;
+        p.y[i] += p.vy[i] * ddt;
+        p.z[i] += p.vz[i] * ddt;
+    }
+}
+
+/**
+ * moves every body along with its velocity for dt, and the kepler pairs along their
+ * orbits (see drift_pairs). the tree isn't touched, see update_tree.
+ * 
+ * @param dt length of the drift [s]
+*/
+void Octree::drift( scalar dt ) {
+    PROFILE_SCOPE( prof, PHASE_DRIFT );
+    pool->parallel_for( n, 4096, [&]( int begin, int end, int ) {
+        for (int i = begin; i < end; i++) {
+            p.x[i] += p.vx[i] * dt;
+            p.y[i] += p.vy[i] * dt;
+            p.z[i] += p.vz[i] * dt;
+        }
+    });
+
+    drift_pairs( dt );
+}
+
+/**
+ * advances all bodies by dt with block (hierarchical) timesteps: kick-drift-kick
+ * leapfrog where every body steps with dt / 2^rung of its own.
+ * 
+ * dt is cut into 2^max_rung ticks. a body on rung r starts and ends its steps every
+ * 2^(max_rung - r) ticks, so at any tick the bodies whose steps end there (the active
+ * ones) get new forces, their closing half kick, a new rung and the opening half kick
+ * of their next step; everybody drifts. only active bodies get forces, so a substep
+ * costs about as much as its active bodies, not N. between the big steps the tree is
+ * only refit to the drifted positions; a rebuild can only come at the end of dt (see
+ * update_tree), when every body is active anyway.
+ * 
+ * the rung comes from how fast a body's acceleration changed over its last step: the
+ * new step is the one over which it changes by a fraction eta. bodies can go to a
+ * shorter step at the end of any of their steps, to a longer one only at ticks where
+ * that longer step would end. accelerations carry over from step to step, so every
+ * body gets exactly one force evaluation per step of its own.
+ * 
+ * @param theta threshold criteria for barnes-hut, ratio of node width to distance to center of mass.
+ * @param dt timestep [s], the longest step any body takes
+*/
+void Octree::step_block( scalar theta, scalar dt ) {
+    const long ticks = 1L << max_rung;
+    const double tick_dt = (double) dt / ticks;
+
+    active.resize( n );
+    oax.resize( n ); oay.resize( n ); oaz.resize( n );
+
+    if (!have_acc) {
+        walk_tree( theta, true, false );
+        have_acc = true;
+    }
+
+    // everybody starts a step at tick 0: opening half kicks
+    {
+        PROFILE_SCOPE( prof, PHASE_KICK );
+        pool->parallel_for( n, 4096, [&]( int begin, int end, int ) {
+            for (int i = begin; i < end; i++) {
+                scalar hdt = (scalar) (0.5 * tick_dt * (ticks >> p.rung[i]));
+                p.vx[i] += p.ax[i] * hdt;
+                p.vy[i] += p.ay[i] * hdt;
+                p.vz[i] += p.az[i] * hdt;
+            }
+        });
+    }
+
+    long tick = 0;
+    while (tick < ticks) {
+
+        // the next tick where anybody's step ends is set by the deepest rung in use
+        int top = 0;
+        for (int i = 0; i < n; i++)
+            if (p.rung[i] > top) top = p.rung[i];
+        long span = ticks >> top;
+        long next = (tick / span + 1) * span;
+
+        // drift, everybody
+        drift( (scalar) (tick_dt * (next - tick)) );
+        tick = next;
+
+        if (tick == ticks) {
+            update_tree();
+        } else {
+            refit();
+            stats.refits++;
+        }
+
+        // new forces for the bodies whose steps end now
+        pool->parallel_for( n, 4096, [&]( int begin, int end, int ) {
+            for (int i = begin; i < end; i++) {
+                active[i] = tick % (ticks >> p.rung[i]) == 0;
+                oax[i] = p.ax[i]; oay[i] = p.ay[i]; oaz[i] = p.az[i];
+            }
+        });
+
+        walk_tree( theta, true, false, active.data() );
+
+        // closing half kick, new rung, opening half kick of the next step
+        PROFILE_SCOPE( prof, PHASE_KICK );
+        pool->parallel_for( n, 4096, [&]( int begin, int end, int ) {
+            for (int i = begin; i < end; i++) {
+                if (!active[i])
+                    continue;
+
+                int r = p.rung[i];
+                double step = tick_dt * (ticks >> r);
+
+                double dax = p.ax[i] - oax[i], day = p.ay[i] - oay[i], daz = p.az[i] - oaz[i];
+                double da = std::sqrt( dax*dax + day*day + daz*daz );
+                double a = std::sqrt( (double) p.ax[i]*p.ax[i] + (double) p.ay[i]*p.ay[i] + (double) p.az[i]*p.az[i] );
+                double ao = std::sqrt( (double) oax[i]*oax[i] + (double) oay[i]*oay[i] + (double) oaz[i]*oaz[i] );
+
+                int want = 0;
+                if (da > 0) {
+                    double ideal = eta * step * std::fmax( a, ao ) / da;
+                    while (want < max_rung && tick_dt * (ticks >> want) > ideal)
+                        want++;
+                }
+
+                int nr = r;
+                if (want > r) {
+                    nr = want;
+                } else {
+                    // longer steps only where they line up with the tick grid
+                    while (nr > want && (tick % (ticks >> (nr - 1))) == 0)
+                        nr--;
+                }
+                p.rung[i] = nr;
+
+                scalar kick = (scalar) (0.5 * step);
+                if (tick < ticks)
+                    kick += (scalar) (0.5 * tick_dt * (ticks >> nr));
+
+                p.vx[i] += p.ax[i] * kick;
+                p.vy[i] += p.ay[i] * kick;
+                p.vz[i] += p.az[i] * kick;
+            }
+        });
+    }
+}
+
+/**
+ * calculates the total kinetic and potential energy of the system for diagnostics.
+ * 
+ * the potential of every body comes from the same tree walk as the forces (same theta, 
+ * same opening test), so this is O(N log N) instead of the old O(N^2) pair loop. it costs
+ * about one extra force pass, so call it only on the steps that actually get written out,
+ * or better have compute_forces sum them up at the end of the step.
+ * 
+ * @param theta threshold criteria for barnes-hut, ratio of node width to distance to center of mass.
+*/
+void Octree::compute_energy( scalar theta ) {
+
+    walk_tree( theta, false, true );
+    kick( 0, true ); // no kick, only the sums
+}
+
+/**
+ * direct sums, in double, of the accelerations of a sample of the bodies in the tree:
+ * every (ntree / nsample)-th one. the reference for force_errors; the bodies are
+ * identified by id, so the tree can be rebuilt (or the solver changed) in between.
+ * 
+ * @param nsample number of bodies to sample, at most ntree
+ * @param ref filled with the sample
+*/
+void Octree::direct_reference( int nsample, force_reference &ref ) {
+    direct.reference( p, ntree, pool, soft, nsample, ref );
+}
+
+/**
+ * relative errors of the current accelerations (from the last walk_tree) against a
+ * direct sum, |a - a_ref| / |a_ref|, for every body in the reference.
+ * 
+ * @param ref reference, see direct_reference
+ * 
+ * @returns the errors, in the order of the reference's sample.
+*/
+std::vector<double> Octree::force_errors( const force_reference &ref ) const {
+    std::vector<int> index( n );
+    for (int i = 0; i < n; i++)
+        index[p.id[i]] = i;
+
+    std::vector<double> err( ref.id.size() );
+    for (size_t s = 0; s < ref.id.size(); s++) {
+        int i = index[ref.id[s]];
+        const double *a = &ref.acc[3*s];
+        double ex = p.ax[i] - a[0], ey = p.ay[i] - a[1], ez = p.az[i] - a[2];
+        err[s] = std::sqrt( (ex*ex + ey*ey + ez*ez) / (a[0]*a[0] + a[1]*a[1] + a[2]*a[2]) );
+    }
+    return err;
+}
+
+/**
+ * copies the positions and velocities of all bodies out, in the order they were
+ * handed to set_bodies (or build_tree). kepler pairs come out as their two bodies.
+ *
+ * @param pos filled with x y z for every body [m]; NULL to skip
+ * @param vel filled with x y z for every body [m/s]; NULL to skip
+*/
+void Octree::get_bodies( double *pos, double *vel ) const {
+    for (int i = 0; i < n; i++) {
+        int k = p.id[i];
+        if (pos) { pos[3*k] = p.x[i];  pos[3*k + 1] = p.y[i];  pos[3*k + 2] = p.z[i]; }
+        if (vel) { vel[3*k] = p.vx[i]; vel[3*k + 1] = p.vy[i]; vel[3*k + 2] = p.vz[i]; }
+    }
+
+    // pairs sit at their center of mass a, see make_snapshot
+    for (const kepler_pair &k : pairs) {
+        double fa = k.ma / (k.ma + k.mb), fb = k.mb / (k.ma + k.mb);
+        for (int d = 0; d < 3; d++) {
+            if (pos) { double x = pos[3*k.a + d]; pos[3*k.a + d] = x - fb * k.r[d]; pos[3*k.b + d] = x + fa * k.r[d]; }
+            if (vel) { double v = vel[3*k.a + d]; vel[3*k.a + d] = v - fb * k.v[d]; vel[3*k.b + d] = v + fa * k.v[d]; }
+        }
+    }
+}
+
+/**
+ * copies the results of the last walk_tree out, in the order the bodies were handed to
+ * set_bodies (or build_tree). both bodies of a kepler pair get the pair's (they sit
+ * at its center of mass, see pack).
+ *
+ * @param acc filled with x y z for every body [m/s^2]
+ * @param pot filled with the potential at every body [J/kg], if the walk did those; NULL to skip
+*/
+void Octree::get_accelerations( double *acc, double *pot ) const {
+    for (int i = 0; i < n; i++) {
+        int k = p.id[i];
+        acc[3*k] = p.ax[i];  acc[3*k + 1] = p.ay[i];  acc[3*k + 2] = p.az[i];
+        if (pot) pot[k] = p.pot[i];
+    }
+}
+
+/**
+ * Prints basic information about every particle in a system. 
+ * Only good for VERY small systems, don't use unless debugging.
+ * 
+ * @param step integer timestep of the simulation
+ */ 
+void Octree::print_bodies( int step) {
+
+    std::cout << "timestep ::\t" << step << "\n";
+
+    for (int i = 0; i < n; i++ ) {
+        std::cout << p.id[i] << "\t" << p.x[i] << "\t" << p.y[i] << "\t" << p.z[i] << "\n";
+    }
+
+}
+
+/**
+ * writes the full state of the bodies, the tree and the domain to a checkpoint
+ * (atomically, see write_checkpoint). the caller fills in the step, time and settings
+ * of the run.
+ * 
+ * the tree goes in as it is, refits and all, so load_checkpoint ends up with exactly
+ * the same tree and body order as the run had, whichever build mode made it.
+ *
+ * @param fname checkpoint file
+ * @param h header with the run's step, time and settings
+ *
+ * @returns false if the checkpoint couldn't be written.
+*/
+bool Octree::save_checkpoint( const char *fname, const checkpoint_header &h ) const {
+    checkpoint_header head = h;
+    head.ntree = ntree;
+    head.tsize = tsize;
+    head.corner[0] = corner.x;
+    head.corner[1] = corner.y;
+    head.corner[2] = corner.z;
+
+    return write_checkpoint( fname, head, p, nodes, pairs );
+}
+
+/**
+ * picks a run back up from a checkpoint: bodies, domain and tree, refit to the saved
+ * positions (which the tree was already fit to, so nothing changes but the moments get
+ * filled in). set the leaf, group and multipole settings before this, and set_pairs and
+ * set_timesteps: saved kepler pairs are unpacked if this run can't keep them. the force
+ * settings (softening, solver, kernel) too, the saved accelerations are only used if
+ * they match the checkpoint's (its eps is in AU, as the command line gives it).
+ *
+ * @param fname checkpoint file
+ * @param h filled with the header, for the step, time and settings
+ *
+ * @returns false (after saying why) if the checkpoint can't be used.
+*/
+bool Octree::load_checkpoint( const char *fname, checkpoint_header &h ) {
+    if (!read_checkpoint( fname, h, p, nodes, pairs ))
+        return false;
+
+    this->n = h.n;
+    this->ntree = h.ntree;
+    this->tsize = h.tsize;
+    this->corner = { (scalar) h.corner[0], (scalar) h.corner[1], (scalar) h.corner[2] };
+    this->energies = false;
+
+    // the saved accelerations are at the saved positions, so the next step opens with
+    // them, unless they're of other forces than this run's (softening, multipole order,
+    // solver or kernel changed on the command line)
+    int order = h.multipole < ORDER_QUADRUPOLE ? ORDER_MONOPOLE : std::min( h.multipole, (int) ORDER_OCTUPOLE );
+    bool same_soft = h.soften == soft.mode && (soft.mode == SOFTEN_NONE || (scalar) (h.eps * AU) == soft.eps);
+    bool same_solver = h.solver == solver && (solver != SOLVER_FMM || std::max( 1, std::min( h.fmm_order, 8 ) ) == fmm.order);
+    this->have_acc = same_soft && same_solver && order == moment_order
+                     && std::strncmp( h.kernel, kernel_name, CHECKPOINT_KERNEL ) == 0;
+
+    // a run that doesn't keep kepler pairs (no set_pairs, or block timesteps) gets them
+    // back as two bodies each, with their own pull on each other from the first step on
+    if (!pairs.empty() && (pair_radius == 0 || max_rung > 0)) {
+        where.resize( n );
+        for (int i = 0; i < n; i++)
+            where[p.id[i]] = i;
+        for (const kepler_pair &kp : pairs)
+            unpack( kp, where[kp.a], where[kp.b] );
+        pairs.clear();
+        this->have_acc = false;
+    }
+
+    refit( );
+    find_groups( );
+    return true;
+}
+
+/**
+ * copies the current state into a snapshot, bodies back in initial conditions order
+ * (they get shuffled in memory by every rebuild).
+ *
+ * @param step integer timestep
+ * @param step_time physical time of timestep [s]
+ * @param theta threshold criterion
+ * @param s snapshot to fill, resized to n bodies
+*/
+void Octree::make_snapshot( int step, scalar step_time, scalar theta, snapshot &s ) const {
+    s.resize( n );
+    copy_snapshot( s, 0, n );
+    finish_snapshot( step, step_time, theta, s );
+}
+
+/**
+ * copies the bodies [begin, end) (tree order) into a snapshot, each to its place in
+ * initial conditions order. pieces that don't overlap can be copied at the same time.
+ *
+ * @param s snapshot, already resized to n bodies
+ * @param begin first body
+ * @param end one past the last body
+*/
+void Octree::copy_snapshot( snapshot &s, int begin, int end ) const {
+    const scalar *src[NFIELDS] = { p.m.data(), p.x.data(), p.y.data(), p.z.data(),
+                                   p.vx.data(), p.vy.data(), p.vz.data() };
+
+    for (int f = 0; f < NFIELDS; f++) {
+        float *dst = s.field( f );
+        for (int i = begin; i < end; i++)
+            dst[p.id[i]] = src[f][i];
+    }
+}
+
+/**
+ * the rest of make_snapshot, once all bodies are copied in: the kepler pairs split
+ * back up, and the header.
+ *
+ * @param step integer timestep
+ * @param step_time physical time of timestep [s]
+ * @param theta threshold criterion
+ * @param s snapshot with all bodies copied in
+*/
+void Octree::finish_snapshot( int step, scalar step_time, scalar theta, snapshot &s ) const {
+    s.head.step = step;
+    s.head.time = step_time;
+    s.head.theta = theta;
+    s.head.size = tsize;
+    s.head.energies = energies ? 1 : 0;
+    s.head.kenergy = energies ? kenergy : 0;
+    s.head.penergy = energies ? penergy : 0;
+
+    // kepler pairs back as two bodies, around the center of mass in a
+    float *m = s.field( FIELD_M );
+    float *pos[3] = { s.field( FIELD_X ), s.field( FIELD_Y ), s.field( FIELD_Z ) };
+    float *vel[3] = { s.field( FIELD_VX ), s.field( FIELD_VY ), s.field( FIELD_VZ ) };
+    for (const kepler_pair &k : pairs) {
+        double fa = k.ma / (k.ma + k.mb), fb = k.mb / (k.ma + k.mb);
+        for (int d = 0; d < 3; d++) {
+            double x = pos[d][k.a], v = vel[d][k.a];
+            pos[d][k.a] = x - fb * k.r[d]; pos[d][k.b] = x + fa * k.r[d];
+            vel[d][k.a] = v - fb * k.v[d]; vel[d][k.b] = v + fa * k.v[d];
+        }
+        m[k.a] = k.ma;
+        m[k.b] = k.mb;
+    }
+}
+
+/**
+ * hands the current state to the snapshot writer, which puts it on disk in the
+ * background (see SnapshotWriter). only waits if the writer is still busy with the
+ * last two outputs.
+ * 
+ * all files have the naming convention globr_{run}_0000000.snap (binary, see snapshot.h)
+ * or globr_{run}_0000000.dat (text).
+ * 
+ * @param step integer timestep
+ * @param step_time physical time of timestep [s]
+ * @param theta threshold criterion
+ * @param out writer for this run
+ * @param filled the bodies are already in out's buffer, copied in by the step itself
+ *               (see compute_forces); only the header and the pairs are left
+*/
+void Octree::save_step( int step, scalar step_time, scalar theta, SnapshotWriter &out, bool filled ) {
+    PROFILE_SCOPE( prof, PHASE_OUTPUT );
+    if (filled)
+        finish_snapshot( step, step_time, theta, out.buffer() );
+    else
+        make_snapshot( step, step_time, theta, out.buffer() );
+    out.submit();
+}
@@ -6,15 +6,40 @@ import os
 import shutil
 
 
+# binary snapshots (globr_{run}_*.snap), see include/snapshot.h: a 64 byte header,
+# then one float32 array per field, n values each, in initial conditions order.
+SNAP_HEADER = np.dtype([
+    ('magic', 'S8'), ('version', '<i4'), ('n', '<i4'), ('step', '<i4'), ('energies', '<i4'),
+    ('time', '<f8'), ('theta', '<f8'), ('size', '<f8'), ('kenergy', '<f8'), ('penergy', '<f8'),
+])
+SNAP_FIELDS = ['m', 'x', 'y', 'z', 'vx', 'vy', 'vz']
+
+
+def read_snapshot( fname: str ) :
+    """
+    memory maps a binary snapshot, nothing gets parsed or copied until it's used.
+
+    returns the header (time [s], size [m], energies [J], ...) and a dict of
+    float32 arrays in si units: m [kg], x y z [m], vx vy vz [m/s].
+    """
+    head = np.memmap(fname, dtype=SNAP_HEADER, mode='r', shape=(1,))[0]
+    if head['magic'] != b'GLOBRSNP':
+        raise ValueError(f'{fname} is not a globr snapshot')
+
+    n = int(head['n'])
+    data = np.memmap(fname, dtype='<f4', mode='r', offset=SNAP_HEADER.itemsize, shape=(len(SNAP_FIELDS), n))
+    return head, { f: data[k] for k, f in enumerate(SNAP_FIELDS) }
+
+
 def make_viz( datadir: str, rad_multiplier = 2) :
 
     OUTPATH = os.path.join('frames', datadir)
-    DATPATH = os.path.join('..', 'data', datadir, f'globr_{datadir}_*.dat')
+    DATPATH = os.path.join('..', 'data', datadir, f'globr_{datadir}_*')
 
     shutil.rmtree( OUTPATH, ignore_errors=True) # removes directory if exists already before rendering
     os.mkdir(  OUTPATH  )
     directory = f'{datadir}'
-    files = sorted(glob.glob(DATPATH))
+    files = sorted(glob.glob(DATPATH + '.snap')) or sorted(glob.glob(DATPATH + '.dat'))
 
     pv.OFF_SCREEN = True 
 
@@ -24,9 +49,14 @@ def make_viz( datadir: str, rad_multiplier = 2) :
     for i, fname in enumerate(files):
         plotter.clear()
 
-        data = np.loadtxt(fname, comments='#', skiprows=11)
-        mass = data[:,1]
-        xyz = data[:,2:5]
+        if fname.endswith('.snap'):
+            _, snap = read_snapshot(fname)
+            mass = snap['m']
+            xyz = np.column_stack((snap['x'], snap['y'], snap['z']))
+        else:
+            data = np.loadtxt(fname, comments='#', skiprows=11)
+            mass = data[:,1]
+            xyz = data[:,2:5]
 
         # create point cloud object
         cloud = pv.PolyData(xyz)
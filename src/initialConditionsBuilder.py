@@ -205,9 +205,15 @@ class initialConditions:
     
         Returns
         -------
-        posVels (array): array with the sampled phase-space positions
+        posVels (array): array with the sampled phase-space positions, x, y, z [m] and
+                         vx, vy, vz [m/s] whatever units R0 and Vmax come in
         """
         
+        # The samplers below drop the units, so everything goes to m and m/s first
+        R0 = u.Quantity(R0, u.m)
+        if Vmax is not None:
+            Vmax = u.Quantity(Vmax, u.m/u.s)
+
         # This builds a (unstable) uniform spherical distribution
         if model == 'uniform':
             positions       = randomUniformSpherical(n    = self.N,
@@ -223,7 +229,6 @@ class initialConditions:
             
             M   = (np.sum(self.masses)*u.Msun).to(u.kg)
             G   = const.G
-            R0  = R0.to(u.m)
             
             # Radii from the Plummer mass CDF: mr = M(r)/M = r^3/(r^2+a^2)^(3/2)
             mr  = np.random.uniform(size = self.N)
@@ -247,13 +252,41 @@ class initialConditions:
             # distribution. Hence:
             y = np.random.beta(1.5, 4.5, size=self.N)
             q = np.sqrt(y)
-            v = q*vesc
+            v = (q*vesc).to(u.m/u.s)
         
             # We built the velocities with random directions
             velocities = randomUniformSpherical(n    = self.N,
                                                 nDim = nDim,
                                                 R    = v)
         self.posVels    = np.concatenate([positions,velocities],axis=0)
+
+    def save(self,
+             fname,
+             binary  = True):
+        """
+        This method writes the initial conditions to a file that globr reads with --init:
+        seven rows x, y, z [m], vx, vy, vz [m/s], m [Msun] of N values each.
+    
+        Parameters
+        ----------
+        fname (str): output file.
+        binary (bool): if True, a binary file (16 byte header with the magic b'GLOBRIC',
+                       version 1 and N as int32, then the seven rows as little-endian
+                       float32) that loads without any parsing. if False, plain text.
+        """
+        data = np.concatenate([np.asarray(self.posVels,dtype=float),
+                               np.asarray(self.masses,dtype=float).reshape(1,-1)],axis=0)
+
+        if binary:
+            header = np.zeros(1,dtype=[('magic','S8'),('version','<i4'),('n','<i4')])
+            header['magic']     = b'GLOBRIC'
+            header['version']   = 1
+            header['n']         = data.shape[1]
+            with open(fname,'wb') as f:
+                f.write(header.tobytes())
+                f.write(data.astype('<f4').tobytes())
+        else:
+            np.savetxt(fname,data)
         
         
         
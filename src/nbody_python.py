@@ -14,6 +14,13 @@ def acceleration(system):
     # Again use the einsum method detailed in the reference document.
     # Note that this returns km s^-2.
 
+    # With a globr tree attached (see src/barnes-hut/python/globr.py) the C++ tree code does it instead, 
+    # straight from system.pos and into a new array, O(N log N) instead of O(N^2).
+    # globr has its own G and msun, so the masses are scaled to give the same G * m as here.
+    if system.tree is not None:
+        m = system.mlist * (G * msun / (system.tree.G * system.tree.MSUN))
+        return system.tree.accelerations(system.pos, m, theta = system.theta)
+
     # Initialize the acceleration array. 
     a = np.zeros((system.nparticles, 3))
 
@@ -132,14 +139,20 @@ def energy(system):
 # Class implementation for the nbody system
 class nbdsys:
 
-    def __init__(self, nparticles, mass_list = None, init_vel = None, init_pos = None, test = False) -> None:
+    def __init__(self, nparticles, mass_list = None, init_vel = None, init_pos = None, test = False, tree = None, theta = 0.5) -> None:
         """
         Initializes an object of the class nbdsys. 
         Note that nparticles has to be defined at the time of object generation; for others, the program provides a uniform distribution
         of 1 solar mass objects in n**(1/3) pc**3 with 0 initial velocity and uniformly random initial positions. 
 
         Note that after the list was put in, the stars will be recentered so that CoM is always at (0, 0, 0).
+
+        tree is an optional globr.Tree (src/barnes-hut/python/globr.py): if given, acceleration() asks the C++ tree code 
+        with opening angle theta instead of summing every pair in NumPy. 
         """
+
+        self.tree = tree
+        self.theta = theta
         
         # check if the lists are of appropriate size. 
         # ***********